@@ -4,7 +4,7 @@
  */
 
 #define _XOPEN_SOURCE 500
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 
 #include <unistd.h>
 #include <stdarg.h>
@@ -18,6 +18,16 @@
 #include <string.h>
 #include <sys/types.h>
 #include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "rl_lock_library.h"
 
@@ -26,10 +36,22 @@
  */
 static rl_all_files rla;
 
+/**
+ * @brief The number of tokens given to threads by `rl_bind_owner()`
+ */
+static atomic_ulong nb_thread_tokens;
+
+/**
+ * @brief The requests waiting in the queues of every file, NULL until the
+ * library is initialized
+ */
+static rl_wait_graph *wait_graph;
+
 /******************************************************************************/
 
 /**
- * @brief Initializes `pmutex` for process sync
+ * @brief Initializes `pmutex` for process sync, the mutex being robust so that
+ * it is not left locked forever by a process that dies while holding it
  * @param pmutex the mutex to initialize
  * @return 0 if the initialization was successfull, the error code otherwise
  */
@@ -43,18 +65,254 @@ static int initialize_mutex(pthread_mutex_t *pmutex) {
     code = pthread_mutexattr_setpshared(&mutexattr, PTHREAD_PROCESS_SHARED);
     if(code != 0)
         return code;
+    code = pthread_mutexattr_setrobust(&mutexattr, PTHREAD_MUTEX_ROBUST);
+    if (code != 0)
+        return code;
     return pthread_mutex_init(pmutex, &mutexattr);
 }
 
+/**
+ * @brief Initializes `pcond` for process sync, timed waits on `pcond` being
+ * measured with `CLOCK_MONOTONIC`
+ * @param pcond the condition variable to initialize
+ * @return 0 if the initialization was successfull, the error code otherwise
+ */
+static int initialize_cond(pthread_cond_t *pcond) {
+    pthread_condattr_t condattr;
+    int code;
+
+    code = pthread_condattr_init(&condattr);
+    if (code != 0)
+        return code;
+    code = pthread_condattr_setpshared(&condattr, PTHREAD_PROCESS_SHARED);
+    if (code != 0)
+        return code;
+    code = pthread_condattr_setclock(&condattr, CLOCK_MONOTONIC);
+    if (code != 0)
+        return code;
+    return pthread_cond_init(pcond, &condattr);
+}
+
+/**
+ * @brief Initializes `combiner` without any published request, its mutex being
+ * private to the process
+ * @param combiner the combiner to initialize
+ * @return 0 if the initialization was successfull, the error code otherwise
+ */
+static int initialize_combiner(rl_combiner *combiner) {
+    atomic_init(&combiner->requests, NULL);
+    return pthread_mutex_init(&combiner->mutex, NULL);
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Rounds `offset` up to a cache line, so that any structure can be
+ * stored at it and that the arrays start on their own cache line
+ * @param offset an offset in a shared memory object
+ * @return the aligned offset
+ */
+static size_t align_offset(size_t offset) {
+    size_t align = RL_CACHE_LINE_SIZE;
+    return (offset + align - 1) / align * align;
+}
+
+/**
+ * @brief Extends the shared memory object of `file` with a new region of
+ * `size` bytes at its end
+ *
+ * The object is only made bigger with `ftruncate()`: as every process maps
+ * `RL_SEGMENT_MAX_SIZE` bytes of it, the new region is visible to all of them
+ * at the same address as before, without remapping. This function does not use
+ * any locking mechanism.
+ *
+ * The regions left behind when the lock table, the owner pool or the PID map
+ * grow are never reused, as the readers that do not take the mutex of the file
+ * may still be reading them, and the increments of `map_try_increment()`
+ * writing to the old PID map. Since each of them doubles when it grows, the
+ * regions left behind take at most as much room as the live ones; they are
+ * freed with the object once the last process closes the file.
+ *
+ * @param file the file whose shared memory object is extended
+ * @param size the size of the new region
+ * @return the offset of the new region, 0 on error
+ */
+static size_t extend_segment(rl_open_file *file, size_t size) {
+    size_t offset = align_offset(file->size);
+    if (offset + size > RL_SEGMENT_MAX_SIZE) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    int fd = shm_open(file->shm_name, O_RDWR, 0);
+    if (fd == -1)
+        return 0;
+    int res = ftruncate(fd, offset + size);
+    close(fd);
+    if (res == -1)
+        return 0;
+
+    file->size = offset + size;
+    return offset;
+}
+
+/**
+ * @brief Gives the lock table of `file`
+ * @param file an open file
+ * @return the address of the first slot of the table
+ */
+static rl_lock *get_lock_table(rl_open_file *file) {
+    return (rl_lock *) ((char *) file + file->lock_table);
+}
+
+/**
+ * @brief Gives the lock index of `file`
+ * @param file an open file
+ * @return the address of the first entry of the index
+ */
+static int *get_lock_index(rl_open_file *file) {
+    return (int *) ((char *) file + file->lock_index);
+}
+
+/**
+ * @brief Gives the starts of the locks of `file`, in the order of its lock
+ * index
+ * @param file an open file
+ * @return the address of the start of the first lock
+ */
+static int64_t *get_lock_starts(rl_open_file *file) {
+    return (int64_t *) ((char *) file + file->lock_starts);
+}
+
+/**
+ * @brief Gives the ends of the locks of `file`, in the order of its lock index
+ * @param file an open file
+ * @return the address of the end of the first lock
+ */
+static int64_t *get_lock_ends(rl_open_file *file) {
+    return (int64_t *) ((char *) file + file->lock_ends);
+}
+
+/**
+ * @brief Gives the write masks of the locks of `file`, in the order of its
+ * lock index
+ * @param file an open file
+ * @return the address of the write mask of the first lock
+ */
+static int64_t *get_lock_writes(rl_open_file *file) {
+    return (int64_t *) ((char *) file + file->lock_writes);
+}
+
+/**
+ * @brief Copies the hot fields of `lck` to position `pos` of the field arrays
+ * of `file`
+ * @param file the file that contains the lock
+ * @param pos the position of `lck` in the lock index
+ * @param lck the lock
+ */
+static void set_lock_fields(rl_open_file *file, int pos, const rl_lock *lck) {
+    get_lock_starts(file)[pos] = lck->start;
+    get_lock_ends(file)[pos] = (lck->len == 0) ?
+        RL_END_OF_FILE : lck->start + lck->len;
+    get_lock_writes(file)[pos] = (lck->type == F_WRLCK) ? -1 : 0;
+}
+
+/**
+ * @brief Moves the entries of the lock index of `file` and of its field arrays
+ * from position `from` to position `to`
+ * @param file the file that contains the locks
+ * @param to the destination position
+ * @param from the source position
+ * @param nb the number of entries to move
+ */
+static void move_lock_entries(rl_open_file *file, int to, int from, int nb) {
+    memmove(&get_lock_index(file)[to], &get_lock_index(file)[from],
+            nb * sizeof(int));
+    memmove(&get_lock_starts(file)[to], &get_lock_starts(file)[from],
+            nb * sizeof(int64_t));
+    memmove(&get_lock_ends(file)[to], &get_lock_ends(file)[from],
+            nb * sizeof(int64_t));
+    memmove(&get_lock_writes(file)[to], &get_lock_writes(file)[from],
+            nb * sizeof(int64_t));
+}
+
+/**
+ * @brief Gives the lock at position `i` in the lock index of `file`
+ * @param file an open file
+ * @param i the position of the lock, from 0 to `file->nb_locks` - 1
+ * @return the address of the lock
+ */
+static rl_lock *get_lock(rl_open_file *file, int i) {
+    return &get_lock_table(file)[get_lock_index(file)[i]];
+}
+
+/**
+ * @brief Gives the owner pool of `file`
+ * @param file an open file
+ * @return the address of the first node of the pool
+ */
+static rl_owner_node *get_owner_pool(rl_open_file *file) {
+    return (rl_owner_node *) ((char *) file + file->owner_pool);
+}
+
+/**
+ * @brief Gives the PID map of `file`
+ * @param file an open file
+ * @return the address of the first entry of the map
+ */
+static rl_pid_fd_count *get_pid_map(rl_open_file *file) {
+    return (rl_pid_fd_count *) ((char *) file + file->pid_map);
+}
+
 /******************************************************************************/
 
+/**
+ * @brief Marks the beginning of a modification of the lock table or of the
+ * PID map of `file`
+ *
+ * The calls can be nested, only the outermost one makes `file->seq` odd so that
+ * the readers of `get_conflicting_lock()` and `map_try_increment()` retry until
+ * the file is consistent again. The mutex of the file must be held.
+ *
+ * @param file the file about to be modified
+ */
+static void begin_update(rl_open_file *file) {
+    if (file->update_depth++ > 0)
+        return;
+    unsigned long seq = atomic_load_explicit(&file->seq, memory_order_relaxed);
+    atomic_store_explicit(&file->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief Marks the end of a modification of the lock table or of the PID map
+ * of `file` started by `begin_update()`
+ * @param file the file that was modified
+ */
+static void end_update(rl_open_file *file) {
+    if (--file->update_depth > 0)
+        return;
+    unsigned long seq = atomic_load_explicit(&file->seq, memory_order_relaxed);
+    atomic_store_explicit(&file->seq, seq + 1, memory_order_release);
+}
+
 /**
  * @brief Checks if `map_entry` is free
  * @param map_entry the map entry to check
  * @return 1 if it is free, 0 otherwise
  */
 static int is_map_entry_free(rl_pid_fd_count *map_entry) {
-    return map_entry->pid == -1;
+    return map_entry->pid == RL_FREE_MAP_ENTRY;
+}
+
+/**
+ * @brief Checks if `map_entry` holds the fd count of a process
+ * @param map_entry the map entry to check
+ * @return 1 if it is neither free nor removed, 0 otherwise
+ */
+static int is_map_entry_used(rl_pid_fd_count *map_entry) {
+    return map_entry->pid != RL_FREE_MAP_ENTRY
+        && map_entry->pid != RL_REMOVED_MAP_ENTRY;
 }
 
 /**
@@ -62,36 +320,165 @@ static int is_map_entry_free(rl_pid_fd_count *map_entry) {
  * @param map_entry the map entry to free
  */
 static void erase_map_entry(rl_pid_fd_count *map_entry) {
-    map_entry->pid = -1;
+    map_entry->pid = RL_FREE_MAP_ENTRY;
+    atomic_init(&map_entry->fd_count, 0);
+}
+
+/**
+ * @brief Gives the first slot to look at for key `pid` in a PID map
+ * @param pid the key
+ * @param capacity the capacity of the map, a power of 2
+ * @return the index of the slot
+ */
+static int hash_pid(pid_t pid, int capacity) {
+    return (int) (((unsigned) pid * 2654435761u) & (unsigned) (capacity - 1));
+}
+
+/**
+ * @brief Looks for the entry of key `pid` in `map` by linear probing
+ * @param map the entries of a PID map
+ * @param capacity the capacity of the map, a power of 2
+ * @param pid the key of the entry
+ * @param slot where to put the first slot in which the key could be inserted,
+ * ignored if NULL
+ * @return the entry, NULL if there is none
+ */
+static rl_pid_fd_count *probe_map(rl_pid_fd_count *map, int capacity,
+        pid_t pid, rl_pid_fd_count **slot) {
+    if (slot != NULL)
+        *slot = NULL;
+    int i = hash_pid(pid, capacity);
+    for (int n = 0; n < capacity; n++, i = (i + 1) & (capacity - 1)) {
+        rl_pid_fd_count *cur = &map[i];
+        if (cur->pid == pid)
+            return cur;
+        if (slot != NULL && *slot == NULL && !is_map_entry_used(cur))
+            *slot = cur;
+        if (is_map_entry_free(cur))
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Gives the entry of key `pid` in the PID map of `file`
+ * @param file the file that contains the map
+ * @param pid the key of the entry
+ * @return the entry, NULL if there is none
+ */
+static rl_pid_fd_count *find_map_entry(rl_open_file *file, pid_t pid) {
+    return probe_map(get_pid_map(file), file->map_capacity, pid, NULL);
 }
 
 /**
- * @brief Moves the map entries of `file` in order to fit in the first
- * `file->nb_map_entries` cells of `file` PID map
+ * @brief Copies the entries of the PID map of `file` to a new map of the given
+ * capacity, at the end of the shared memory object
  *
- * This function does not use any locking mechanism, so be sure to have an
- * exclusive lock on the structure before organizing its entries in order to
- * preserve data integrity.
- *
- * @param file the file that contains the entries to organize
- * @return 0 if the entries were successfully organized, -1 on error
- */
-static int organize_map_entries(rl_open_file *file) {
-    for (int i = 0; i < file->nb_map_entries; i++) {
-        if (is_map_entry_free(&file->pid_map[i])) {
-            int j = i + 1;
-            while (j < RL_MAX_MAP_ENTRIES
-                    && is_map_entry_free(&file->pid_map[j]))
-                j++;
-            if (j >= RL_MAX_MAP_ENTRIES)
-                return -1;
-            file->pid_map[i] = file->pid_map[j];
-            erase_map_entry(&file->pid_map[j]);
-        }
+ * The removed entries are dropped. The fd counts of the old map are replaced by
+ * `RL_MOVED_FD_COUNT`, so that the processes updating them without the mutex
+ * notice that the map moved. This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the map
+ * @param capacity the capacity of the new map, a power of 2
+ * @return 0 on success, -1 on error
+ */
+static int rehash_map(rl_open_file *file, int capacity) {
+    size_t offset = extend_segment(file, capacity * sizeof(rl_pid_fd_count));
+    if (offset == 0)
+        return -1;
+
+    rl_pid_fd_count *map = (rl_pid_fd_count *) ((char *) file + offset);
+    for (int i = 0; i < capacity; i++)
+        erase_map_entry(&map[i]);
+
+    begin_update(file);
+    for (int i = 0; i < file->map_capacity; i++) {
+        rl_pid_fd_count *old = &get_pid_map(file)[i];
+        if (!is_map_entry_used(old))
+            continue;
+        rl_pid_fd_count *new;
+        probe_map(map, capacity, old->pid, &new);
+        new->first_held = old->first_held;
+        atomic_init(&new->fd_count,
+                atomic_exchange(&old->fd_count, RL_MOVED_FD_COUNT));
+        new->pid = old->pid;
     }
+    file->pid_map = offset;
+    file->map_capacity = capacity;
+    file->nb_removed_map_entries = 0;
+    end_update(file);
     return 0;
 }
 
+/**
+ * @brief Makes room in the PID map of `file` for one more entry
+ *
+ * The map is kept at most three quarters full, counting the removed entries
+ * that still lengthen the probe sequences. When it would be fuller, it is
+ * rehashed into a new map, twice as large if half of the entries are used.
+ * This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the map
+ * @return 0 on success, -1 on error
+ */
+static int reserve_map_entry(rl_open_file *file) {
+    int nb_used = file->nb_map_entries + file->nb_removed_map_entries + 1;
+    if (4 * nb_used <= 3 * file->map_capacity)
+        return 0;
+
+    int capacity = file->map_capacity;
+    if (2 * (file->nb_map_entries + 1) > capacity)
+        capacity *= 2;
+    return rehash_map(file, capacity);
+}
+
+/**
+ * @brief Adds an entry of key `pid` and value `fd_count` to the PID map of
+ * `file`
+ *
+ * The key must not be in the map already. This function does not use any
+ * locking mechanism.
+ *
+ * @param file the file that contains the map
+ * @param pid the key of the entry
+ * @param fd_count the value of the entry
+ * @return the entry, NULL on error
+ */
+static rl_pid_fd_count *insert_map_entry(rl_open_file *file, pid_t pid,
+        int fd_count) {
+    if (reserve_map_entry(file) == -1)
+        return NULL;
+
+    rl_pid_fd_count *entry;
+    probe_map(get_pid_map(file), file->map_capacity, pid, &entry);
+    if (entry == NULL)
+        return NULL;
+    if (entry->pid == RL_REMOVED_MAP_ENTRY)
+        file->nb_removed_map_entries--;
+    entry->first_held = RL_NO_OWNER;
+    atomic_store(&entry->fd_count, fd_count);
+    entry->pid = pid;
+    file->nb_map_entries++;
+    return entry;
+}
+
+/**
+ * @brief Removes `entry` from the PID map of `file`
+ *
+ * The slot is marked as removed rather than freed, so that the probe sequences
+ * that go through it are not cut. This function does not use any locking
+ * mechanism.
+ *
+ * @param file the file that contains the map
+ * @param entry the entry to remove
+ */
+static void remove_map_entry(rl_open_file *file, rl_pid_fd_count *entry) {
+    atomic_store(&entry->fd_count, 0);
+    entry->pid = RL_REMOVED_MAP_ENTRY;
+    file->nb_map_entries--;
+    file->nb_removed_map_entries++;
+}
+
 /**
  * @brief Increments the value of key `pid` in the PID-fd count map of
  * `file`, creating the entry if necessary
@@ -103,21 +490,10 @@ static int organize_map_entries(rl_open_file *file) {
  * @return 0 on success, -1 on error
  */
 static int map_increment(rl_open_file *file, pid_t pid) {
-    rl_pid_fd_count *entry = NULL;
-    for (int i = 0; i < file->nb_map_entries; i++)
-        if (file->pid_map[i].pid == pid)
-            entry = &file->pid_map[i];
-    
-    if (entry == NULL) {
-        if (file->nb_map_entries >= RL_MAX_MAP_ENTRIES)
-            return -1;
-        
-        file->pid_map[file->nb_map_entries].pid = pid;
-        file->pid_map[file->nb_map_entries].fd_count = 1;
-        file->nb_map_entries++;
-    } else
-        entry->fd_count++;
-
+    rl_pid_fd_count *entry = find_map_entry(file, pid);
+    if (entry == NULL)
+        return insert_map_entry(file, pid, 1) == NULL ? -1 : 0;
+    atomic_fetch_add(&entry->fd_count, 1);
     return 0;
 }
 
@@ -129,996 +505,4860 @@ static int map_increment(rl_open_file *file, pid_t pid) {
  *
  * @param file the file that contains the map
  * @param pid the key of the entry
- * @return 0 on success, -1 on error
+ * @return 1 if the entry was deleted, 0 if it was not, -1 on error
  */
 static int map_decrement(rl_open_file *file, pid_t pid) {
-    rl_pid_fd_count *entry = NULL;
-    for (int i = 0; i < file->nb_map_entries; i++)
-        if (file->pid_map[i].pid == pid)
-            entry = &file->pid_map[i];
-
+    rl_pid_fd_count *entry = find_map_entry(file, pid);
     if (entry == NULL)
         return -1;
-    else {
-        entry->fd_count--;
 
-        if (entry->fd_count == 0) {
-            erase_map_entry(entry);
-            file->nb_map_entries--;
-            if (organize_map_entries(file) < 0)
-                return -1;
+    /* the count only drops to 0 if no `map_try_increment()` got in between */
+    int fd_count = atomic_load(&entry->fd_count);
+    while (fd_count > 0) {
+        if (atomic_compare_exchange_weak(&entry->fd_count, &fd_count,
+                    fd_count - 1)) {
+            if (fd_count > 1)
+                return 0;
+            remove_map_entry(file, entry);
+            return 1;
         }
     }
+    return -1;
+}
+
+/**
+ * @brief Increments the value of key `pid` in the PID-fd count map of `file`
+ * without taking its mutex
+ *
+ * This only succeeds if the entry already exists. The map is found between two
+ * loads of `file->seq`, and the increment fails if the map moved in the
+ * meantime, as its old fd counts are then `RL_MOVED_FD_COUNT`.
+ *
+ * @param file the file that contains the map
+ * @param pid the key of the entry
+ * @return 1 if the value was incremented, 0 if the mutex must be taken to do so
+ */
+static int map_try_increment(rl_open_file *file, pid_t pid) {
+    unsigned long seq = atomic_load_explicit(&file->seq, memory_order_acquire);
+    if (seq & 1)
+        return 0;
+    size_t offset = file->pid_map;
+    int capacity = file->map_capacity;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&file->seq, memory_order_relaxed) != seq)
+        return 0;
 
+    rl_pid_fd_count *map = (rl_pid_fd_count *) ((char *) file + offset);
+    rl_pid_fd_count *entry = probe_map(map, capacity, pid, NULL);
+    if (entry == NULL)
+        return 0;
+    int fd_count = atomic_load(&entry->fd_count);
+    while (fd_count > 0) {
+        if (atomic_compare_exchange_weak(&entry->fd_count, &fd_count,
+                    fd_count + 1))
+            return 1;
+    }
     return 0;
 }
 
 /******************************************************************************/
 
 /**
- * @brief Checks if `owner` is free
- * @param owner the owner to check
- * @return 1 if it is free, 0 otherwise
+ * @brief Takes a node from the free list of the owner pool of `file`
+ *
+ * When the free list is empty, the capacity of the pool is doubled and the pool
+ * is copied to a new region at the end of the shared memory object, so the
+ * pointers to nodes of the pool must not be used after a call. This function
+ * does not use any locking mechanism.
+ *
+ * @param file the file that contains the owner pool
+ * @return the index of the node, `RL_NO_OWNER` on error
+ */
+static int alloc_owner_node(rl_open_file *file) {
+    if (file->free_owner == RL_NO_OWNER) {
+        int capacity = 2 * file->owner_capacity;
+        size_t offset = extend_segment(file, capacity * sizeof(rl_owner_node));
+        if (offset == 0)
+            return RL_NO_OWNER;
+
+        rl_owner_node *pool = (rl_owner_node *) ((char *) file + offset);
+        memcpy(pool, get_owner_pool(file),
+                file->owner_capacity * sizeof(rl_owner_node));
+        for (int i = file->owner_capacity; i < capacity; i++)
+            pool[i].next = (i + 1 < capacity) ? i + 1 : RL_NO_OWNER;
+        file->free_owner = file->owner_capacity;
+        file->owner_pool = offset;
+        file->owner_capacity = capacity;
+    }
+
+    int index = file->free_owner;
+    file->free_owner = get_owner_pool(file)[index].next;
+    return index;
+}
+
+/**
+ * @brief Gives the node at `index` back to the free list of the owner pool of
+ * `file`
+ *
+ * This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the owner pool
+ * @param index the index of the node to free
  */
-static int is_owner_free(rl_owner *owner) {
-    return owner != NULL && owner->fd == RL_FREE_OWNER;
+static void free_owner_node(rl_open_file *file, int index) {
+    get_owner_pool(file)[index].next = file->free_owner;
+    file->free_owner = index;
 }
 
 /**
- * @brief Erases `owner` if possible
- * @param owner the owner to erase
+ * @brief Gives the node at `index` in the owner pool of `file`
+ * @param file the file that contains the owner pool
+ * @param index the index of a node, possibly `RL_NO_OWNER`
+ * @return the node, NULL if `index` is `RL_NO_OWNER`
  */
-static void erase_owner(rl_owner *owner) {
-    if (owner != NULL) {
-        owner->pid = (pid_t) RL_FREE_OWNER;
-        owner->fd = RL_FREE_OWNER;
-    }
+static rl_owner_node *owner_node(rl_open_file *file, int index) {
+    if (index == RL_NO_OWNER)
+        return NULL;
+    return &get_owner_pool(file)[index];
 }
 
 /**
- * @brief Moves the owners of `lck` in order to fit in the first
- * `lck->nb_owners` cells of `lck` owner table
+ * @brief Links the node at `index` at the head of the list of the locks held
+ * by the process of its owner
  *
- * This function does not use any locking mechanism, so be sure to have an
- * exclusive lock on the structure before organizing its owners in order to
- * preserve data integrity.
+ * This function does not use any locking mechanism.
  *
- * @param lck the lck that contains the owners to organize
- * @return 0 if the owners were successfully organized, -1 on error
+ * @param file the file that contains the owner pool
+ * @param index the index of the node to link
+ * @return 0 on success, -1 if the process of the owner has not opened the file
  */
-static int organize_owners(rl_lock *lck) {
-    if (lck == NULL || lck->nb_owners < 0 || lck->nb_owners > RL_MAX_OWNERS)
+static int link_held(rl_open_file *file, int index) {
+    rl_owner_node *node = owner_node(file, index);
+    rl_pid_fd_count *entry = find_map_entry(file, node->owner.pid);
+    if (entry == NULL)
         return -1;
 
-    for (int i = 0; i < lck->nb_owners; i++) {
-        if (is_owner_free(&lck->lock_owners[i])) {
-            int j = i + 1;
-            while (j < RL_MAX_OWNERS && is_owner_free(&lck->lock_owners[j]))
-                j++;
-            if (j >= RL_MAX_OWNERS)
-                return -1;
-            lck->lock_owners[i] = lck->lock_owners[j];
-            erase_owner(&lck->lock_owners[j]);
-        }
-    }
+    node->prev_held = RL_NO_OWNER;
+    node->next_held = entry->first_held;
+    if (entry->first_held != RL_NO_OWNER)
+        owner_node(file, entry->first_held)->prev_held = index;
+    entry->first_held = index;
     return 0;
 }
 
 /**
- * @brief Checks if the owners are equal
- * @param o1 the first owner
- * @param o2 the second owner
- * @return 1 if they are equal, that is if o1.pid == o2.pid && o1.fd == o2.fd,
- * 0 otherwise
+ * @brief Unlinks the node at `index` from the list of the locks held by the
+ * process of its owner
+ *
+ * This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the owner pool
+ * @param index the index of the node to unlink
  */
-static int equals(rl_owner o1, rl_owner o2) {
-    return o1.pid == o2.pid && o1.fd == o2.fd;
+static void unlink_held(rl_open_file *file, int index) {
+    rl_owner_node *node = owner_node(file, index);
+    if (node->prev_held != RL_NO_OWNER)
+        owner_node(file, node->prev_held)->next_held = node->next_held;
+    else {
+        rl_pid_fd_count *entry = find_map_entry(file, node->owner.pid);
+        if (entry != NULL && entry->first_held == index)
+            entry->first_held = node->next_held;
+    }
+    if (node->next_held != RL_NO_OWNER)
+        owner_node(file, node->next_held)->prev_held = node->prev_held;
 }
 
-/******************************************************************************/
-
 /**
- * @brief Erases `lck` if possible
- * @param lck the lock to erase
+ * @brief Checks if the owners are equal
+ * @param o1 the first owner
+ * @param o2 the second owner
+ * @return 1 if they are equal, that is if o1.pid == o2.pid && o1.fd == o2.fd
+ * && o1.token == o2.token, 0 otherwise
  */
-static void erase_lock(rl_lock *lck) {
-    if (lck != NULL)
-        lck->start = RL_FREE_LOCK;
+static int equals(rl_owner o1, rl_owner o2) {
+    return o1.pid == o2.pid && o1.fd == o2.fd && o1.token == o2.token;
 }
 
 /**
- * @brief Checks if `lck` is free
- * @param lck the lock to check
- * @return 1 if `lck` is free, 0 otherwise
+ * @brief Gives the owner of the locks applied through `lfd` by the calling
+ * process
+ * @param lfd the descriptor through which the locks are applied
+ * @return the owner `{getpid(), lfd.fd, lfd.token}`
  */
-static int is_lock_free(rl_lock *lck) {
-    return lck != NULL && lck->start == RL_FREE_LOCK;
+static rl_owner get_owner(rl_descriptor lfd) {
+    rl_owner owner = {.pid = getpid(), .fd = lfd.fd, .token = lfd.token};
+    return owner;
 }
 
 /**
- * @brief Moves the locks of `file` in order to fit in the first
- * `file->nb_locks` cells of `file` lock table
+ * @brief Adds `new` to the owners of `lck`
  *
- * This function does not use any locking mechanism, so be sure to have an
- * exclusive lock on the structure before organizing its lock in order to
- * preserve data integrity.
+ * The owner is stored in a node of the owner pool of `file`, linked both to
+ * the other owners of `lck` and to the other locks held by the process of
+ * `new`, which must have opened the file. `lck` must be a lock of the lock
+ * table of `file`.
  *
- * @param file the file that contains the locks to organize
- * @return 0 if the locks were successfully organized, -1 on error
+ * @param file the file that contains `lck`
+ * @param new the owner to add
+ * @param lck the lock to which to add the new owner
+ * @return 0 if `new` was succesfully added, -1 if it could not be added
  */
-static int organize_locks(rl_open_file *file) {
-    if (file == NULL || file->nb_locks < 0 || file->nb_locks > RL_MAX_LOCKS)
+static int add_owner(rl_open_file *file, rl_owner new, rl_lock *lck) {
+    if (new.pid < 0 || new.fd < 0 || lck == NULL)
         return -1;
 
-    for (int i = 0; i < file->nb_locks; i++) {
-        if (is_lock_free(&file->lock_table[i])) {
-            int j = i + 1;
-            while (j < RL_MAX_LOCKS && is_lock_free(&file->lock_table[j]))
-                j++;
-            if (j >= RL_MAX_LOCKS)
-                return -1;
-            file->lock_table[i] = file->lock_table[j];
-            erase_lock(&file->lock_table[j]);
-        }
+    int index = alloc_owner_node(file);
+    if (index == RL_NO_OWNER)
+        return -1;
+    rl_owner_node *node = owner_node(file, index);
+    node->owner = new;
+    node->start = lck->start;
+    node->len = lck->len;
+    node->type = lck->type;
+    if (link_held(file, index) == -1) {
+        free_owner_node(file, index);
+        return -1;
     }
+    node->next = lck->first_owner;
+    lck->first_owner = index;
+    lck->nb_owners++;
     return 0;
 }
 
 /**
- * @brief Converts `from` into a `struct flock` and puts the result in `to`
- * @param from the original `rl_lock`
- * @param to the conversion of `from` to a `struct flock`
- * @return 0 on success, -1 on error
- */
-static void rl_lock_to_flock(const rl_lock *from, struct flock *to) {
-    to->l_type = from->type;
-    to->l_whence = SEEK_SET;
-    to->l_start = from->start;
-    to->l_len = from->len;
-}
-
-/******************************************************************************/
-
-/**
- * @brief Deletes every owner that matches the given criteria in the given file
+ * @brief Removes from the owners of `lck` every owner that matches the given
+ * criteria
  *
- * This function does not use any locking mechanism. If `crit` returns a value
- * > 0, the owner given as first parameter of the function is erased from the
- * lock owners table of the currently considered lock of the file. If `crit`
- * returns 0, nothing is done. If it returns -1, the function quits on error.
- * After each removal, the owners in the lock owner table are reorganized, so as
- * the locks if there are no owners left.
+ * `crit` is called with each owner of `lck` as first parameter and
+ * `owner_crit` as second parameter, the owner being removed if it returns a
+ * value > 0. The nodes of the removed owners go back to the owner pool of
+ * `file`. If no owner is left, the lock must be erased by the caller. This
+ * function does not use any locking mechanism.
  *
- * @param file the file that contains the lock owners to remove
+ * @param file the file that contains `lck`
+ * @param lck the lock whose owners to remove
  * @param crit a function that take two lock owners and returns an integer
  * @param owner_crit the owner used as second parameter of `crit`
- * @return 0 if the owner removal was succesful, -1 on error.
+ * @return the number of removed owners, -1 if `crit` returned -1
  */
-static int delete_owner_on_criteria(rl_open_file *file,
+static int remove_owners(rl_open_file *file, rl_lock *lck,
         int (*crit)(rl_owner, rl_owner), rl_owner owner_crit) {
-    if (crit == NULL || file == NULL)
-        return -1;
-
-    int locks_count = file->nb_locks;
-    for (int i = 0; i < file->nb_locks; i++) {
-        int owners_count = file->lock_table[i].nb_owners;
-        for (int j = 0; j < file->lock_table[i].nb_owners; j++) {
-            rl_owner *cur = &file->lock_table[i].lock_owners[j];
-            int res = crit(*cur, owner_crit);
-            if (res > 0) {
-                erase_owner(cur);
-                owners_count--;
-            } else if (res == -1)
-                return -1;
-        }
-        file->lock_table[i].nb_owners = owners_count;
-        if (organize_owners(&file->lock_table[i]) < 0)
+    int nb_removed = 0;
+    int *link = &lck->first_owner;
+    while (*link != RL_NO_OWNER) {
+        int index = *link;
+        rl_owner_node *cur = owner_node(file, index);
+        int res = crit(cur->owner, owner_crit);
+        if (res == -1)
             return -1;
-        if (owners_count == 0) {
-            erase_lock(&file->lock_table[i]);
-            locks_count--;
-        }
+        if (res > 0) {
+            *link = cur->next;
+            unlink_held(file, index);
+            free_owner_node(file, index);
+            nb_removed++;
+        } else
+            link = &cur->next;
+    }
+
+    lck->nb_owners -= nb_removed;
+    return nb_removed;
+}
+
+/**
+ * @brief Checks if `owner` is an owner of `lck`
+ * @param file the file that contains `lck`
+ * @param owner the owner that might own `lck`
+ * @param lck the lock that might be owned by `owner`
+ * @return 1 if `owner` is an owner of `lck`, 0 if it is not
+ */
+static int is_owner_of(rl_open_file *file, rl_owner owner, rl_lock *lck) {
+    for (rl_owner_node *cur = owner_node(file, lck->first_owner);
+            cur != NULL; cur = owner_node(file, cur->next)) {
+        if (equals(owner, cur->owner))
+            return 1;
     }
-    file->nb_locks = locks_count;
-    if (organize_locks(file) < 0)
-        return -1;
     return 0;
 }
 
 /******************************************************************************/
 
 /**
- * @brief Puts in `buffer` the name of the shm corresponding to `fd`
- * @param fd a file descriptor associated to a regular file
- * @param buffer a memory zone big enough for the shm name
- * @return 0 on success, -1 on error
+ * @brief Erases `lck` if possible
+ * @param lck the lock to erase
  */
-static int get_shm_name(int fd, char *buffer) {
-    struct stat st;
-    if (fstat(fd, &st))
-        return -1;
-    
-    int sprintf_res = sprintf(buffer, "/%s_%lu_%lu", SHM_PREFIX,
-            st.st_dev, st.st_ino);
-    if (sprintf_res < 0)
-        return -1;
-    
-    return 0;
+static void erase_lock(rl_lock *lck) {
+    if (lck != NULL)
+        lck->start = RL_FREE_LOCK;
 }
 
 /**
- * @brief Closes the given locked file descriptor
+ * @brief Checks if `lck` is free
+ * @param lck the lock to check
+ * @return 1 if `lck` is free, 0 otherwise
+ */
+static int is_lock_free(rl_lock *lck) {
+    return lck != NULL && lck->start == RL_FREE_LOCK;
+}
+
+/**
+ * @brief Checks if the segment [s1, s1 + l1[ and [s2, s2 + l2[ overlap
  *
- * This function removes from each lock of the descripted open file the owner
- * `{getpid(), lfd.fd}` if present. After deletion, the lock owners of each lock
- * are reorganized, as each lock of the lock table of the open file description.
- * The `close()` operation is made only if the previous operations are
- * successful.
+ * If l1 or l2 equal 0, the segment is extensible, which would make the segment
+ * as follows: [s*, inf[
  *
- * @param lfd the locked file descriptor to close
- * @return 0 if `lfd` was successfully closed, -1 on error
+ * @param s1 the start of the first segment
+ * @param l1 the length of the first segment, 0 if extensible
+ * @param s2 the start of the second segment
+ * @param l2 the length of the second segment, 0 if extensible
+ * @return 1 if the segments overlap, 0 otherwise
  */
-int rl_close(rl_descriptor lfd) {
-    /* check descriptor validity */
-    if (lfd.fd < 0 || lfd.file == NULL)
-        return -1;
+static int seg_overlap(off_t s1, off_t l1, off_t s2, off_t l2) {
+    if (l1 == 0)
+        return (l2 == 0) || (l2 > 0 && s2 + l2 - 1 >= s1);
 
-    /* take lock on open file */
-    int err = pthread_mutex_lock(&lfd.file->mutex);
-    if (err != 0)
-        return -1;
+    if (s2 >= s1)
+        return s2 < s1 + l1;
+    else
+        return l2 == 0 || s2 + l2 > s1;
+}
 
-    rl_owner lfd_owner = {.pid = getpid(), .fd = lfd.fd};
-    if (delete_owner_on_criteria(lfd.file, equals, lfd_owner) < 0)
-        return -1;
+/**
+ * @brief Checks if the lock at position `pos` comes before the key
+ * (start, len) in the lock index of `file`
+ *
+ * The lock index of a file is sorted by start, the finite locks coming before
+ * the extensible ones. Only whether `len` is 0 matters in the key.
+ *
+ * @param file the file that contains the lock
+ * @param pos the position of the lock to compare
+ * @param start the start of the key
+ * @param len the length of the key, 0 if extensible
+ * @return 1 if the lock comes before the key, 0 otherwise
+ */
+static int lock_before(rl_open_file *file, int pos, off_t start, off_t len) {
+    int extensible = get_lock_ends(file)[pos] == RL_END_OF_FILE;
+    if (extensible != (len == 0))
+        return len == 0;
+    return get_lock_starts(file)[pos] < start;
+}
 
-    char shm_name[256];
-    if (get_shm_name(lfd.fd, shm_name))
-        return -1;
+/**
+ * @brief Finds by binary search the first of the `nb_locks` first locks of
+ * `file` that does not come before the key (start, len)
+ * @param file the file that contains the sorted lock table
+ * @param nb_locks the number of locks to search
+ * @param start the start of the key
+ * @param len the length of the key, 0 if extensible
+ * @return the index of the lock found, `nb_locks` if there is none
+ */
+static int lower_bound(rl_open_file *file, int nb_locks, off_t start,
+        off_t len) {
+    int low = 0, high = nb_locks;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (lock_before(file, mid, start, len))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
 
-    if (close(lfd.fd) == -1)
-        return -1;
+/**
+ * @brief The indexes of the locks of a file that may overlap a segment
+ *
+ * The candidates are the finite locks in [finite_first, finite_end[ and the
+ * extensible locks in [ext_first, end[. They are iterated with
+ * `window_begin()` and `window_next()`.
+ */
+typedef struct {
+    int finite_first; /**< The first finite candidate */
+    int finite_end; /**< The index after the last finite candidate */
+    int ext_first; /**< The first extensible candidate */
+    int end; /**< The index after the last extensible candidate */
+} rl_window;
 
-    if (map_decrement(lfd.file, getpid()))
-        return -1;
+/**
+ * @brief Computes the locks among the `nb_locks` first locks of `file` that
+ * may overlap the segment (start, len)
+ *
+ * A finite lock can only overlap the segment if it starts less than
+ * `file->max_len` bytes before it, and an extensible lock if it starts before
+ * its end. The window is found in O(log n) and contains the k overlapping locks
+ * plus the finite locks that start close enough but end before `start`.
+ *
+ * @param file the file that contains the sorted lock table
+ * @param nb_locks the number of locks in the lock table
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @param window where to put the candidates
+ */
+static void find_window(rl_open_file *file, int nb_locks, off_t start,
+        off_t len, rl_window *window) {
+    window->ext_first = lower_bound(file, nb_locks, -1, 0);
+    window->finite_first = lower_bound(file, window->ext_first,
+            start - file->max_len + 1, 1);
+    if (len == 0) {
+        window->finite_end = window->ext_first;
+        window->end = nb_locks;
+    } else {
+        window->finite_end = lower_bound(file, window->ext_first, start + len,
+                1);
+        window->end = lower_bound(file, nb_locks, start + len, 0);
+    }
+}
 
-    int unlink_shm = 1;
-    int new_nb_map_entries = lfd.file->nb_map_entries;
-    for (int i = 0; i < lfd.file->nb_map_entries; i++) {
-        rl_pid_fd_count *entry = &lfd.file->pid_map[i];
-        if (kill(entry->pid, 0) == -1 && errno == ESRCH) {
-            erase_map_entry(entry);
-            new_nb_map_entries--;
-        } else
-            unlink_shm = 0;
+/**
+ * @brief Gives the index of the first candidate of `window`
+ * @param window the candidates
+ * @return the index of the first candidate, `window->end` if there is none
+ */
+static int window_begin(const rl_window *window) {
+    if (window->finite_first < window->finite_end)
+        return window->finite_first;
+    return window->ext_first;
+}
+
+/**
+ * @brief Gives the index of the candidate of `window` following the one at `i`
+ * @param window the candidates
+ * @param i the index of a candidate
+ * @return the index of the next candidate, `window->end` if there is none
+ */
+static int window_next(const rl_window *window, int i) {
+    i++;
+    return i == window->finite_end ? window->ext_first : i;
+}
+
+/**
+ * @brief Gives the first of the locks in [first; end[ that conflicts with a
+ * request on [start; stop[, scanning one lock at a time
+ *
+ * A lock conflicts if it overlaps the request and, unless `any` is -1, if it
+ * is a write lock.
+ *
+ * @param starts the starts of the locks
+ * @param ends the ends of the locks, `RL_END_OF_FILE` if extensible
+ * @param writes the write masks of the locks, -1 for a write lock, 0 otherwise
+ * @param first the first position to scan
+ * @param end the position after the last one to scan
+ * @param start the start of the request
+ * @param stop the end of the request, `RL_END_OF_FILE` if extensible
+ * @param any -1 if the request is a write lock, 0 otherwise
+ * @return the position of the lock, `end` if there is none
+ */
+static int scan_conflicts_scalar(const int64_t *starts, const int64_t *ends,
+        const int64_t *writes, int first, int end, int64_t start, int64_t stop,
+        int64_t any) {
+    for (int i = first; i < end; i++) {
+        if (starts[i] < stop && start < ends[i] && (writes[i] | any))
+            return i;
     }
-    lfd.file->nb_map_entries = new_nb_map_entries;
-    if (organize_map_entries(lfd.file))
-        return -1;
+    return end;
+}
 
-    if (msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
-        return -1;
-    err = pthread_mutex_unlock(&lfd.file->mutex);
-    if (err != 0)
-        return -1;
+#if defined(__GNUC__) && defined(__x86_64__)
+/**
+ * @brief Same as `scan_conflicts_scalar()`, scanning two locks at a time with
+ * SSE4.2
+ */
+__attribute__((target("sse4.2")))
+static int scan_conflicts_sse42(const int64_t *starts, const int64_t *ends,
+        const int64_t *writes, int first, int end, int64_t start, int64_t stop,
+        int64_t any) {
+    __m128i vstart = _mm_set1_epi64x(start);
+    __m128i vstop = _mm_set1_epi64x(stop);
+    __m128i vany = _mm_set1_epi64x(any);
+    int i = first;
+    for (; i + 2 <= end; i += 2) {
+        __m128i s = _mm_loadu_si128((const __m128i *) &starts[i]);
+        __m128i e = _mm_loadu_si128((const __m128i *) &ends[i]);
+        __m128i w = _mm_loadu_si128((const __m128i *) &writes[i]);
+        __m128i hit = _mm_and_si128(_mm_cmpgt_epi64(vstop, s),
+                _mm_cmpgt_epi64(e, vstart));
+        hit = _mm_and_si128(hit, _mm_or_si128(w, vany));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(hit));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    return scan_conflicts_scalar(starts, ends, writes, i, end, start, stop,
+            any);
+}
 
-    if (unlink_shm) {
-        if (shm_unlink(shm_name))
-            return -1;
+/**
+ * @brief Same as `scan_conflicts_scalar()`, scanning four locks at a time with
+ * AVX2
+ */
+__attribute__((target("avx2")))
+static int scan_conflicts_avx2(const int64_t *starts, const int64_t *ends,
+        const int64_t *writes, int first, int end, int64_t start, int64_t stop,
+        int64_t any) {
+    __m256i vstart = _mm256_set1_epi64x(start);
+    __m256i vstop = _mm256_set1_epi64x(stop);
+    __m256i vany = _mm256_set1_epi64x(any);
+    int i = first;
+    for (; i + 4 <= end; i += 4) {
+        __m256i s = _mm256_loadu_si256((const __m256i *) &starts[i]);
+        __m256i e = _mm256_loadu_si256((const __m256i *) &ends[i]);
+        __m256i w = _mm256_loadu_si256((const __m256i *) &writes[i]);
+        __m256i hit = _mm256_and_si256(_mm256_cmpgt_epi64(vstop, s),
+                _mm256_cmpgt_epi64(e, vstart));
+        hit = _mm256_and_si256(hit, _mm256_or_si256(w, vany));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(hit));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
     }
-    
-    return 0;
+    return scan_conflicts_scalar(starts, ends, writes, i, end, start, stop,
+            any);
 }
+#endif
 
-/******************************************************************************/
+/**
+ * @brief The kernel used to scan the locks for conflicts, chosen by
+ * `rl_init_library()` according to the instruction sets of the CPU
+ */
+static int (*scan_conflicts)(const int64_t *, const int64_t *,
+        const int64_t *, int, int, int64_t, int64_t, int64_t)
+    = scan_conflicts_scalar;
 
 /**
- * @brief Initializes the library
- * 
- * You must call this function before using the library.
+ * @brief Gives the first candidate of `window` from position `i` that
+ * conflicts with a lock of type `type` on the segment (start, len)
  *
- * @return always 0
+ * The candidates are scanned on the field arrays of `file`, several at a time
+ * if the CPU allows it, so the owners of the lock found are not checked.
+ *
+ * @param file the file that contains the locks
+ * @param window the candidates
+ * @param i a candidate, `window->end` if there is none
+ * @param type the type of the request (F_RDLCK, F_WRLCK)
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @return the position of the lock, `window->end` if there is none
  */
-int rl_init_library() {
-    rla.nb_files = 0;
-    for (int i = 0; i < RL_MAX_FILES; i++)
-        rla.open_files[i] = RL_FREE_FILE;
-    return 0;
+static int next_conflict(rl_open_file *file, const rl_window *window, int i,
+        short type, off_t start, off_t len) {
+    int64_t stop = (len == 0) ? RL_END_OF_FILE : start + len;
+    int64_t any = (type == F_WRLCK) ? -1 : 0;
+    if (i < window->finite_end) {
+        int pos = scan_conflicts(get_lock_starts(file), get_lock_ends(file),
+                get_lock_writes(file), i, window->finite_end, start, stop, any);
+        if (pos < window->finite_end)
+            return pos;
+        i = window->ext_first;
+    }
+    return scan_conflicts(get_lock_starts(file), get_lock_ends(file),
+            get_lock_writes(file), i, window->end, start, stop, any);
 }
 
-/******************************************************************************/
+/**
+ * @brief Computes the range of buckets covered by the segment (start, len)
+ *
+ * Bucket `i` covers the offsets `o` such that
+ * `(o / bucket_size) % nb_buckets == i`. If the segment is extensible or spans
+ * all the buckets, every bucket is covered.
+ *
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @param bucket_size the number of bytes of a bucket
+ * @param nb_buckets the number of buckets
+ * @param first where to put the first covered bucket
+ * @return the number of covered buckets, starting from `first` and wrapping
+ * around
+ */
+static int get_buckets(off_t start, off_t len, off_t bucket_size,
+        int nb_buckets, int *first) {
+    off_t first_block = start / bucket_size;
+    *first = first_block % nb_buckets;
+    if (len == 0)
+        return nb_buckets;
+    off_t nb_blocks = (start + len - 1) / bucket_size - first_block + 1;
+    return nb_blocks > nb_buckets ? nb_buckets : nb_blocks;
+}
 
 /**
- * @brief Adds the given open file to the open file descriptions of this process
- * if it is not already there
+ * @brief Records in the version buckets of `file` that the write lock `lck`
+ * was added (`delta` = 1) or removed (`delta` = -1)
  *
- * Fails if rla is full and rlo must be added
+ * The version of every bucket covered by the lock is incremented so that the
+ * optimistic reads of `rl_read_begin()` on these buckets fail to validate.
  *
- * @param rlo the open file to add
- * @return 0 on success, -1 on error
+ * @param file the file that contains the lock
+ * @param lck the added or removed lock, ignored if it is not a write lock
+ * @param delta 1 if the lock was added, -1 if it was removed
  */
-static int add_to_rla(rl_open_file *rlo) {
-    for (int i = 0; i < rla.nb_files; i++)
-        if (rla.open_files[i] == rlo)
-            return 0;
+static void mark_versions(rl_open_file *file, rl_lock *lck, int delta) {
+    if (lck->type != F_WRLCK)
+        return;
+
+    int first;
+    int nb_buckets = get_buckets(lck->start, lck->len, RL_VERSION_BUCKET_SIZE,
+            RL_NB_VERSION_BUCKETS, &first);
+    for (int i = 0; i < nb_buckets; i++) {
+        rl_version_bucket *bucket
+            = &file->buckets[(first + i) % RL_NB_VERSION_BUCKETS];
+        atomic_fetch_add(&bucket->nb_writers, delta);
+        atomic_fetch_add(&bucket->version, 1);
+    }
+}
 
-    if (rla.nb_files >= RL_MAX_FILES)
-        return -1;
+/**
+ * @brief Records in the occupancy summary and the version buckets of `file`
+ * that `lck` was added (`delta` = 1) or removed (`delta` = -1)
+ *
+ * @param file the file that contains the lock
+ * @param lck the added or removed lock
+ * @param delta 1 if the lock was added, -1 if it was removed
+ */
+static void mark_lock(rl_open_file *file, rl_lock *lck, int delta) {
+    rl_occupancy *occupancy = &file->occupancy;
+    int first;
+    int nb_buckets = get_buckets(lck->start, lck->len,
+            RL_OCCUPANCY_BUCKET_SIZE, RL_NB_OCCUPANCY_BUCKETS, &first);
+    if (nb_buckets == RL_NB_OCCUPANCY_BUCKETS) {
+        if (lck->type == F_WRLCK)
+            occupancy->nb_wide_writers += delta;
+        else
+            occupancy->nb_wide_readers += delta;
+    } else {
+        int *counts = (lck->type == F_WRLCK) ?
+            occupancy->nb_writers : occupancy->nb_readers;
+        for (int i = 0; i < nb_buckets; i++)
+            counts[(first + i) % RL_NB_OCCUPANCY_BUCKETS] += delta;
+    }
+    if (lck->type == F_WRLCK)
+        occupancy->nb_write_locks += delta;
+    mark_versions(file, lck, delta);
+}
+
+/**
+ * @brief Checks on the occupancy summary of `file` whether a lock of type
+ * `type` on the segment (start, len) may conflict with a lock of the file
+ *
+ * A request only needs the lock table to be scanned if a lock of a conflicting
+ * type is on one of the buckets it covers, without regard to the owners of the
+ * locks. When the request covers more buckets than there are locks, the scan is
+ * cheaper than the check and the function answers that a conflict is possible.
+ *
+ * @param file the file that contains the locks
+ * @param type the type of the request (F_RDLCK, F_WRLCK)
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @return 0 if no lock can conflict with the request, 1 otherwise
+ */
+static int may_conflict(rl_open_file *file, short type, off_t start,
+        off_t len) {
+    rl_occupancy *occupancy = &file->occupancy;
+    if (file->nb_locks == 0)
+        return 0;
+    if (occupancy->nb_wide_writers > 0
+            || (type == F_WRLCK && occupancy->nb_wide_readers > 0))
+        return 1;
 
-    rla.open_files[rla.nb_files] = rlo;
-    rla.nb_files++;
+    int first;
+    int nb_buckets = get_buckets(start, len, RL_OCCUPANCY_BUCKET_SIZE,
+            RL_NB_OCCUPANCY_BUCKETS, &first);
+    if (nb_buckets > file->nb_locks)
+        return 1;
+    for (int i = 0; i < nb_buckets; i++) {
+        int bucket = (first + i) % RL_NB_OCCUPANCY_BUCKETS;
+        if (occupancy->nb_writers[bucket] > 0
+                || (type == F_WRLCK && occupancy->nb_readers[bucket] > 0))
+            return 1;
+    }
     return 0;
 }
 
 /**
- * @brief Opens the file at the given path
+ * @brief Removes the erased locks from the lock index of `file`
  *
- * Opens `path` with the open() system call (identical parameters). Also does
- * the memory projection of the `rl_open_file` associated with the file at path,
- * creating the shared memory object if it doesn't exist. Returns the
- * corresponding `rl_descriptor`.
+ * The index is packed in a single pass that keeps the order of the locks, the
+ * slots of the erased locks go back to the free list of the lock table, and
+ * `file->nb_locks` and `file->max_len` are updated. The locks are erased by
+ * their callers without being counted, and must stay in the index until this
+ * function is called, so that its binary searches still work on the locks
+ * that are not erased. This function does not use any locking mechanism, so be
+ * sure to have an exclusive lock on the structure before organizing its lock in
+ * order to preserve data integrity.
  *
- * @param path the relative or absolute path to the file
- * @param oflag the flags passed to `open()`
- * @param ... the mode (permissions) for the new file, required if O_CREAT flag
- *            is specified
- * @return the rl_descriptor containing the file descriptor returned by open()
- *         and a pointer to the rl_open_file associated to the file, or an
- *         rl_descriptor containing fd -1 and rl_open_file pointer NULL on error
+ * @param file the file that contains the locks to organize
+ * @return 0 if the locks were successfully organized, -1 on error
  */
-rl_descriptor rl_open(const char *path, int oflag, ...) {
-    rl_descriptor err_desc = {.fd = -1, .file = NULL};
+static int organize_locks(rl_open_file *file) {
+    if (file == NULL || file->nb_locks < 0
+            || file->nb_locks > file->lock_capacity)
+        return -1;
 
-    if (rla.nb_files >= RL_MAX_FILES) {
-        errno = EMFILE;
-        return err_desc;
+    int *index = get_lock_index(file);
+    int nb_locks = 0;
+    file->max_len = 0;
+    for (int i = 0; i < file->nb_locks; i++) {
+        rl_lock *cur = &get_lock_table(file)[index[i]];
+        if (is_lock_free(cur)) {
+            cur->first_owner = file->free_lock;
+            file->free_lock = index[i];
+            continue;
+        }
+        if (nb_locks < i)
+            move_lock_entries(file, nb_locks, i, 1);
+        nb_locks++;
+        if (cur->len > file->max_len)
+            file->max_len = cur->len;
     }
-    
-    va_list va;
-    va_start(va, oflag);
+    file->nb_locks = nb_locks;
+    return 0;
+}
 
-    int open_res;
-    if (oflag & O_CREAT)
-        open_res = open(path, oflag, va_arg(va, mode_t));
-    else
-        open_res = open(path, oflag);
+/******************************************************************************/
 
-    va_end(va);
+/**
+ * @brief Makes the lock table of `file` big enough for `nb_locks` locks
+ *
+ * When the table is full, its capacity is doubled until it fits. The table and
+ * the index are copied to new regions at the end of the shared memory object,
+ * the new slots being added to the free list. The old regions are left as is,
+ * so that the readers of `get_conflicting_lock()` still read valid memory until
+ * they notice the modification. This function does not use any locking
+ * mechanism, and the pointers to locks of `file` must not be used after a
+ * call.
+ *
+ * @param file the file that contains the lock table
+ * @param nb_locks the number of locks the table must be able to hold
+ * @return 0 on success, -1 on error
+ */
+static int reserve_locks(rl_open_file *file, int nb_locks) {
+    if (nb_locks <= file->lock_capacity)
+        return 0;
 
-    if (open_res == -1)
-        return err_desc;
+    int capacity = 2 * file->lock_capacity;
+    while (capacity < nb_locks)
+        capacity *= 2;
+    size_t offset = extend_segment(file, capacity * sizeof(rl_lock));
+    if (offset == 0)
+        return -1;
+    size_t index_offset = extend_segment(file, capacity * sizeof(int));
+    if (index_offset == 0)
+        return -1;
+    size_t fields_offset[3];
+    for (int i = 0; i < 3; i++) {
+        fields_offset[i] = extend_segment(file, capacity * sizeof(int64_t));
+        if (fields_offset[i] == 0)
+            return -1;
+    }
 
-    char shm_path[256];
-    if (get_shm_name(open_res, shm_path)) {
-        close(open_res);
-        return err_desc;
+    rl_lock *locks = (rl_lock *) ((char *) file + offset);
+    memcpy(locks, get_lock_table(file),
+            file->lock_capacity * sizeof(rl_lock));
+    for (int i = file->lock_capacity; i < capacity; i++) {
+        erase_lock(&locks[i]);
+        locks[i].first_owner = (i + 1 < capacity) ? i + 1 : file->free_lock;
     }
+    int *index = (int *) ((char *) file + index_offset);
+    memcpy(index, get_lock_index(file), file->nb_locks * sizeof(int));
+    int64_t *fields[3] = {get_lock_starts(file), get_lock_ends(file),
+        get_lock_writes(file)};
+    for (int i = 0; i < 3; i++)
+        memcpy((char *) file + fields_offset[i], fields[i],
+                file->nb_locks * sizeof(int64_t));
+
+    begin_update(file);
+    file->free_lock = file->lock_capacity;
+    file->lock_table = offset;
+    file->lock_index = index_offset;
+    file->lock_starts = fields_offset[0];
+    file->lock_ends = fields_offset[1];
+    file->lock_writes = fields_offset[2];
+    file->lock_capacity = capacity;
+    end_update(file);
+    return 0;
+}
 
-    int shm_res = shm_open(shm_path, O_RDWR, 0);
-    int shm_res2 = -1;
-    rl_open_file *rlo = NULL;
-    // Problem: process 1 creates the shm and is paused before initializing it
-    // then process 2 comes here and the shm exists but is not initialized
-    if (shm_res >= 0) {
-        rlo = mmap(NULL, sizeof(rl_open_file), PROT_READ | PROT_WRITE,
-                MAP_SHARED, shm_res, 0);
-        if (rlo == MAP_FAILED) {
-        error2:
-            close(open_res);
-            close(shm_res);
-            return err_desc;
-        }
+/******************************************************************************/
 
-        if (pthread_mutex_lock(&rlo->mutex))
-            goto error2;
+/**
+ * @brief Checks if `waiter` is free
+ * @param waiter the queued request to check
+ * @return 1 if it is free, 0 otherwise
+ */
+static int is_waiter_free(rl_waiter *waiter) {
+    return waiter->ticket == RL_FREE_WAITER;
+}
 
-        if (map_increment(rlo, getpid()))
-            goto error2;
+/**
+ * @brief Removes the edge of `waiter` from the wait graph
+ *
+ * The edge is only freed if it still belongs to the owner of `waiter`, as the
+ * edge of a dead process may have been given to another request already. This
+ * function does not need the mutex of the graph.
+ *
+ * @param waiter a queued request
+ */
+static void remove_wait_edge(rl_waiter *waiter) {
+    if (waiter->edge == RL_NO_EDGE)
+        return;
+    pid_t pid = waiter->owner.pid;
+    atomic_compare_exchange_strong(&wait_graph->edges[waiter->edge].pid, &pid,
+            RL_FREE_EDGE);
+    waiter->edge = RL_NO_EDGE;
+}
 
-        if (msync(rlo, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
-            goto error2;
-        if (pthread_mutex_unlock(&rlo->mutex))
-            goto error2;
-    } else { // We create the shm
-        shm_res2 = shm_open(shm_path, O_RDWR | O_CREAT,
-                S_IRWXU | S_IRWXG | S_IRWXO);
-        if (shm_res2 == -1) {
-            close(open_res);
-            shm_unlink(shm_path);
-            return err_desc;
-        }
-        
-        int trunc_res = ftruncate(shm_res2, sizeof(rl_open_file));
-        if (trunc_res == -1) {
-        error:
-            close(open_res);
-            close(shm_res2);
-            shm_unlink(shm_path);
-            return err_desc;
-        }
-
-        rlo = mmap(NULL, sizeof(rl_open_file), PROT_READ | PROT_WRITE,
-                MAP_SHARED, shm_res2, 0);
-        if (rlo == MAP_FAILED)
-            goto error;
-
-        if (initialize_mutex(&rlo->mutex))
-            goto error;
-        if (pthread_mutex_lock(&rlo->mutex)) 
-            goto error;
-
-        rlo->nb_map_entries = 0;
-        for (int i = 0; i < RL_MAX_MAP_ENTRIES; i++)
-            erase_map_entry(&rlo->pid_map[i]);
-
-        if (map_increment(rlo, getpid()))
-            goto error;
-
-        rlo->nb_locks = 0;
-        for (int i = 0; i < RL_MAX_LOCKS; i++) {
-            erase_lock(&rlo->lock_table[i]);
-            for (int j = 0; j < RL_MAX_OWNERS; j++)
-                erase_owner(&rlo->lock_table[i].lock_owners[j]);
-        }
-
-        if (msync(rlo, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
-            goto error;
-        if (pthread_mutex_unlock(&rlo->mutex))
-            goto error;
-    }
+/**
+ * @brief Erases `waiter` and removes its edge from the wait graph
+ * @param waiter the queued request to erase
+ */
+static void erase_waiter(rl_waiter *waiter) {
+    remove_wait_edge(waiter);
+    waiter->ticket = RL_FREE_WAITER;
+}
 
-    if (add_to_rla(rlo) == -1) {
-        close(open_res);
-        close(shm_res);
-        close(shm_res2);
-        return err_desc;
+/**
+ * @brief Removes the FIFO of an asynchronous request and the private directory
+ * that `rl_lock_async()` created for it
+ * @param path the path of the FIFO
+ */
+static void remove_notify_fifo(const char *path) {
+    char dir[RL_FIFO_PATH_MAX];
+    strcpy(dir, path);
+    unlink(path);
+    char *slash = strrchr(dir, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+        rmdir(dir);
     }
-
-    rl_descriptor desc = {.fd = open_res, .file = rlo};
-    return desc;
 }
 
 /**
- * @brief Checks if the segment [s1, s1 + l1[ and [s2, s2 + l2[ overlap
+ * @brief Wakes up the queued requests of `file` overlapping the segment
+ * (start, len)
  *
- * If l1 or l2 equal 0, the segment is extensible, which would make the segment
- * as follows: [s*, inf[
+ * The waiters only run again once the caller has released the mutex of `file`.
+ * In handoff mode, nothing is done as the waiters are woken up by `hand_off()`
+ * once their lock has been applied, which is always the case of asynchronous
+ * requests. This function does not use any locking
+ * mechanism.
  *
- * @param s1 the start of the first segment
- * @param l1 the length of the first segment, 0 if extensible
- * @param s2 the start of the second segment
- * @param l2 the length of the second segment, 0 if extensible
- * @return 1 if the segments overlap, 0 otherwise
+ * @param file the file on which a segment was released
+ * @param start the start of the released segment
+ * @param len the length of the released segment, 0 if extensible
  */
-static int seg_overlap(off_t s1, off_t l1, off_t s2, off_t l2) {
-    if (l1 == 0)
-        return (l2 == 0) || (l2 > 0 && s2 + l2 - 1 >= s1);
-
-    if (s2 >= s1)
-        return s2 < s1 + l1;
-    else
-        return l2 == 0 || s2 + l2 > s1;
+static void wake_waiters(rl_open_file *file, off_t start, off_t len) {
+    if (file->nb_waiters == 0 || file->handoff)
+        return;
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &file->wait_queue[i];
+        if (!is_waiter_free(cur) && !cur->async
+                && seg_overlap(cur->start, cur->len, start, len))
+            pthread_cond_signal(&cur->wakeup);
+    }
 }
 
 /**
- * @brief Checks if the lock is owned by an rl_owner different than owner
- * 
- * This function does not use any locking mechanism to secure the access to
- * lock, nor tests if owner is in fact an owner of lock.
- * 
- * @param lock the lock to check
- * @param owner the owner to compare the lock owners with
- * @return 1 if the lock is owned by a different owner, 0 otherwise
+ * @brief Checks if the time `t1` is before the time `t2`
+ * @param t1 the first time
+ * @param t2 the second time
+ * @return 1 if `t1` is strictly before `t2`, 0 otherwise
  */
-static int has_different_owner(const rl_lock *lock, rl_owner owner) {
-    for (int i = 0; i < RL_MAX_OWNERS; i++) {
-        rl_owner other = lock->lock_owners[i];
-        if (!is_owner_free(&other)) {
-            if (!equals(other, owner))
-                return 1;
-        }
-    }
-    return 0;
+static int timespec_before(const struct timespec *t1,
+        const struct timespec *t2) {
+    return t1->tv_sec < t2->tv_sec
+        || (t1->tv_sec == t2->tv_sec && t1->tv_nsec < t2->tv_nsec);
 }
 
 /**
- * @brief Computes the starting offset of the lock of the file denoted by fd.
- * @param lck a lock on a region
- * @param fd the file descriptor of the file to lock
- * @return the starting offset of the region or -1 if it could not be determined
+ * @brief Waits until `cond` is signaled or `deadline` passes
+ *
+ * The mutex `mutex` must be held by the caller, it is released during the wait
+ * and taken again before returning. The caller sleeps until it is woken up:
+ * the locks of a process that died without releasing them are removed by the
+ * next request that runs into them, which wakes up their waiters as any other
+ * release does.
+ *
+ * @param cond the condition signaled when the caller may be able to lock, the
+ *             `wakeup` of its queued request or the one of a stripe
+ * @param mutex the mutex protecting `cond`
+ * @param deadline the `CLOCK_MONOTONIC` time after which the caller gives up
+ *                 waiting, NULL to wait without limit
+ * @return 0 when the caller should check its lock again, 1 when it should
+ * also repair the state protected by `mutex`, taken back from a process that
+ * died while holding it, -1 on error or if `deadline` has already passed, in
+ * which case errno is set to `ETIMEDOUT`
  */
-static off_t get_start(struct flock *lck, int fd) {
-    if (lck == NULL)
-        return -1;
-
-    if (lck->l_whence == SEEK_SET) {
-        if (lck->l_start >= 0)
-            return lck->l_start;
-        else
-            return -1; // before beginning of file !
-    } else if (lck->l_whence == SEEK_CUR || lck->l_whence == SEEK_END) {
-        off_t cur = lseek(fd, 0, SEEK_CUR); // current offset
-        if (cur == -1)
-            return -1;
-        off_t pos = lseek(fd, lck->l_start, lck->l_whence); // lock offset
-        if (pos == -1)
+static int wait_for_release(pthread_cond_t *cond, pthread_mutex_t *mutex,
+        const struct timespec *deadline) {
+    int err;
+    if (deadline == NULL)
+        err = pthread_cond_wait(cond, mutex);
+    else {
+        struct timespec now;
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
             return -1;
-        if (lseek(fd, cur, SEEK_SET) == -1)
+        if (!timespec_before(&now, deadline)) {
+            errno = ETIMEDOUT;
             return -1;
-        return pos;
+        }
+        err = pthread_cond_timedwait(cond, mutex, deadline);
     }
-    return -1;
+    if (err == EOWNERDEAD) {
+        err = pthread_mutex_consistent(mutex);
+        if (err == 0)
+            return 1;
+    }
+    if (err != 0 && err != ETIMEDOUT) {
+        errno = err;
+        return -1;
+    }
+    return 0;
 }
 
+/******************************************************************************/
+
 /**
- * @brief Checks if the given lock can be put on the given descriptor
- * 
- * This function only checks for conflicting locks, it doesn't verify if the
- * lock table is big enough for the new locks. This is done in other functions.
- * This function does not use any locking mechanism, so be sure to take the lock
- * before entering this function in order to verify mutual exclusion.
+ * @brief Deletes every owner that matches the given criteria in the given file
  *
- * @param lck the lock to put
- * @param lfd the file on which to put the lock
- * @return 1 if the lock is applicable, 0 if it is not, -1 if an error occured.
- * If the lock is not applicable because of a lock put by a process that has
- * died and has not removed its locks, returns the pid of that process.
+ * This function does not use any locking mechanism. If `crit` returns a value
+ * > 0, the owner given as first parameter of the function is erased from the
+ * lock owners table of the currently considered lock of the file. If `crit`
+ * returns 0, nothing is done. If it returns -1, the function quits on error.
+ * The locks left without owners are erased and the lock table is reorganized.
+ * The requests waiting for a segment overlapping a lock that lost owners are
+ * woken up.
+ *
+ * @param file the file that contains the lock owners to remove
+ * @param crit a function that take two lock owners and returns an integer
+ * @param owner_crit the owner used as second parameter of `crit`
+ * @return 0 if the owner removal was succesful, -1 on error.
  */
-static pid_t is_lock_applicable(struct flock *lck, rl_descriptor lfd) {
-    if (lck == NULL || lfd.file == NULL)
-        return -1;
-
-    off_t start = get_start(lck, lfd.fd);
-    if (start == -1)
-        return -1;
-
-    if (lck->l_type == F_UNLCK)
-        return 1;
-
-    rl_open_file *file = lfd.file;
-    if (file->nb_locks < 0 || file->nb_locks > RL_MAX_LOCKS)
+static int delete_owner_on_criteria(rl_open_file *file,
+        int (*crit)(rl_owner, rl_owner), rl_owner owner_crit) {
+    if (crit == NULL || file == NULL)
         return -1;
 
-    rl_owner lfd_owner = {.pid = getpid(), .fd = lfd.fd};
-
+    int res = -1;
+    begin_update(file);
     for (int i = 0; i < file->nb_locks; i++) {
-        rl_lock *cur = &file->lock_table[i];
-
-        /* if locks overlap check for conflicts */
-        if (seg_overlap(cur->start, cur->len, start, lck->l_len)) {
-            if (cur->type == F_WRLCK || lck->l_type == F_WRLCK) {
-                if (has_different_owner(cur, lfd_owner)) {
-                    /* check if owner is still alive */
-                    for (int j = 0; j < cur->nb_owners; j++) {
-                        if (!equals(lfd_owner, cur->lock_owners[j])) {
-                            if (kill(cur->lock_owners[j].pid, 0) == -1
-                                    && errno == ESRCH) {
-                                return cur->lock_owners[j].pid;
-                            } else {
-                                return 0;
-                            }
-                        }
-                    }
-
-                    /* there is a different owner that has not been found */
-                    return -1;
-                }
-            }
+        rl_lock *cur = get_lock(file, i);
+        int nb_removed = remove_owners(file, cur, crit, owner_crit);
+        if (nb_removed == -1)
+            goto end;
+        if (nb_removed > 0)
+            wake_waiters(file, cur->start, cur->len);
+        if (cur->nb_owners == 0) {
+            mark_lock(file, cur, -1);
+            erase_lock(cur);
         }
     }
-    return 1;
+    if (organize_locks(file) < 0)
+        goto end;
+    res = 0;
+
+ end:
+    end_update(file);
+    return res;
 }
 
 /**
- * @brief Checks if `ol` and `or` have the same PID
- * @param ol the left owner
- * @param or the right owner
- * @return 1 if `ol` and `or` have the same PID, 0 otherwise
+ * @brief Gives the lock of `file` whose owner list contains the node at
+ * `index` of the owner pool
+ *
+ * The lock is found by binary search on the segment recorded in the node.
+ *
+ * @param file the file that contains the lock
+ * @param index the index of an owner node
+ * @param link where to put the address of the index that points to the node in
+ * the owner list of the lock
+ * @return the lock, NULL if no lock is owned through the node
  */
-static int same_pid(rl_owner ol, rl_owner or) {
-    return ol.pid == or.pid;
+static rl_lock *find_holder(rl_open_file *file, int index, int **link) {
+    rl_owner_node *node = owner_node(file, index);
+    for (int i = lower_bound(file, file->nb_locks, node->start, node->len);
+            i < file->nb_locks && get_lock(file, i)->start == node->start;
+            i++) {
+        rl_lock *cur = get_lock(file, i);
+        if (cur->len != node->len || cur->type != node->type)
+            continue;
+        for (int *l = &cur->first_owner; *l != RL_NO_OWNER;
+                l = &owner_node(file, *l)->next) {
+            if (*l == index) {
+                *link = l;
+                return cur;
+            }
+        }
+    }
+    return NULL;
 }
 
 /**
- * @brief Removes the locks owned by the process of given PID in the given
- * rl_open_file
+ * @brief Removes the owners of process `pid` from the locks of `file`, only
+ * those of descriptor `fd` unless it is -1
  *
- * This function does not use any locking mechanism, be sure that mutual
- * exclusion is assured before using it. If after removal a lock is empty, it is
- * also deleted. The owners of every modified lock are reorganized, so as the
- * locks of the file.
+ * Only the locks in the list of the locks held by the process are visited. The
+ * locks left without owners are erased and the lock table is reorganized. The
+ * requests waiting for a segment overlapping a lock that lost owners are woken
+ * up. This function does not use any locking mechanism.
  *
- * @param pid the PID of the process that owns the locks to remove
- * @param file the file that contains the locks to remove
+ * @param file the file that contains the locks
+ * @param pid the PID of the owners to remove
+ * @param fd the descriptor of the owners to remove, -1 for all of them
  * @return 0 on success, -1 on error
  */
-static int remove_locks_of(pid_t pid, rl_open_file *file) {
-    if (pid <= 0 || file == NULL || file->nb_locks < 0
-            || file->nb_locks > RL_MAX_LOCKS)
-        return -1;
+static int remove_held_locks(rl_open_file *file, pid_t pid, int fd) {
+    rl_pid_fd_count *entry = find_map_entry(file, pid);
+    if (entry == NULL)
+        return 0;
 
-    rl_owner cmp = {.pid = pid, .fd = 0};
-    if (delete_owner_on_criteria(file, same_pid, cmp) < 0)
-        return -1;
-    return 0;
+    int res = -1;
+    int nb_emptied = 0;
+    begin_update(file);
+    int index = entry->first_held;
+    while (index != RL_NO_OWNER) {
+        rl_owner_node *node = owner_node(file, index);
+        int next = node->next_held;
+        if (fd == -1 || node->owner.fd == fd) {
+            int *link;
+            rl_lock *lck = find_holder(file, index, &link);
+            if (lck == NULL)
+                goto end;
+            *link = node->next;
+            lck->nb_owners--;
+            unlink_held(file, index);
+            free_owner_node(file, index);
+            wake_waiters(file, lck->start, lck->len);
+            if (lck->nb_owners == 0) {
+                mark_lock(file, lck, -1);
+                nb_emptied++;
+            }
+        }
+        index = next;
+    }
+
+    /* erased last, as the binary searches need the table to stay sorted */
+    if (nb_emptied > 0) {
+        for (int i = 0; i < file->nb_locks; i++) {
+            if (get_lock(file, i)->nb_owners == 0)
+                erase_lock(get_lock(file, i));
+        }
+        if (organize_locks(file) < 0)
+            goto end;
+    }
+    res = 0;
+
+ end:
+    end_update(file);
+    return res;
 }
 
-/**
- * @brief Adds `new` to the owners table of `lck` if possible
- * @param new the owner to add
- * @param lck the lock to which to add the new owner
- * @return 0 if `new` was succesfully added, -1 if it could not be added
+/******************************************************************************/
+
+/*
+ * In record mode, the state of each record of a file is a 64-bit word whose
+ * low `RL_MAX_RECORD_OWNERS` bits tell which owners hold a read lock on it and
+ * whose high bits tell which ones hold a write lock. An owner is given a slot
+ * of `record_owners` the first time it locks a record, and its bits in every
+ * word are those of its slot.
  */
-static int add_owner(rl_owner new, rl_lock *lck) {
-    if (new.pid < 0 || new.fd < 0 || lck == NULL || lck->nb_owners < 0
-            || lck->nb_owners + 1 > RL_MAX_OWNERS)
-        return -1;
-    lck->lock_owners[lck->nb_owners] = new;
-    lck->nb_owners++;
-    return 0;
-}
 
 /**
- * @brief Checks if `owner` is an owner of `lck`
- * @param owner the owner that might own `lck`
- * @param lck the lock that might be owned by `owner`
- * @return 1 if `owner` is an owner of `lck`, 0 if it is not
+ * @brief Gives the bit of a read lock of the owner in slot `slot`
+ * @param slot the slot of an owner
+ * @return the bit of the owner in the words of the records
  */
-static int is_owner_of(rl_owner owner, rl_lock *lck) {
-    for (int i = 0; i < lck->nb_owners; i++) {
-        if (equals(owner, lck->lock_owners[i]))
-            return 1;
-    }
-    return 0;
+static uint64_t reader_bit(int slot) {
+    return (uint64_t) 1 << slot;
 }
 
 /**
- * @brief Adds `new` to the locks of `file` if possible, where `first` is the
- * initial owner of `new`
- *
- * This function should be use when `new` is not already a lock of `file`. The
- * owners that might be stored in `new` are erased.
- *
- * @param new the lock to add
- * @param file the file in which to add `new`
- * @param first the initial owner of `new`
+ * @brief Gives the bit of a write lock of the owner in slot `slot`
+ * @param slot the slot of an owner
+ * @return the bit of the owner in the words of the records
  */
-static int add_lock(rl_lock *new, rl_open_file *file, rl_owner first) {
-    if (new == NULL || file == NULL || file->nb_locks + 1 > RL_MAX_LOCKS)
-        return -1;
-    file->lock_table[file->nb_locks] = *new;
-    rl_lock *tmp = &file->lock_table[file->nb_locks];
-    for (int i = 0; i < RL_MAX_OWNERS; i++)
-        erase_owner(&tmp->lock_owners[i]);
-    file->nb_locks++;
-    tmp->nb_owners = 0;
-    if (add_owner(first, tmp) == -1)
-        return -1;
-    return 0;
+static uint64_t writer_bit(int slot) {
+    return (uint64_t) 1 << (RL_MAX_RECORD_OWNERS + slot);
 }
 
 /**
- * @brief Gets the lock in `file` that starts at the same offset, has the same
- * length and is of the same type than `lck`
- * @param file the file that might contain `lck`
- * @param lck the lock to find in `file`
- * @return A pointer to the corresponding lock in file or NULL if it was not
- * found
+ * @brief Gives the word of the record `record` of `file`
+ *
+ * The words are stored in chunks of `RL_RECORD_CHUNK_SIZE` records, allocated
+ * by `reserve_records()`, that never move, so that they can be updated without
+ * the mutex of the file.
+ *
+ * @param file the file that contains the record
+ * @param record the index of the record, less than `RL_MAX_RECORDS`
+ * @return the address of the word, NULL if its chunk is not allocated, in
+ * which case no lock is held on the record
  */
-static rl_lock *find_lock(rl_open_file *file, rl_lock *lck) {
-    if (file == NULL || lck == NULL)
+static _Atomic uint64_t *get_record(rl_open_file *file, off_t record) {
+    size_t chunk = atomic_load_explicit(
+            &file->record_chunks[record / RL_RECORD_CHUNK_SIZE],
+            memory_order_acquire);
+    if (chunk == 0)
         return NULL;
-    for (int i = 0; i < file->nb_locks; i++) {
-        rl_lock *tmp = &file->lock_table[i];
-        if (tmp->start == lck->start && tmp->len == lck->len
-                && tmp->type == lck->type)
-            return tmp;
-    }
-    return NULL;
+    return (_Atomic uint64_t *) ((char *) file + chunk)
+        + record % RL_RECORD_CHUNK_SIZE;
 }
 
 /**
- * @brief Checks if (s2, l2) is strictly in the middle of (s1, l1)
- * @param s1 the start of the first segment
- * @param l1 the length of the first segment, 0 if extensible
- * @param s2 the start of the second segment
- * @param l2 the length of the second segment, 0 if extensible
- * @return 1 if (s2, l2) is strictly in the middle of (s1, l1), 0 otherwise
+ * @brief Gives the stripe of `file` on which the requests waiting for the
+ * record `record` sleep
+ * @param file the file that contains the record
+ * @param record the index of the record
+ * @return the stripe of the record
  */
-static int strictly_in_middle(off_t s1, off_t l1, off_t s2, off_t l2) {
-    return l2 > 0 && s1 < s2 && (l1 == 0 || s1 + l1 > s2 + l2);
+static rl_stripe *get_stripe(rl_open_file *file, off_t record) {
+    return &file->stripes[record % RL_NB_STRIPES];
 }
 
 /**
- * @brief Checks if (s2, l2) covers entirely (s1, l1)
- * @param s1 the start of the first segment
- * @param l1 the length of the first segment, 0 if extensible
- * @param s2 the start of the second segment
- * @param l2 the length of the second segment, 0 if extensible
- * @return 1 if (s2, l2) covers entirely (s1, l1), 0 otherwise
+ * @brief Takes the mutex of `stripe`, made consistent again at once if its
+ * previous holder died while holding it, as it only protects the waits on the
+ * stripe
+ * @param stripe the stripe whose mutex to take
+ * @param try 1 to give up if the mutex is held, 0 to wait for it
+ * @return 0 if the mutex was taken, the error code otherwise
  */
-static int covers_entirely(off_t s1, off_t l1, off_t s2, off_t l2) {
-    return (l1 > 0 && l2 > 0 && s1 >= s2 && s1 + l1 <= s2 + l2)
-        || (l2 == 0 && s2 <= s1);
+static int lock_stripe(rl_stripe *stripe, int try) {
+    int err = try ? pthread_mutex_trylock(&stripe->mutex)
+        : pthread_mutex_lock(&stripe->mutex);
+    if (err == EOWNERDEAD)
+        err = pthread_mutex_consistent(&stripe->mutex);
+    return err;
 }
 
 /**
- * @brief Checks if (s2, l2) covers the end of (s1, l1)
+ * @brief Wakes up the requests waiting for one of the records [first; end[ of
+ * `file` after locks on them were removed
  *
- * (s2, l2) must start strictly after (s1, l1) and may end at the same byte or
- * after.
+ * Only the mutexes of the stripes on which requests wait are taken. The fence
+ * pairs with the one of `enter_stripe()`. A caller holding the mutex of a
+ * stripe only waits for the mutexes of the stripes that follow it, so that two
+ * callers never wait for each other; the stripes that cannot be taken at once
+ * are returned, for the caller to wake them up with `wake_stripes()` once it
+ * has released its own.
  *
- * @param s1 the start of the first segment
- * @param l1 the length of the first segment, 0 if extensible
- * @param s2 the start of the second segment
- * @param l2 the length of the second segment, 0 if extensible
- * @return 1 if (s2, l2) covers the end of (s1, l1), 0 otherwise
+ * @param file the file that contains the records
+ * @param first the first record
+ * @param end the record after the last one
+ * @param held the stripe whose mutex the caller holds, NULL if there is none
+ * @return the mask of the indexes of the stripes whose requests were not woken
+ * up, 0 if there is none
  */
-static int covers_end(off_t s1, off_t l1, off_t s2, off_t l2) {
-    return (l1 > 0 && l2 > 0 && s1 < s2 && s1 + l1 <= s2 + l2)
-        || (l2 == 0 && s1 < s2);
+static uint64_t records_released(rl_open_file *file, off_t first, off_t end,
+        rl_stripe *held) {
+    uint64_t missed = 0;
+    atomic_thread_fence(memory_order_seq_cst);
+    off_t nb_stripes = (end - first < RL_NB_STRIPES) ?
+        end - first : RL_NB_STRIPES;
+    for (off_t i = 0; i < nb_stripes; i++) {
+        rl_stripe *stripe = get_stripe(file, first + i);
+        if (atomic_load(&stripe->nb_waiters) == 0)
+            continue;
+        if (stripe != held
+                && lock_stripe(stripe, held != NULL && stripe < held) != 0) {
+            missed |= (uint64_t) 1 << (stripe - file->stripes);
+            continue;
+        }
+        pthread_cond_broadcast(&stripe->released);
+        if (stripe != held)
+            pthread_mutex_unlock(&stripe->mutex);
+    }
+    return missed;
+}
+
+/**
+ * @brief Wakes up the requests waiting on the stripes of `file` that
+ * `records_released()` could not take
+ *
+ * The caller must not hold the mutex of any stripe.
+ *
+ * @param file the file that contains the stripes
+ * @param stripes the mask of the indexes of the stripes
+ */
+static void wake_stripes(rl_open_file *file, uint64_t stripes) {
+    for (int i = 0; stripes != 0 && i < RL_NB_STRIPES; i++) {
+        if (!(stripes & ((uint64_t) 1 << i)))
+            continue;
+        stripes &= ~((uint64_t) 1 << i);
+        rl_stripe *stripe = &file->stripes[i];
+        if (lock_stripe(stripe, 0) != 0)
+            continue;
+        pthread_cond_broadcast(&stripe->released);
+        pthread_mutex_unlock(&stripe->mutex);
+    }
+}
+
+/**
+ * @brief Takes the mutex of `stripe` and counts the caller among the requests
+ * waiting on it
+ *
+ * The fence pairs with the one of `records_released()`: a request that tries
+ * to lock its records again after this call either sees the locks removed by a
+ * concurrent release, or is woken up by it.
+ *
+ * @param stripe the stripe of the record the caller waits for
+ * @return 0 on success, -1 on error
+ */
+static int enter_stripe(rl_stripe *stripe) {
+    if (lock_stripe(stripe, 0) != 0)
+        return -1;
+    atomic_fetch_add(&stripe->nb_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return 0;
+}
+
+/**
+ * @brief Stops counting the caller among the requests waiting on `stripe` and
+ * releases its mutex
+ * @param stripe a stripe entered with `enter_stripe()`
+ */
+static void leave_stripe(rl_stripe *stripe) {
+    atomic_fetch_sub(&stripe->nb_waiters, 1);
+    pthread_mutex_unlock(&stripe->mutex);
 }
 
 /**
- * @brief Unlocks the region delimited by `lck` of the open file pointed by
- * `lfd`
+ * @brief Allocates the chunks of the words of the records [first; end[ of
+ * `file` that are not allocated yet
  *
- * `lck` must be of type `F_UNLCK` and must start at or after the beginning of
- * the file. This function does not use any locking mechanism, ensure mutual
- * exclusion before the call.
+ * This function does not use any locking mechanism, so be sure to have an
+ * exclusive lock on the file.
  *
- * @param lfd the file descriptor to unlock
- * @param lck the region to unlock
+ * @param file the file that contains the records
+ * @param first the first record
+ * @param end the record after the last one, at most `RL_MAX_RECORDS`
  * @return 0 on success, -1 on error
  */
-static int apply_unlock(rl_descriptor lfd, struct flock *lck) {
-    if (lfd.file == NULL || lck == NULL)
+static int alloc_record_chunks(rl_open_file *file, off_t first, off_t end) {
+    for (off_t chunk = first / RL_RECORD_CHUNK_SIZE;
+            chunk <= (end - 1) / RL_RECORD_CHUNK_SIZE; chunk++) {
+        if (atomic_load(&file->record_chunks[chunk]) != 0)
+            continue;
+        size_t offset = extend_segment(file,
+                RL_RECORD_CHUNK_SIZE * sizeof(uint64_t));
+        if (offset == 0)
+            return -1;
+        atomic_store(&file->record_chunks[chunk], offset);
+    }
+    return 0;
+}
+
+/**
+ * @brief Finds the slot of `owner` in the owners of records of `file`
+ *
+ * This function does not use any locking mechanism: a slot is only given to
+ * `owner` by its own process, and only freed once it is closed or dead.
+ *
+ * @param file the file that contains the owners
+ * @param owner the owner to find
+ * @return the slot of `owner`, -1 if it has none
+ */
+static int find_record_owner(rl_open_file *file, rl_owner owner) {
+    for (int i = 0; i < RL_MAX_RECORD_OWNERS; i++) {
+        rl_record_owner *cur = &file->record_owners[i];
+        if (atomic_load(&cur->pid) == owner.pid && cur->fd == owner.fd
+                && cur->token == owner.token)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Widens the records the owner `cur` may lock to [first; end[
+ *
+ * The bounds are widened before the records are locked, so that every record
+ * locked by the owner is between them.
+ *
+ * @param cur the owner
+ * @param first the first record
+ * @param end the record after the last one
+ */
+static void widen_record_owner(rl_record_owner *cur, off_t first, off_t end) {
+    off_t bound = atomic_load(&cur->first_record);
+    while (first < bound
+            && !atomic_compare_exchange_weak(&cur->first_record, &bound, first))
+        ;
+    bound = atomic_load(&cur->end_record);
+    while (end > bound
+            && !atomic_compare_exchange_weak(&cur->end_record, &bound, end))
+        ;
+}
+
+/**
+ * @brief Removes the locks of the owner in slot `slot` from the records of
+ * `file` and frees the slot
+ *
+ * Only the records between the bounds of the owner are scanned, until as many
+ * locks as the owner counts have been removed. This function does not use any
+ * locking mechanism, so be sure to have an exclusive lock on the file. The
+ * requests waiting for the records are woken up.
+ *
+ * @param file the file that contains the records
+ * @param slot the slot of the owner
+ */
+static void release_record_owner(rl_open_file *file, int slot) {
+    rl_record_owner *cur = &file->record_owners[slot];
+    uint64_t bits = reader_bit(slot) | writer_bit(slot);
+    long left = atomic_exchange(&cur->nb_records, -1);
+    off_t first = atomic_load(&cur->first_record);
+    off_t end = atomic_load(&cur->end_record);
+    for (off_t i = first; left > 0 && i < end; i++) {
+        _Atomic uint64_t *word = get_record(file, i);
+        if (word == NULL) {
+            /* the whole chunk is unlocked */
+            i = (i / RL_RECORD_CHUNK_SIZE + 1) * RL_RECORD_CHUNK_SIZE - 1;
+            continue;
+        }
+        if (atomic_load_explicit(word, memory_order_relaxed) & bits) {
+            atomic_fetch_and(word, ~bits);
+            left--;
+        }
+    }
+    atomic_store(&cur->pid, RL_FREE_RECORD_OWNER);
+    if (first < end)
+        records_released(file, first, end, NULL);
+}
+
+/**
+ * @brief Finds the slot of `owner` in the owners of records of `file` and
+ * counts a request of the owner in progress on it, so that the slot is not
+ * freed before `unpin_record_owner()` is called
+ *
+ * This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the owners
+ * @param owner the owner to find
+ * @return the slot of `owner`, -1 if it has none
+ */
+static int pin_record_owner(rl_open_file *file, rl_owner owner) {
+    int slot = find_record_owner(file, owner);
+    if (slot == -1)
         return -1;
 
-    off_t lck_start = get_start(lck, lfd.fd);
-    if (lck_start == -1)
+    rl_record_owner *cur = &file->record_owners[slot];
+    long nb_records = atomic_load(&cur->nb_records);
+    do {
+        if (nb_records < 0)
+            return -1;
+    } while (!atomic_compare_exchange_weak(&cur->nb_records, &nb_records,
+                nb_records + 1));
+    /* the slot may have been given to another owner before being pinned */
+    if (atomic_load(&cur->pid) != owner.pid || cur->fd != owner.fd
+            || cur->token != owner.token) {
+        atomic_fetch_sub(&cur->nb_records, 1);
         return -1;
+    }
+    return slot;
+}
 
-    int nb_locks = lfd.file->nb_locks;
-    size_t nb_new_locks = 0;
-    rl_lock new_locks[2 * nb_locks];
-    size_t nb_locks_to_remove = 0;
-    size_t locks_to_remove[nb_locks];
-    rl_owner lfd_owner = {.pid = getpid(), .fd = lfd.fd};
-    for (int i = 0; i < nb_locks; i++) {
-        rl_lock *cur = &lfd.file->lock_table[i];
-        if (is_owner_of(lfd_owner, cur)
-                && seg_overlap(lck_start, lck->l_len, cur->start, cur->len)) {
-            locks_to_remove[nb_locks_to_remove] = i;
-            nb_locks_to_remove++;
-            if (strictly_in_middle(cur->start, cur->len, lck_start,
-                            lck->l_len)) {
-                rl_lock l1, l2;
-                l1.type = cur->type;
-                l1.start = cur->start;
-                l1.len = lck_start - cur->start;
-                new_locks[nb_new_locks] = l1;
-                nb_new_locks++;
+/**
+ * @brief Ends a request of the owner in slot `slot` counted by
+ * `pin_record_owner()` or `add_record_owner()`
+ * @param file the file that contains the owners
+ * @param slot the slot of the owner
+ */
+static void unpin_record_owner(rl_open_file *file, int slot) {
+    atomic_fetch_sub(&file->record_owners[slot].nb_records, 1);
+}
 
-                l2.type = cur->type;
-                l2.start = lck_start + lck->l_len;
-                l2.len = (cur->len == 0) ?
-                    0 : (cur->start + cur->len) - (lck_start + lck->l_len);
-                new_locks[nb_new_locks] = l2;
-                nb_new_locks++;
-            } else if (covers_entirely(cur->start, cur->len, lck_start,
-                            lck->l_len))
-                continue;
-            else if (covers_end(cur->start, cur->len, lck_start, lck->l_len)) {
-                rl_lock l1;
-                l1.type = cur->type;
-                l1.start = cur->start;
-                l1.len = lck_start - cur->start;
-                new_locks[nb_new_locks] = l1;
-                nb_new_locks++;
-            } else { /* unlock beginning of cur */
-                rl_lock l1;
-                l1.type = cur->type;
-                l1.start = lck_start + lck->l_len;
-                l1.len = (cur->len == 0) ?
-                    0 : (cur->start + cur->len) - (lck_start + lck->l_len);
-                new_locks[nb_new_locks] = l1;
-                nb_new_locks++;
-            }
+/**
+ * @brief Gives a slot of the owners of records of `file` to `owner` if it has
+ * none, and pins it as `pin_record_owner()` does
+ *
+ * If every slot is taken, the slots of the owners that lock no record and have
+ * no request in progress are freed, then those of the dead processes. This
+ * function does not use any locking mechanism, so be sure to have an exclusive
+ * lock on the file.
+ *
+ * @param file the file that contains the owners
+ * @param owner the owner to add
+ * @return the slot of `owner`, -1 with errno set to ENOLCK if there is none
+ * left
+ */
+static int add_record_owner(rl_open_file *file, rl_owner owner) {
+    int slot = find_record_owner(file, owner);
+    if (slot != -1) {
+        atomic_fetch_add(&file->record_owners[slot].nb_records, 1);
+        return slot;
+    }
+    for (int i = 0; slot == -1 && i < RL_MAX_RECORD_OWNERS; i++) {
+        if (atomic_load(&file->record_owners[i].pid) == RL_FREE_RECORD_OWNER)
+            slot = i;
+    }
+    for (int i = 0; slot == -1 && i < RL_MAX_RECORD_OWNERS; i++) {
+        long idle = 0;
+        if (atomic_compare_exchange_strong(&file->record_owners[i].nb_records,
+                    &idle, -1)) {
+            atomic_store(&file->record_owners[i].pid, RL_FREE_RECORD_OWNER);
+            slot = i;
+        }
+    }
+    for (int i = 0; slot == -1 && i < RL_MAX_RECORD_OWNERS; i++) {
+        pid_t pid = atomic_load(&file->record_owners[i].pid);
+        if (kill(pid, 0) == -1 && errno == ESRCH) {
+            release_record_owner(file, i);
+            slot = i;
+        }
+    }
+    if (slot == -1) {
+        errno = ENOLCK;
+        return -1;
+    }
+
+    rl_record_owner *cur = &file->record_owners[slot];
+    cur->fd = owner.fd;
+    cur->token = owner.token;
+    atomic_store(&cur->first_record, RL_MAX_RECORDS);
+    atomic_store(&cur->end_record, 0);
+    atomic_store(&cur->nb_records, 1);
+    atomic_store(&cur->pid, owner.pid);
+    return slot;
+}
+
+/**
+ * @brief Gives the locks of the owner in slot `from` on the records of `file`
+ * to `owner`
+ *
+ * Only the records between the bounds of the owner in slot `from` are scanned.
+ * This function does not use any locking mechanism, so be sure to have an
+ * exclusive lock on the file.
+ *
+ * @param file the file that contains the records
+ * @param from the slot of the owner whose locks are copied
+ * @param owner the owner to give the locks to
+ * @return 0 on success, -1 on error
+ */
+static int copy_record_owner(rl_open_file *file, int from, rl_owner owner) {
+    int slot = add_record_owner(file, owner);
+    if (slot == -1)
+        return -1;
+    off_t first = atomic_load(&file->record_owners[from].first_record);
+    off_t end = atomic_load(&file->record_owners[from].end_record);
+    if (first < end)
+        widen_record_owner(&file->record_owners[slot], first, end);
+    for (off_t i = first; i < end; i++) {
+        _Atomic uint64_t *word = get_record(file, i);
+        if (word == NULL) {
+            i = (i / RL_RECORD_CHUNK_SIZE + 1) * RL_RECORD_CHUNK_SIZE - 1;
+            continue;
         }
-        if (nb_new_locks + nb_locks > RL_MAX_LOCKS)
+        uint64_t cur = atomic_load(word);
+        uint64_t bits = 0;
+        if (cur & reader_bit(from))
+            bits |= reader_bit(slot);
+        if (cur & writer_bit(from))
+            bits |= writer_bit(slot);
+        if (bits != 0
+                && !(atomic_fetch_or(word, bits)
+                    & (reader_bit(slot) | writer_bit(slot))))
+            atomic_fetch_add(&file->record_owners[slot].nb_records, 1);
+    }
+    unpin_record_owner(file, slot);
+    return 0;
+}
+
+/**
+ * @brief Removes the locks on the records of `file` of the owners of PID `pid`
+ * and file descriptor `fd`
+ *
+ * This function does not use any locking mechanism, so be sure to have an
+ * exclusive lock on the file.
+ *
+ * @param file the file that contains the records
+ * @param pid the PID of the owners
+ * @param fd the file descriptor of the owners, -1 for all of them
+ */
+static void remove_records_of(rl_open_file *file, pid_t pid, int fd) {
+    for (int i = 0; file->record_size > 0 && i < RL_MAX_RECORD_OWNERS; i++) {
+        rl_record_owner *cur = &file->record_owners[i];
+        if (atomic_load(&cur->pid) == pid && (fd == -1 || cur->fd == fd))
+            release_record_owner(file, i);
+    }
+}
+
+/**
+ * @brief Replaces the bits `clear` of `*word` by the bits `set` with a single
+ * atomic operation, unless one of the bits `conflicts` is set
+ * @param word the word of a record
+ * @param conflicts the bits that prevent the update
+ * @param clear the bits to clear
+ * @param set the bits to set
+ * @param old where to put the value of the word before the update, or the one
+ * that prevented it
+ * @return 1 if the word was updated, 0 otherwise
+ */
+static int update_record(_Atomic uint64_t *word, uint64_t conflicts,
+        uint64_t clear, uint64_t set, uint64_t *old) {
+    uint64_t cur = atomic_load_explicit(word, memory_order_relaxed);
+    do {
+        *old = cur;
+        if (cur & conflicts)
+            return 0;
+    } while (!atomic_compare_exchange_weak(word, &cur, (cur & ~clear) | set));
+    return 1;
+}
+
+/**
+ * @brief Gives the slot of the first owner that has a bit in `bits`,
+ * preferring the writers
+ * @param bits bits of a record word, at least one of them set
+ * @return the slot of the owner
+ */
+static int first_record_owner(uint64_t bits) {
+    int slot = 0;
+    uint64_t writers = bits >> RL_MAX_RECORD_OWNERS;
+    if (writers != 0)
+        bits = writers;
+    while (!(bits & ((uint64_t) 1 << slot)))
+        slot++;
+    return slot;
+}
+
+/**
+ * @brief Puts a lock of type `type` on the records [first; end[ of `file` for
+ * the owner in slot `slot`
+ *
+ * Each record is updated with a single atomic operation, the mutex of the file
+ * is not needed. The lock is first added beside the ones the owner already
+ * holds with the other type, so that the bits added before a conflicting
+ * record can simply be removed again. Once every record is acquired, the locks
+ * of the other type are removed. The records are counted for the owner before
+ * they are locked, and the ones it did not get are uncounted at the end.
+ *
+ * @param file the file that contains the records, reserved up to `end`
+ * @param slot the slot of the owner
+ * @param type the type of the lock (F_RDLCK, F_WRLCK)
+ * @param first the first record
+ * @param end the record after the last one
+ * @param holder where to put the slot of an owner of a conflicting lock
+ * @param conflict where to put the record locked by that owner
+ * @return 0 if the lock was put, 1 if a record is locked by another owner, -1
+ * on error
+ */
+static int lock_records(rl_open_file *file, int slot, short type, off_t first,
+        off_t end, int *holder, off_t *conflict) {
+    uint64_t mine = reader_bit(slot) | writer_bit(slot);
+    uint64_t bit = (type == F_WRLCK) ? writer_bit(slot) : reader_bit(slot);
+    uint64_t conflicts = (type == F_WRLCK) ? ~mine : RL_RECORD_WRITERS & ~mine;
+
+    off_t nb_records = end - first;
+    uint64_t batch[RL_RECORD_BATCH / 64];
+    uint64_t *added = batch;
+    if (nb_records > RL_RECORD_BATCH) {
+        added = calloc((nb_records + 63) / 64, sizeof(uint64_t));
+        if (added == NULL)
             return -1;
+    } else
+        memset(batch, 0, sizeof(batch));
+
+    atomic_long *counted = &file->record_owners[slot].nb_records;
+    atomic_fetch_add(counted, nb_records);
+    widen_record_owner(&file->record_owners[slot], first, end);
+    off_t nb_locked = 0;
+    int res = 0;
+    off_t i;
+    for (i = 0; i < nb_records; i++) {
+        uint64_t old;
+        if (!update_record(get_record(file, first + i), conflicts, 0, bit,
+                    &old)) {
+            *holder = first_record_owner(old & conflicts);
+            *conflict = first + i;
+            res = 1;
+            break;
+        }
+        if (!(old & bit))
+            added[i / 64] |= (uint64_t) 1 << (i % 64);
+        if (!(old & mine))
+            nb_locked++;
     }
-    for (int i = 0; i < nb_locks_to_remove; i++) {
-        size_t ind = locks_to_remove[i];
-        rl_lock *rlck = &lfd.file->lock_table[ind];
-        if (rlck->nb_owners == 1) {
-            erase_lock(rlck);
-            lfd.file->nb_locks--;
-        } else {
-            size_t nb_owners = rlck->nb_owners;
-            for (int j = 0; j < rlck->nb_owners; j++) {
-                if (equals(lfd_owner, rlck->lock_owners[j])) {
-                    erase_owner(&rlck->lock_owners[j]);
-                    nb_owners--;
-                }
+
+    if (res == 1) {
+        for (off_t j = 0; j < i; j++) {
+            if ((added[j / 64] & ((uint64_t) 1 << (j % 64)))
+                    && !(atomic_fetch_and(get_record(file, first + j), ~bit)
+                        & mine & ~bit))
+                nb_locked--;
+        }
+    } else {
+        uint64_t other = mine & ~bit;
+        for (i = first; i < end; i++) {
+            _Atomic uint64_t *word = get_record(file, i);
+            if (atomic_load_explicit(word, memory_order_relaxed) & other)
+                atomic_fetch_and(word, ~other);
+        }
+    }
+
+    atomic_fetch_sub(counted, nb_records - nb_locked);
+    if (added != batch)
+        free(added);
+    return res;
+}
+
+/**
+ * @brief Removes the locks of the owner in slot `slot` from the records
+ * [first; end[ of `file`, and uncounts them for the owner
+ * @param file the file that contains the records
+ * @param slot the slot of the owner
+ * @param first the first record
+ * @param end the record after the last one
+ * @return 1 if a lock was removed, 0 otherwise
+ */
+static int unlock_records(rl_open_file *file, int slot, off_t first,
+        off_t end) {
+    uint64_t mine = reader_bit(slot) | writer_bit(slot);
+    long nb_released = 0;
+    for (off_t i = first; i < end; i++) {
+        _Atomic uint64_t *word = get_record(file, i);
+        if (word == NULL) {
+            /* the whole chunk is unlocked */
+            i = (i / RL_RECORD_CHUNK_SIZE + 1) * RL_RECORD_CHUNK_SIZE - 1;
+            continue;
+        }
+        if (atomic_load_explicit(word, memory_order_relaxed) & mine
+                && (atomic_fetch_and(word, ~mine) & mine))
+            nb_released++;
+    }
+    atomic_fetch_sub(&file->record_owners[slot].nb_records, nb_released);
+    return nb_released > 0;
+}
+
+/**
+ * @brief Fills `lck` with the first lock on the records [first; end[ of `file`
+ * that prevents `owner` from putting a lock of type `lck->l_type` on them
+ *
+ * This function does not take the mutex of the file. Locks whose owners are
+ * dead are not reported. If no lock conflicts, `lck->l_type` is set to F_UNLCK
+ * and the other fields are left unchanged.
+ *
+ * @param file the file that contains the records
+ * @param owner the owner of the lock that would be put
+ * @param lck the lock that would be put, of type F_RDLCK or F_WRLCK
+ * @param first the first record
+ * @param end the record after the last one
+ */
+static void get_conflicting_record(rl_open_file *file, rl_owner owner,
+        struct flock *lck, off_t first, off_t end) {
+    int slot = find_record_owner(file, owner);
+    uint64_t mine = (slot == -1) ? 0 : reader_bit(slot) | writer_bit(slot);
+    uint64_t conflicts = (lck->l_type == F_WRLCK) ?
+        ~mine : RL_RECORD_WRITERS & ~mine;
+    for (off_t i = first; i < end; i++) {
+        _Atomic uint64_t *word = get_record(file, i);
+        if (word == NULL) {
+            i = (i / RL_RECORD_CHUNK_SIZE + 1) * RL_RECORD_CHUNK_SIZE - 1;
+            continue;
+        }
+        uint64_t others = atomic_load(word) & conflicts;
+        for (int j = 0; others != 0 && j < RL_MAX_RECORD_OWNERS; j++) {
+            if (!(others & (reader_bit(j) | writer_bit(j))))
+                continue;
+            pid_t pid = atomic_load(&file->record_owners[j].pid);
+            if (pid == RL_FREE_RECORD_OWNER
+                    || (kill(pid, 0) == -1 && errno == ESRCH))
+                continue;
+            lck->l_type = (others & writer_bit(j)) ? F_WRLCK : F_RDLCK;
+            lck->l_whence = SEEK_SET;
+            lck->l_start = i * file->record_size;
+            lck->l_len = file->record_size;
+            lck->l_pid = pid;
+            return;
+        }
+    }
+    lck->l_type = F_UNLCK;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Packs `pid` and `state` into a word of the fast path
+ * @param pid the PID of the holder, 0 if there is none
+ * @param state the state of the fast path
+ * @return the packed word
+ */
+static uint64_t fast_word(pid_t pid, int state) {
+    return ((uint64_t) pid << RL_FAST_STATE_BITS) | (uint64_t) state;
+}
+
+/**
+ * @brief Gets the state of the fast path packed in `word`
+ * @param word the word of the fast path
+ * @return `RL_FAST_OPEN`, `RL_FAST_CLOSED`, `RL_FAST_CLAIMED` or
+ * `RL_FAST_HELD`
+ */
+static int fast_state(uint64_t word) {
+    return (int) (word & ((1 << RL_FAST_STATE_BITS) - 1));
+}
+
+/**
+ * @brief Gets the PID of the holder packed in `word`
+ * @param word the word of the fast path
+ * @return the PID of the holder of the fast path, 0 if there is none
+ */
+static pid_t fast_pid(uint64_t word) {
+    return (pid_t) (word >> RL_FAST_STATE_BITS);
+}
+
+/******************************************************************************/
+
+/*
+ * The mutex of a file is robust: when a process dies while holding it, the
+ * next process that takes it is told so and repairs the structures the dead
+ * process may have left halfway through a modification before making the mutex
+ * consistent again.
+ */
+
+/**
+ * @brief Rebuilds the lock index, the free lists and the lists of the locks
+ * held by each process of `file` from its lock table and its owner pool
+ *
+ * Only the slots of the lock table are trusted. The owner lists are followed
+ * until a node out of the pool or already owning a lock, and the locks left
+ * without owners are freed. The summaries of the locks are recomputed. This
+ * function does not use any locking mechanism.
+ *
+ * @param file the file to repair
+ * @return 0 on success, -1 if the owner pool could not be checked
+ */
+static int rebuild_locks(rl_open_file *file) {
+    char *used = calloc(file->owner_capacity, 1);
+    if (used == NULL)
+        return -1;
+
+    rl_owner_node *pool = get_owner_pool(file);
+    for (int i = 0; i < file->map_capacity; i++)
+        get_pid_map(file)[i].first_held = RL_NO_OWNER;
+    memset(&file->occupancy, 0, sizeof(file->occupancy));
+    for (int i = 0; i < RL_NB_VERSION_BUCKETS; i++) {
+        atomic_store(&file->buckets[i].nb_writers, 0);
+        atomic_fetch_add(&file->buckets[i].version, 1);
+    }
+
+    file->nb_locks = 0;
+    file->max_len = 0;
+    file->free_lock = RL_NO_LOCK;
+    for (int slot = file->lock_capacity - 1; slot >= 0; slot--) {
+        rl_lock *lck = &get_lock_table(file)[slot];
+        size_t nb_owners = 0;
+        for (int *link = &lck->first_owner; !is_lock_free(lck)
+                && *link != RL_NO_OWNER; link = &pool[*link].next) {
+            if (*link < 0 || *link >= file->owner_capacity || used[*link]) {
+                *link = RL_NO_OWNER;
+                break;
             }
-            rlck->nb_owners = nb_owners;
-            if (organize_owners(rlck) == -1)
-                return -1;
+            rl_owner_node *node = &pool[*link];
+            used[*link] = 1;
+            node->start = lck->start;
+            node->len = lck->len;
+            node->type = lck->type;
+            link_held(file, *link);
+            nb_owners++;
+        }
+        if (nb_owners == 0) {
+            erase_lock(lck);
+            lck->first_owner = file->free_lock;
+            file->free_lock = slot;
+            continue;
+        }
+
+        lck->nb_owners = nb_owners;
+        int pos = lower_bound(file, file->nb_locks, lck->start + 1, lck->len);
+        move_lock_entries(file, pos + 1, pos, file->nb_locks - pos);
+        get_lock_index(file)[pos] = slot;
+        set_lock_fields(file, pos, lck);
+        file->nb_locks++;
+        if (lck->len > file->max_len)
+            file->max_len = lck->len;
+        mark_lock(file, lck, 1);
+    }
+
+    file->free_owner = RL_NO_OWNER;
+    for (int i = file->owner_capacity - 1; i >= 0; i--) {
+        if (!used[i])
+            free_owner_node(file, i);
+    }
+    free(used);
+    return 0;
+}
+
+/**
+ * @brief Repairs `file` after a process died while holding its mutex, then
+ * removes the locks and the requests of the processes that are dead
+ *
+ * The lock table, the PID map and the wait queue are made consistent again,
+ * the lock of the fast path is counted again in the version buckets, and the
+ * read locks that were being moved from the reader slots to the lock table are
+ * announced in their slots again. A lock that was being moved from the fast
+ * path to the lock table when its mover died is lost. Must be called with the
+ * mutex of the file held.
+ *
+ * @param file the file to repair
+ * @return 0 on success, -1 on error
+ */
+static int repair_file(rl_open_file *file) {
+    unsigned long seq = atomic_load(&file->seq);
+    file->update_depth = 0;
+    if (seq & 1)
+        atomic_store(&file->seq, seq + 1);
+    begin_update(file);
+
+    file->nb_map_entries = 0;
+    file->nb_removed_map_entries = 0;
+    for (int i = 0; i < file->map_capacity; i++) {
+        rl_pid_fd_count *entry = &get_pid_map(file)[i];
+        if (entry->pid == RL_REMOVED_MAP_ENTRY)
+            file->nb_removed_map_entries++;
+        if (!is_map_entry_used(entry))
+            continue;
+        file->nb_map_entries++;
+        /* the map was being rehashed, the counts are lost */
+        if (atomic_load(&entry->fd_count) == RL_MOVED_FD_COUNT)
+            atomic_store(&entry->fd_count, 1);
+    }
+
+    int res = rebuild_locks(file);
+    uint64_t word = atomic_load(&file->fast_lock);
+    if (fast_state(word) == RL_FAST_HELD)
+        mark_versions(file, &file->fast_held, 1);
+    for (int i = 0; i < RL_NB_READER_SLOTS; i++) {
+        rl_reader_slot *slot = &file->reader_slots[i];
+        if (fast_state(atomic_load(&slot->word)) == RL_FAST_CLOSED)
+            atomic_store(&slot->word,
+                    fast_word(slot->owner.pid, RL_FAST_HELD));
+    }
+
+    file->nb_waiters = 0;
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &file->wait_queue[i];
+        if (is_waiter_free(cur))
+            continue;
+        if (kill(cur->owner.pid, 0) == -1 && errno == ESRCH) {
+            if (cur->async)
+                remove_notify_fifo(cur->notify_path);
+            erase_waiter(cur);
+        } else
+            file->nb_waiters++;
+    }
+
+    for (int i = 0; res == 0 && i < file->map_capacity; i++) {
+        rl_pid_fd_count *entry = &get_pid_map(file)[i];
+        if (!is_map_entry_used(entry)
+                || !(kill(entry->pid, 0) == -1 && errno == ESRCH))
+            continue;
+        res = remove_held_locks(file, entry->pid, -1);
+        remove_records_of(file, entry->pid, -1);
+        remove_map_entry(file, entry);
+    }
+    wake_waiters(file, 0, 0);
+    end_update(file);
+    return res;
+}
+
+/**
+ * @brief Takes the mutex of `file`, repairing the file if the previous holder
+ * of the mutex died while holding it
+ * @param file the file whose mutex to take
+ * @return 0 on success, -1 on error, in which case the mutex is not held
+ */
+static int lock_file(rl_open_file *file) {
+    int err = pthread_mutex_lock(&file->mutex);
+    if (err == EOWNERDEAD) {
+        err = pthread_mutex_consistent(&file->mutex);
+        if (err == 0 && repair_file(file) == -1) {
+            pthread_mutex_unlock(&file->mutex);
+            return -1;
         }
     }
-    if (organize_locks(lfd.file) == -1)
+    if (err != 0) {
+        errno = err;
         return -1;
-    for (int i = 0; i < nb_new_locks; i++) {
-        rl_lock *tmp = find_lock(lfd.file, &new_locks[i]);
-        if (tmp != NULL) {
-            if (add_owner(lfd_owner, tmp) == -1)
-                return -1;
-        } else {
-            if (add_lock(&new_locks[i], lfd.file, lfd_owner) == -1)
+    }
+    return 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Puts in `buffer` the name of the shm corresponding to `fd`
+ * @param fd a file descriptor associated to a regular file
+ * @param buffer a memory zone big enough for the shm name
+ * @return 0 on success, -1 on error
+ */
+static int get_shm_name(int fd, char *buffer) {
+    struct stat st;
+    if (fstat(fd, &st))
+        return -1;
+    
+    int sprintf_res = sprintf(buffer, "/%s_%lu_%lu", SHM_PREFIX,
+            st.st_dev, st.st_ino);
+    if (sprintf_res < 0)
+        return -1;
+    
+    return 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Maps the wait graph shared by the processes using the library,
+ * creating it if it does not exist
+ *
+ * The process that creates the shared memory object initializes it, the other
+ * ones wait until it is sized and marked as ready.
+ *
+ * @return the wait graph, NULL on error
+ */
+static rl_wait_graph *open_wait_graph() {
+    int created = 1;
+    int fd = shm_open(RL_WAIT_GRAPH_NAME, O_RDWR | O_CREAT | O_EXCL,
+            S_IRWXU | S_IRWXG | S_IRWXO);
+    if (fd == -1) {
+        if (errno != EEXIST)
+            return NULL;
+        created = 0;
+        fd = shm_open(RL_WAIT_GRAPH_NAME, O_RDWR, 0);
+        if (fd == -1)
+            return NULL;
+    } else if (ftruncate(fd, sizeof(rl_wait_graph)) == -1) {
+        close(fd);
+        shm_unlink(RL_WAIT_GRAPH_NAME);
+        return NULL;
+    }
+
+    struct stat st;
+    for (;;) {
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            return NULL;
+        }
+        if (st.st_size >= (off_t) sizeof(rl_wait_graph))
+            break;
+        sched_yield();
+    }
+
+    rl_wait_graph *graph = mmap(NULL, sizeof(rl_wait_graph),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (graph == MAP_FAILED)
+        return NULL;
+
+    if (created) {
+        if (initialize_mutex(&graph->mutex) != 0) {
+            munmap(graph, sizeof(rl_wait_graph));
+            shm_unlink(RL_WAIT_GRAPH_NAME);
+            return NULL;
+        }
+        for (int i = 0; i < RL_MAX_WAIT_EDGES; i++)
+            atomic_init(&graph->edges[i].pid, RL_FREE_EDGE);
+        atomic_store(&graph->ready, 1);
+    }
+    while (!atomic_load(&graph->ready))
+        sched_yield();
+    return graph;
+}
+
+/**
+ * @brief Initializes the library
+ * 
+ * You must call this function before using the library. The child processes
+ * created with `fork()` keep the wait graph of their parent.
+ *
+ * @return 0 on success, -1 if the wait graph shared by the processes could
+ * not be opened
+ */
+int rl_init_library() {
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_conflicts = scan_conflicts_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        scan_conflicts = scan_conflicts_sse42;
+#endif
+    atomic_init(&rla.nb_files, 0);
+    for (int i = 0; i < RL_MAX_FILES; i++) {
+        atomic_init(&rla.open_files[i], RL_FREE_FILE);
+        initialize_combiner(&rla.combiners[i]);
+    }
+    if (wait_graph == NULL)
+        wait_graph = open_wait_graph();
+    return wait_graph == NULL ? -1 : 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Gives the index of `rlo` in the open file descriptions of this
+ * process
+ *
+ * The open files are never removed and are added in the first free slot, so
+ * that the lookup stops at the first free slot and needs no lock.
+ *
+ * @param rlo the open file to look for
+ * @return the index of `rlo`, -1 if it is not there
+ */
+static int find_in_rla(rl_open_file *rlo) {
+    for (int i = 0; i < RL_MAX_FILES; i++) {
+        rl_open_file *cur = atomic_load(&rla.open_files[i]);
+        if (cur == rlo)
+            return i;
+        if (cur == RL_FREE_FILE)
+            break;
+    }
+    return -1;
+}
+
+/**
+ * @brief Adds the given open file to the open file descriptions of this process
+ * if it is not already there
+ *
+ * The first free slot is taken with a CAS, so that the threads opening files
+ * concurrently do not need a lock, and that two threads adding the same file
+ * agree on a single slot. Fails if rla is full and rlo must be added
+ *
+ * @param rlo the open file to add
+ * @return 0 on success, -1 on error
+ */
+static int add_to_rla(rl_open_file *rlo) {
+    for (int i = 0; i < RL_MAX_FILES; i++) {
+        rl_open_file *cur = RL_FREE_FILE;
+        if (atomic_compare_exchange_strong(&rla.open_files[i], &cur, rlo)) {
+            atomic_fetch_add(&rla.nb_files, 1);
+            return 0;
+        }
+        if (cur == rlo)
+            return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Opens the file at the given path with the mode `mode` and maps its
+ * `rl_open_file`, creating it in the mode given by `record_size` if it doesn't
+ * exist
+ * @param path the relative or absolute path to the file
+ * @param oflag the flags passed to `open()`
+ * @param mode the mode passed to `open()` if O_CREAT flag is specified
+ * @param record_size the size of the records of the file, 0 to lock ranges of
+ *                    bytes
+ * @return the rl_descriptor of the file, fd -1 and NULL on error
+ */
+static rl_descriptor open_file(const char *path, int oflag, mode_t mode,
+        off_t record_size) {
+    rl_descriptor err_desc = {.fd = -1, .file = NULL};
+
+    if (atomic_load(&rla.nb_files) >= RL_MAX_FILES) {
+        errno = EMFILE;
+        return err_desc;
+    }
+
+    int open_res;
+    if (oflag & O_CREAT)
+        open_res = open(path, oflag, mode);
+    else
+        open_res = open(path, oflag);
+
+    if (open_res == -1)
+        return err_desc;
+
+    char shm_path[RL_SHM_NAME_MAX];
+    if (get_shm_name(open_res, shm_path)) {
+        close(open_res);
+        return err_desc;
+    }
+
+    int shm_res = shm_open(shm_path, O_RDWR, 0);
+    int shm_res2 = -1;
+    rl_open_file *rlo = NULL;
+    // Problem: process 1 creates the shm and is paused before initializing it
+    // then process 2 comes here and the shm exists but is not initialized
+    if (shm_res >= 0) {
+        rlo = mmap(NULL, RL_SEGMENT_MAX_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED, shm_res, 0);
+        if (rlo == MAP_FAILED) {
+        error2:
+            close(open_res);
+            close(shm_res);
+            return err_desc;
+        }
+        if (record_size != 0 && rlo->record_size != record_size) {
+            munmap(rlo, RL_SEGMENT_MAX_SIZE);
+            errno = EINVAL;
+            goto error2;
+        }
+
+        if (!map_try_increment(rlo, getpid())) {
+            if (lock_file(rlo))
+                goto error2;
+
+            if (map_increment(rlo, getpid()))
+                goto error2;
+
+            if (msync(rlo, rlo->size, MS_SYNC | MS_INVALIDATE) == -1)
+                goto error2;
+            if (pthread_mutex_unlock(&rlo->mutex))
+                goto error2;
+        }
+    } else { // We create the shm
+        shm_res2 = shm_open(shm_path, O_RDWR | O_CREAT,
+                S_IRWXU | S_IRWXG | S_IRWXO);
+        if (shm_res2 == -1) {
+            close(open_res);
+            shm_unlink(shm_path);
+            return err_desc;
+        }
+        
+        size_t lock_table = align_offset(sizeof(rl_open_file));
+        size_t lock_index = align_offset(lock_table
+                + RL_INITIAL_LOCKS * sizeof(rl_lock));
+        size_t lock_starts = align_offset(lock_index
+                + RL_INITIAL_LOCKS * sizeof(int));
+        size_t lock_ends = align_offset(lock_starts
+                + RL_INITIAL_LOCKS * sizeof(int64_t));
+        size_t lock_writes = align_offset(lock_ends
+                + RL_INITIAL_LOCKS * sizeof(int64_t));
+        size_t pid_map = align_offset(lock_writes
+                + RL_INITIAL_LOCKS * sizeof(int64_t));
+        size_t owner_pool = align_offset(pid_map
+                + RL_INITIAL_MAP_ENTRIES * sizeof(rl_pid_fd_count));
+        size_t size = owner_pool + RL_INITIAL_OWNERS * sizeof(rl_owner_node);
+        int trunc_res = ftruncate(shm_res2, size);
+        if (trunc_res == -1) {
+        error:
+            close(open_res);
+            close(shm_res2);
+            shm_unlink(shm_path);
+            return err_desc;
+        }
+
+        rlo = mmap(NULL, RL_SEGMENT_MAX_SIZE, PROT_READ | PROT_WRITE,
+                MAP_SHARED, shm_res2, 0);
+        if (rlo == MAP_FAILED)
+            goto error;
+
+        if (initialize_mutex(&rlo->mutex))
+            goto error;
+        if (pthread_mutex_lock(&rlo->mutex)) 
+            goto error;
+
+        strcpy(rlo->shm_name, shm_path);
+        rlo->size = size;
+        rlo->lock_table = lock_table;
+        rlo->lock_index = lock_index;
+        rlo->lock_starts = lock_starts;
+        rlo->lock_ends = lock_ends;
+        rlo->lock_writes = lock_writes;
+        rlo->lock_capacity = RL_INITIAL_LOCKS;
+        rlo->pid_map = pid_map;
+        rlo->map_capacity = RL_INITIAL_MAP_ENTRIES;
+        rlo->owner_pool = owner_pool;
+        rlo->owner_capacity = RL_INITIAL_OWNERS;
+
+        rlo->nb_map_entries = 0;
+        rlo->nb_removed_map_entries = 0;
+        for (int i = 0; i < rlo->map_capacity; i++)
+            erase_map_entry(&get_pid_map(rlo)[i]);
+
+        if (map_increment(rlo, getpid()))
+            goto error;
+
+        atomic_init(&rlo->seq, 0);
+        rlo->update_depth = 0;
+        for (int i = 0; i < RL_NB_VERSION_BUCKETS; i++) {
+            atomic_init(&rlo->buckets[i].version, 0);
+            atomic_init(&rlo->buckets[i].nb_writers, 0);
+        }
+        memset(&rlo->occupancy, 0, sizeof(rl_occupancy));
+        atomic_init(&rlo->fast_lock,
+                record_size > 0 ? RL_FAST_CLOSED : RL_FAST_OPEN);
+        rlo->reader_bias = 0;
+        atomic_init(&rlo->biased, 0);
+        rlo->bias_inhibited_until.tv_sec = 0;
+        rlo->bias_inhibited_until.tv_nsec = 0;
+        for (int i = 0; i < RL_NB_READER_SLOTS; i++)
+            atomic_init(&rlo->reader_slots[i].word, RL_FAST_OPEN);
+        rlo->record_size = record_size;
+        rlo->append_tail = 0;
+        for (int i = 0; i < RL_MAX_RECORD_OWNERS; i++) {
+            atomic_init(&rlo->record_owners[i].pid, RL_FREE_RECORD_OWNER);
+            atomic_init(&rlo->record_owners[i].nb_records, -1);
+            atomic_init(&rlo->record_owners[i].first_record, RL_MAX_RECORDS);
+            atomic_init(&rlo->record_owners[i].end_record, 0);
+        }
+        for (int i = 0; i < RL_MAX_RECORD_CHUNKS; i++)
+            atomic_init(&rlo->record_chunks[i], 0);
+        for (int i = 0; i < RL_NB_STRIPES; i++) {
+            if (initialize_mutex(&rlo->stripes[i].mutex)
+                    || initialize_cond(&rlo->stripes[i].released))
+                goto error;
+            atomic_init(&rlo->stripes[i].nb_waiters, 0);
+        }
+        rlo->nb_locks = 0;
+        rlo->max_len = 0;
+        rlo->free_lock = 0;
+        for (int i = 0; i < rlo->lock_capacity; i++) {
+            erase_lock(&get_lock_table(rlo)[i]);
+            get_lock_table(rlo)[i].first_owner = (i + 1 < rlo->lock_capacity) ?
+                i + 1 : RL_NO_LOCK;
+        }
+
+        rlo->free_owner = 0;
+        for (int i = 0; i < rlo->owner_capacity; i++)
+            get_owner_pool(rlo)[i].next = (i + 1 < rlo->owner_capacity) ?
+                i + 1 : RL_NO_OWNER;
+
+        rlo->policy = RL_POLICY_FIFO;
+        rlo->handoff = 0;
+        rlo->nb_waiters = 0;
+        rlo->next_ticket = RL_FREE_WAITER + 1;
+        for (int i = 0; i < RL_MAX_WAITERS; i++) {
+            rlo->wait_queue[i].edge = RL_NO_EDGE;
+            erase_waiter(&rlo->wait_queue[i]);
+            if (initialize_cond(&rlo->wait_queue[i].wakeup))
+                goto error;
+        }
+
+        if (msync(rlo, rlo->size, MS_SYNC | MS_INVALIDATE) == -1)
+            goto error;
+        if (pthread_mutex_unlock(&rlo->mutex))
+            goto error;
+    }
+
+    if (add_to_rla(rlo) == -1) {
+        close(open_res);
+        close(shm_res);
+        close(shm_res2);
+        return err_desc;
+    }
+
+    rl_descriptor desc = {.fd = open_res, .file = rlo};
+    return desc;
+}
+
+/**
+ * @brief Opens the file at the given path
+ *
+ * Opens `path` with the open() system call (identical parameters). Also does
+ * the memory projection of the `rl_open_file` associated with the file at path,
+ * creating the shared memory object if it doesn't exist. Returns the
+ * corresponding `rl_descriptor`.
+ *
+ * Every process maps `RL_SEGMENT_MAX_SIZE` bytes of address space for each
+ * file it opens, but only the pages of the object in use take memory. The
+ * object cannot grow beyond that size: the requests that would need more room
+ * fail with ENOMEM, knowing that the regions left behind when the tables of
+ * the file grow are not reused until the last process closes it. Define
+ * `RL_SEGMENT_MAX_SIZE` when compiling the library and its users to change
+ * the size.
+ *
+ * @param path the relative or absolute path to the file
+ * @param oflag the flags passed to `open()`
+ * @param ... the mode (permissions) for the new file, required if O_CREAT flag
+ *            is specified
+ * @return the rl_descriptor containing the file descriptor returned by open()
+ *         and a pointer to the rl_open_file associated to the file, or an
+ *         rl_descriptor containing fd -1 and rl_open_file pointer NULL on error
+ */
+rl_descriptor rl_open(const char *path, int oflag, ...) {
+    mode_t mode = 0;
+    if (oflag & O_CREAT) {
+        va_list va;
+        va_start(va, oflag);
+        mode = va_arg(va, mode_t);
+        va_end(va);
+    }
+    return open_file(path, oflag, mode, 0);
+}
+
+/**
+ * @brief Opens the file at the given path, whose locks are put on whole
+ * records of `record_size` bytes
+ *
+ * Same as `rl_open()`, except that if the locks on the file are not shared with
+ * another process yet, they are kept as per-record words updated with atomic
+ * operations instead of ranges of bytes. The requests of `rl_fcntl()` must then
+ * start and end on a record boundary, and locks cannot be extensible. Only the
+ * first `RL_MAX_RECORDS` records can be locked, by at most
+ * `RL_MAX_RECORD_OWNERS` (32) owners holding or waiting for locks at a time,
+ * as each record is a 64-bit word with a read bit and a write bit per owner: a
+ * request of another owner fails with ENOLCK until one of them unlocks all its
+ * records, closes its descriptor or dies.
+ * Asynchronous requests, hand-offs and optimistic reads are not available, and
+ * deadlocks are not detected.
+ *
+ * @param path the relative or absolute path to the file
+ * @param oflag the flags passed to `open()`
+ * @param record_size the size of the records of the file, greater than 0
+ * @param ... the mode (permissions) for the new file, required if O_CREAT flag
+ *            is specified
+ * @return the rl_descriptor of the file, or an rl_descriptor containing fd -1
+ *         and rl_open_file pointer NULL on error, with errno set to EINVAL if
+ *         the locks on the file are shared with another record size
+ */
+rl_descriptor rl_open_records(const char *path, int oflag, off_t record_size,
+        ...) {
+    if (record_size <= 0) {
+        errno = EINVAL;
+        rl_descriptor err_desc = {.fd = -1, .file = NULL};
+        return err_desc;
+    }
+
+    mode_t mode = 0;
+    if (oflag & O_CREAT) {
+        va_list va;
+        va_start(va, record_size);
+        mode = va_arg(va, mode_t);
+        va_end(va);
+    }
+    return open_file(path, oflag, mode, record_size);
+}
+
+/**
+ * @brief Checks if the lock is owned by an rl_owner different than owner
+ * 
+ * This function does not use any locking mechanism to secure the access to
+ * lock, nor tests if owner is in fact an owner of lock.
+ * 
+ * @param file the file that contains the lock
+ * @param lock the lock to check
+ * @param owner the owner to compare the lock owners with
+ * @return 1 if the lock is owned by a different owner, 0 otherwise
+ */
+static int has_different_owner(rl_open_file *file, rl_lock *lock,
+        rl_owner owner) {
+    if (lock->nb_owners == 0)
+        return 0;
+    for (rl_owner_node *cur = owner_node(file, lock->first_owner);
+            cur != NULL; cur = owner_node(file, cur->next)) {
+        if (!equals(cur->owner, owner))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Computes the starting offset of the lock of the file denoted by fd.
+ * @param lck a lock on a region
+ * @param fd the file descriptor of the file to lock
+ * @return the starting offset of the region or -1 if it could not be determined
+ */
+static off_t get_start(struct flock *lck, int fd) {
+    if (lck == NULL)
+        return -1;
+
+    if (lck->l_whence == SEEK_SET) {
+        if (lck->l_start >= 0)
+            return lck->l_start;
+        else
+            return -1; // before beginning of file !
+    } else if (lck->l_whence == SEEK_CUR || lck->l_whence == SEEK_END) {
+        off_t cur = lseek(fd, 0, SEEK_CUR); // current offset
+        if (cur == -1)
+            return -1;
+        off_t pos = lseek(fd, lck->l_start, lck->l_whence); // lock offset
+        if (pos == -1)
+            return -1;
+        if (lseek(fd, cur, SEEK_SET) == -1)
+            return -1;
+        return pos;
+    }
+    return -1;
+}
+
+/**
+ * @brief Checks if a lock of type `type` can be put on the segment (start, len)
+ * of `file` by `owner`
+ * 
+ * This function only checks for conflicting locks, it doesn't verify if the
+ * lock table is big enough for the new locks. This is done in other functions.
+ * This function does not use any locking mechanism, so be sure to take the lock
+ * before entering this function in order to verify mutual exclusion.
+ *
+ * @param file the file on which to put the lock
+ * @param owner the owner of the lock to put
+ * @param type the type of the lock to put (F_RDLCK, F_WRLCK, F_UNLCK)
+ * @param start the start of the segment, at or after the beginning of the file
+ * @param len the length of the segment, 0 if extensible
+ * @return 1 if the lock is applicable, 0 if it is not, -1 if an error occured.
+ * If the lock is not applicable because of a lock put by a process that has
+ * died and has not removed its locks, returns the pid of that process.
+ */
+static pid_t is_lock_applicable(rl_open_file *file, rl_owner owner, short type,
+        off_t start, off_t len) {
+    if (file == NULL)
+        return -1;
+
+    if (type == F_UNLCK)
+        return 1;
+
+    if (file->nb_locks < 0 || file->nb_locks > file->lock_capacity)
+        return -1;
+    if (!may_conflict(file, type, start, len))
+        return 1;
+
+    rl_window window;
+    find_window(file, file->nb_locks, start, len, &window);
+    for (int i = next_conflict(file, &window, window_begin(&window), type,
+                    start, len); i < window.end;
+            i = next_conflict(file, &window, window_next(&window, i), type,
+                    start, len)) {
+        rl_lock *cur = get_lock(file, i);
+        if (has_different_owner(file, cur, owner)) {
+            /* check if owner is still alive */
+            for (rl_owner_node *other = owner_node(file, cur->first_owner);
+                    other != NULL; other = owner_node(file, other->next)) {
+                if (!equals(owner, other->owner)) {
+                    if (kill(other->owner.pid, 0) == -1 && errno == ESRCH)
+                        return other->owner.pid;
+                    else
+                        return 0;
+                }
+            }
+
+            /* there is a different owner that has not been found */
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Fills `lck` with the first lock of `file` that prevents `owner` from
+ * putting a lock of type `lck->l_type` on the segment (start, lck->l_len)
+ *
+ * This function does not take the mutex of the file. It reads a snapshot of
+ * the lock table between two loads of `file->seq` and retries as long as the
+ * table was being modified, that is if the counter was odd or changed in
+ * between. Locks whose owners are all dead are not reported. If no lock
+ * conflicts, `lck->l_type` is set to F_UNLCK and the other fields are left
+ * unchanged.
+ *
+ * @param file the file that contains the locks
+ * @param owner the owner of the lock that would be put
+ * @param lck the lock that would be put, of type F_RDLCK or F_WRLCK
+ * @param start the start of the segment, at or after the beginning of the file
+ */
+static void get_conflicting_lock(rl_open_file *file, rl_owner owner,
+        struct flock *lck, off_t start) {
+    short type;
+    off_t lock_start, lock_len;
+    pid_t holder;
+    for (;;) {
+        unsigned long seq = atomic_load_explicit(&file->seq,
+                memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        type = F_UNLCK;
+        lock_start = lock_len = 0;
+        holder = 0;
+        int nb_locks = file->nb_locks;
+        int capacity = file->lock_capacity;
+        if (nb_locks < 0 || nb_locks > capacity)
+            nb_locks = capacity;
+        /* the index must not be walked beyond the capacity of its region */
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->seq, memory_order_relaxed) != seq)
+            continue;
+        if (!may_conflict(file, lck->l_type, start, lck->l_len)) {
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&file->seq, memory_order_relaxed) == seq)
+                break;
+            continue;
+        }
+        rl_window window;
+        find_window(file, nb_locks, start, lck->l_len, &window);
+        for (int i = next_conflict(file, &window, window_begin(&window),
+                        lck->l_type, start, lck->l_len);
+                i < window.end && type == F_UNLCK;
+                i = next_conflict(file, &window, window_next(&window, i),
+                        lck->l_type, start, lck->l_len)) {
+            rl_lock *cur = get_lock(file, i);
+            short cur_type = cur->type;
+            off_t cur_start = cur->start, cur_len = cur->len;
+            if ((cur_type != F_WRLCK && lck->l_type != F_WRLCK)
+                    || !seg_overlap(cur_start, cur_len, start, lck->l_len))
+                continue;
+
+            /* the owner list may be modified while it is walked */
+            size_t nb_owners = cur->nb_owners;
+            int pool_capacity = file->owner_capacity;
+            int next = cur->first_owner;
+            for (size_t j = 0; j < nb_owners; j++) {
+                if (next < 0 || next >= pool_capacity)
+                    break;
+                rl_owner_node node = get_owner_pool(file)[next];
+                rl_owner other = node.owner;
+                if (!equals(other, owner)
+                        && !(kill(other.pid, 0) == -1 && errno == ESRCH)) {
+                    type = cur_type;
+                    lock_start = cur_start;
+                    lock_len = cur_len;
+                    holder = other.pid;
+                    break;
+                }
+                next = node.next;
+            }
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->seq, memory_order_relaxed) == seq)
+            break;
+    }
+
+    lck->l_type = type;
+    if (type == F_UNLCK)
+        return;
+    lck->l_whence = SEEK_SET;
+    lck->l_start = lock_start;
+    lck->l_len = lock_len;
+    lck->l_pid = holder;
+}
+
+/**
+ * @brief Checks if `ol` and `or` have the same PID
+ * @param ol the left owner
+ * @param or the right owner
+ * @return 1 if `ol` and `or` have the same PID, 0 otherwise
+ */
+static int same_pid(rl_owner ol, rl_owner or) {
+    return ol.pid == or.pid;
+}
+
+/**
+ * @brief Removes the locks owned by the process of given PID in the given
+ * rl_open_file
+ *
+ * This function does not use any locking mechanism, be sure that mutual
+ * exclusion is assured before using it. If after removal a lock is empty, it is
+ * also deleted. Only the locks held by the process are visited, unless its
+ * entry of the PID map has already been erased, in which case every lock of the
+ * file is.
+ *
+ * @param pid the PID of the process that owns the locks to remove
+ * @param file the file that contains the locks to remove
+ * @return 0 on success, -1 on error
+ */
+static int remove_locks_of(pid_t pid, rl_open_file *file) {
+    if (pid <= 0 || file == NULL || file->nb_locks < 0
+            || file->nb_locks > file->lock_capacity)
+        return -1;
+
+    /* the locks of a process whose map entry was erased are not listed */
+    if (find_map_entry(file, pid) == NULL) {
+        rl_owner cmp = {.pid = pid, .fd = 0};
+        return delete_owner_on_criteria(file, same_pid, cmp);
+    }
+    return remove_held_locks(file, pid, -1);
+}
+
+/**
+ * @brief Adds `new` to the locks of `file` if possible, where `first` is the
+ * initial owner of `new`
+ *
+ * This function should be use when `new` is not already a lock of `file`. The
+ * owners that might be stored in `new` are ignored.
+ *
+ * @param new the lock to add
+ * @param file the file in which to add `new`
+ * @param first the initial owner of `new`
+ */
+static int add_lock(rl_lock *new, rl_open_file *file, rl_owner first) {
+    if (new == NULL || file == NULL
+            || reserve_locks(file, file->nb_locks + 1) == -1)
+        return -1;
+    int slot = file->free_lock;
+    rl_lock *tmp = &get_lock_table(file)[slot];
+    file->free_lock = tmp->first_owner;
+    *tmp = *new;
+
+    int pos = lower_bound(file, file->nb_locks, new->start + 1, new->len);
+    move_lock_entries(file, pos + 1, pos, file->nb_locks - pos);
+    get_lock_index(file)[pos] = slot;
+    set_lock_fields(file, pos, new);
+    file->nb_locks++;
+    if (new->len > file->max_len)
+        file->max_len = new->len;
+    tmp->nb_owners = 0;
+    tmp->first_owner = RL_NO_OWNER;
+    if (add_owner(file, first, tmp) == -1)
+        return -1;
+    mark_lock(file, tmp, 1);
+    return 0;
+}
+
+/**
+ * @brief Gets the lock in `file` that starts at the same offset, has the same
+ * length and is of the same type than `lck`
+ * @param file the file that might contain `lck`
+ * @param lck the lock to find in `file`
+ * @return A pointer to the corresponding lock in file or NULL if it was not
+ * found
+ */
+static rl_lock *find_lock(rl_open_file *file, rl_lock *lck) {
+    if (file == NULL || lck == NULL)
+        return NULL;
+    for (int i = lower_bound(file, file->nb_locks, lck->start, lck->len);
+            i < file->nb_locks && get_lock(file, i)->start == lck->start;
+            i++) {
+        rl_lock *tmp = get_lock(file, i);
+        if (tmp->len == lck->len && tmp->type == lck->type)
+            return tmp;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Checks if (s2, l2) is strictly in the middle of (s1, l1)
+ * @param s1 the start of the first segment
+ * @param l1 the length of the first segment, 0 if extensible
+ * @param s2 the start of the second segment
+ * @param l2 the length of the second segment, 0 if extensible
+ * @return 1 if (s2, l2) is strictly in the middle of (s1, l1), 0 otherwise
+ */
+static int strictly_in_middle(off_t s1, off_t l1, off_t s2, off_t l2) {
+    return l2 > 0 && s1 < s2 && (l1 == 0 || s1 + l1 > s2 + l2);
+}
+
+/**
+ * @brief Checks if (s2, l2) covers entirely (s1, l1)
+ * @param s1 the start of the first segment
+ * @param l1 the length of the first segment, 0 if extensible
+ * @param s2 the start of the second segment
+ * @param l2 the length of the second segment, 0 if extensible
+ * @return 1 if (s2, l2) covers entirely (s1, l1), 0 otherwise
+ */
+static int covers_entirely(off_t s1, off_t l1, off_t s2, off_t l2) {
+    return (l1 > 0 && l2 > 0 && s1 >= s2 && s1 + l1 <= s2 + l2)
+        || (l2 == 0 && s2 <= s1);
+}
+
+/**
+ * @brief Checks if (s2, l2) covers the end of (s1, l1)
+ *
+ * (s2, l2) must start strictly after (s1, l1) and may end at the same byte or
+ * after.
+ *
+ * @param s1 the start of the first segment
+ * @param l1 the length of the first segment, 0 if extensible
+ * @param s2 the start of the second segment
+ * @param l2 the length of the second segment, 0 if extensible
+ * @return 1 if (s2, l2) covers the end of (s1, l1), 0 otherwise
+ */
+static int covers_end(off_t s1, off_t l1, off_t s2, off_t l2) {
+    return (l1 > 0 && l2 > 0 && s1 < s2 && s1 + l1 <= s2 + l2)
+        || (l2 == 0 && s1 < s2);
+}
+
+/**
+ * @brief Unlocks the segment (lck_start, lck_len) of `file` for `owner`
+ *
+ * This function does not use any locking mechanism, ensure mutual exclusion
+ * before the call. If a lock was removed or shrinked, the requests waiting for
+ * a segment overlapping the unlocked region are woken up.
+ *
+ * @param file the file to unlock
+ * @param owner the owner of the locks to remove
+ * @param lck_start the start of the segment, at or after the beginning of the
+ *                  file
+ * @param lck_len the length of the segment, 0 if extensible
+ * @return 0 on success, -1 on error
+ */
+static int apply_unlock(rl_open_file *file, rl_owner owner, off_t lck_start,
+        off_t lck_len) {
+    if (file == NULL)
+        return -1;
+
+    int nb_locks = file->nb_locks;
+    rl_window window;
+    find_window(file, nb_locks, lck_start, lck_len, &window);
+    int nb_candidates = (window.finite_end - window.finite_first)
+        + (window.end - window.ext_first);
+    size_t nb_new_locks = 0;
+    size_t nb_locks_to_remove = 0;
+    rl_lock new_batch[2 * RL_UNLOCK_BATCH];
+    size_t remove_batch[RL_UNLOCK_BATCH];
+    rl_lock *new_locks = new_batch;
+    size_t *locks_to_remove = remove_batch;
+    /* the table is not bounded, the stack is */
+    if (nb_candidates > RL_UNLOCK_BATCH) {
+        new_locks = malloc(2 * nb_candidates * sizeof(rl_lock));
+        locks_to_remove = malloc(nb_candidates * sizeof(size_t));
+        if (new_locks == NULL || locks_to_remove == NULL) {
+            free(new_locks);
+            free(locks_to_remove);
+            return -1;
+        }
+    }
+    for (int i = window_begin(&window); i < window.end;
+            i = window_next(&window, i)) {
+        rl_lock *cur = get_lock(file, i);
+        if (is_owner_of(file, owner, cur)
+                && seg_overlap(lck_start, lck_len, cur->start, cur->len)) {
+            locks_to_remove[nb_locks_to_remove] = i;
+            nb_locks_to_remove++;
+            if (strictly_in_middle(cur->start, cur->len, lck_start,
+                            lck_len)) {
+                rl_lock l1, l2;
+                l1.type = cur->type;
+                l1.start = cur->start;
+                l1.len = lck_start - cur->start;
+                new_locks[nb_new_locks] = l1;
+                nb_new_locks++;
+
+                l2.type = cur->type;
+                l2.start = lck_start + lck_len;
+                l2.len = (cur->len == 0) ?
+                    0 : (cur->start + cur->len) - (lck_start + lck_len);
+                new_locks[nb_new_locks] = l2;
+                nb_new_locks++;
+            } else if (covers_entirely(cur->start, cur->len, lck_start,
+                            lck_len))
+                continue;
+            else if (covers_end(cur->start, cur->len, lck_start, lck_len)) {
+                rl_lock l1;
+                l1.type = cur->type;
+                l1.start = cur->start;
+                l1.len = lck_start - cur->start;
+                new_locks[nb_new_locks] = l1;
+                nb_new_locks++;
+            } else { /* unlock beginning of cur */
+                rl_lock l1;
+                l1.type = cur->type;
+                l1.start = lck_start + lck_len;
+                l1.len = (cur->len == 0) ?
+                    0 : (cur->start + cur->len) - (lck_start + lck_len);
+                new_locks[nb_new_locks] = l1;
+                nb_new_locks++;
+            }
+        }
+    }
+    int res = -1;
+    if (reserve_locks(file, nb_new_locks + nb_locks) == -1)
+        goto out;
+
+    begin_update(file);
+    for (int i = 0; i < nb_locks_to_remove; i++) {
+        size_t ind = locks_to_remove[i];
+        rl_lock *rlck = get_lock(file, ind);
+        if (remove_owners(file, rlck, equals, owner) == -1)
+            goto end;
+        if (rlck->nb_owners == 0) {
+            mark_lock(file, rlck, -1);
+            erase_lock(rlck);
+        }
+    }
+    if (organize_locks(file) == -1)
+        goto end;
+    if (nb_locks_to_remove > 0)
+        wake_waiters(file, lck_start, lck_len);
+    for (int i = 0; i < nb_new_locks; i++) {
+        rl_lock *tmp = find_lock(file, &new_locks[i]);
+        if (tmp != NULL) {
+            if (add_owner(file, owner, tmp) == -1)
+                goto end;
+        } else {
+            if (add_lock(&new_locks[i], file, owner) == -1)
+                goto end;
+        }
+    }
+    res = 0;
+
+ end:
+    end_update(file);
+ out:
+    if (new_locks != new_batch) {
+        free(new_locks);
+        free(locks_to_remove);
+    }
+    return res;
+}
+
+/**
+ * @brief Locks the segment (lck_start, lck_len) of `file` for `owner` with a
+ * lock of type `type`
+ *
+ * This function does not use any locking mechanism, ensure mutual exclusion
+ * before the call.
+ *
+ * @param file the file to lock
+ * @param owner the owner of the new lock
+ * @param type the type of the lock (F_RDLCK, F_WRLCK)
+ * @param lck_start the start of the segment, at or after the beginning of the
+ *                  file
+ * @param lck_len the length of the segment, 0 if extensible
+ * @return 0 on success, -1 on error
+ */
+static int apply_rw_lock(rl_open_file *file, rl_owner owner, short type,
+        off_t lck_start, off_t lck_len) {
+    if (reserve_locks(file, file->nb_locks + 2) == -1)
+        return -1;
+
+    int res = -1;
+    begin_update(file);
+    if (apply_unlock(file, owner, lck_start, lck_len) == -1)
+        goto end;
+
+    /* the neighbours overlap the segment extended by one byte on each side */
+    rl_lock *left = NULL;
+    rl_lock *right = NULL;
+    rl_window window;
+    find_window(file, file->nb_locks, lck_start - 1,
+            lck_len == 0 ? 0 : lck_len + 2, &window);
+    for (int i = window_begin(&window); i < window.end;
+            i = window_next(&window, i)) {
+        rl_lock *cur = get_lock(file, i);
+        if (cur->type != type || !is_owner_of(file, owner, cur))
+            continue;
+        if (cur->start + cur->len == lck_start && cur->len > 0)
+            left = cur;
+        else if (cur->start == lck_start + lck_len && lck_len > 0)
+            right = cur;
+    }
+
+    int unlock_left = 0;
+    int unlock_right = 0;
+    rl_lock tmp;
+    tmp.type = type;
+    tmp.start = lck_start;
+    tmp.len = lck_len;
+    if (left != NULL && right != NULL) {
+        if (right->len == 0) tmp.len = 0;
+        else tmp.len += left->len + right->len;
+        tmp.start = left->start;
+        unlock_left = 1;
+        unlock_right = 1;
+    } else if (left != NULL) {
+        if (tmp.len != 0)
+            tmp.len += left->len;
+        tmp.start = left->start;
+        unlock_left = 1;
+    } else if (right != NULL) {
+        if (right->len == 0) tmp.len = 0;
+        else tmp.len += right->len;
+        unlock_right = 1;
+    }
+
+    off_t left_start = 0, left_len = 0, right_start = 0, right_len = 0;
+    if (unlock_left) {
+        left_start = left->start;
+        left_len = left->len;
+    }
+    if (unlock_right) {
+        right_start = right->start;
+        right_len = right->len;
+    }
+
+    if (unlock_left && apply_unlock(file, owner, left_start, left_len) == -1)
+        goto end;
+
+    if (unlock_right
+            && apply_unlock(file, owner, right_start, right_len) == -1)
+        goto end;
+
+    rl_lock *tmp2 = find_lock(file, &tmp);
+    if (tmp2 != NULL) {
+        if (add_owner(file, owner, tmp2) == -1)
+            goto end;
+    } else {
+        if (add_lock(&tmp, file, owner) == -1)
+            goto end;
+    }
+    res = 0;
+
+ end:
+    end_update(file);
+    return res;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Tries to apply the lock or unlock `lck` of `owner` on `file` without
+ * taking its mutex
+ *
+ * While the fast path is open, the file has no lock and no waiter, so that a
+ * lock is granted by claiming the fast path with a single CAS. The lock is
+ * then kept in `fast_held` instead of the lock table, until its owner releases
+ * it with another CAS or another request closes the fast path and moves it to
+ * the table. An unlock is also done without the mutex when the owner has no
+ * lock on the file, which the state of the fast path tells.
+ *
+ * @param file the file on which to apply `lck`
+ * @param owner the owner of the lock
+ * @param lck the lock to apply, whose start is relative to the beginning of the
+ *            file
+ * @return 1 if `lck` was applied, 0 if it must be applied under the mutex
+ */
+static int fast_fcntl(rl_open_file *file, rl_owner owner, struct flock *lck) {
+    uint64_t word = atomic_load(&file->fast_lock);
+    int state = fast_state(word);
+    if (lck->l_type != F_UNLCK) {
+        if (state != RL_FAST_OPEN
+                || !atomic_compare_exchange_strong(&file->fast_lock, &word,
+                        fast_word(owner.pid, RL_FAST_CLAIMED)))
+            return 0;
+        file->fast_owner = owner;
+        file->fast_held.start = lck->l_start;
+        file->fast_held.len = lck->l_len;
+        file->fast_held.type = lck->l_type;
+        file->fast_held.nb_owners = 1;
+        file->fast_held.first_owner = RL_NO_OWNER;
+        atomic_store(&file->fast_lock, fast_word(owner.pid, RL_FAST_HELD));
+        mark_versions(file, &file->fast_held, 1);
+        return 1;
+    }
+
+    if (state == RL_FAST_OPEN)
+        return 1;
+    if (state == RL_FAST_CLOSED)
+        return 0;
+    /* the fields of the fast path are those of `owner` only if it holds it */
+    if (fast_pid(word) != owner.pid || state != RL_FAST_HELD)
+        return 1;
+    rl_lock held = file->fast_held;
+    if (!equals(file->fast_owner, owner)
+            || !seg_overlap(held.start, held.len, lck->l_start, lck->l_len))
+        return 1;
+    if (!covers_entirely(held.start, held.len, lck->l_start, lck->l_len)
+            || !atomic_compare_exchange_strong(&file->fast_lock, &word,
+                    fast_word(0, RL_FAST_OPEN)))
+        return 0;
+    mark_versions(file, &held, -1);
+    return 1;
+}
+
+/**
+ * @brief Gives the reader slot of `owner` in `file`
+ * @param file the file that contains the slots
+ * @param owner the owner of the read locks
+ * @return the only slot in which `owner` can announce a read lock
+ */
+static rl_reader_slot *get_reader_slot(rl_open_file *file, rl_owner owner) {
+    pid_t key = (pid_t) ((unsigned) owner.pid * 31u + (unsigned) owner.fd
+            + (unsigned) owner.token * 17u);
+    return &file->reader_slots[hash_pid(key, RL_NB_READER_SLOTS)];
+}
+
+/**
+ * @brief Checks without taking the mutex of `file` whether the process `pid`
+ * may hold locks in its lock table
+ *
+ * The PID map is read between two loads of `file->seq`, the answer being yes
+ * if it was modified in the meantime.
+ *
+ * @param file the file that contains the locks
+ * @param pid the PID of the process
+ * @return 0 if the process holds no lock in the table, 1 if it may hold some
+ */
+static int may_hold_locks(rl_open_file *file, pid_t pid) {
+    unsigned long seq = atomic_load_explicit(&file->seq, memory_order_acquire);
+    if (seq & 1)
+        return 1;
+    size_t offset = file->pid_map;
+    int capacity = file->map_capacity;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&file->seq, memory_order_relaxed) != seq)
+        return 1;
+
+    rl_pid_fd_count *map = (rl_pid_fd_count *) ((char *) file + offset);
+    rl_pid_fd_count *entry = probe_map(map, capacity, pid, NULL);
+    int res = entry == NULL || entry->first_held != RL_NO_OWNER;
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&file->seq, memory_order_relaxed) != seq)
+        return 1;
+    return res;
+}
+
+/**
+ * @brief Tries to apply the read lock or unlock `lck` of `owner` on `file`
+ * through its reader slot, without taking the mutex of the file
+ *
+ * While the file is biased towards readers, it has no write lock and no
+ * waiter, so that a read lock is granted by announcing it in the slot of its
+ * owner, without writing to the lock table. A writer revokes the bias and moves
+ * the announced locks to the table before checking for conflicts. A reader
+ * that finds the bias revoked after announcing its lock withdraws it, unless
+ * the writer already moved it. The lock is released the same way, provided
+ * that its owner has no other lock on the segment in the table.
+ *
+ * @param file the file on which to apply `lck`
+ * @param owner the owner of the lock
+ * @param lck the read lock or unlock to apply, whose start is relative to the
+ *            beginning of the file
+ * @return 1 if `lck` was applied, 0 if it must be applied under the mutex
+ */
+static int biased_fcntl(rl_open_file *file, rl_owner owner,
+        struct flock *lck) {
+    if (lck->l_type == F_WRLCK || !atomic_load(&file->biased))
+        return 0;
+
+    rl_reader_slot *slot = get_reader_slot(file, owner);
+    uint64_t word = atomic_load(&slot->word);
+    int state = fast_state(word);
+    if (lck->l_type == F_UNLCK) {
+        /* a slot being moved to the table may be the one of `owner` */
+        if (state == RL_FAST_CLAIMED || state == RL_FAST_CLOSED
+                || may_hold_locks(file, owner.pid))
+            return 0;
+        if (state == RL_FAST_OPEN || fast_pid(word) != owner.pid
+                || !equals(slot->owner, owner)
+                || !seg_overlap(slot->start, slot->len, lck->l_start,
+                        lck->l_len))
+            return 1;
+        return covers_entirely(slot->start, slot->len, lck->l_start,
+                    lck->l_len)
+            && atomic_compare_exchange_strong(&slot->word, &word,
+                    fast_word(0, RL_FAST_OPEN));
+    }
+
+    if (state != RL_FAST_OPEN
+            || !atomic_compare_exchange_strong(&slot->word, &word,
+                    fast_word(owner.pid, RL_FAST_CLAIMED)))
+        return 0;
+    slot->owner = owner;
+    slot->start = lck->l_start;
+    slot->len = lck->l_len;
+    word = fast_word(owner.pid, RL_FAST_HELD);
+    atomic_store(&slot->word, word);
+    if (atomic_load(&file->biased))
+        return 1;
+    return !atomic_compare_exchange_strong(&slot->word, &word,
+            fast_word(0, RL_FAST_OPEN));
+}
+
+/**
+ * @brief Moves the read lock announced in `slot` to the lock table of `file`
+ *
+ * Must be called with the mutex of the file held. If a process has claimed the
+ * slot but not yet filled in its lock, the function waits for it, unless it
+ * died.
+ *
+ * @param file the file that contains the slot
+ * @param slot the slot to empty
+ * @return 0 on success, -1 if the lock could not be added to the table
+ */
+static int move_reader_slot(rl_open_file *file, rl_reader_slot *slot) {
+    uint64_t word = atomic_load(&slot->word);
+    for (;;) {
+        int state = fast_state(word);
+        if (state == RL_FAST_OPEN)
+            return 0;
+        if (state == RL_FAST_CLAIMED
+                && !(kill(fast_pid(word), 0) == -1 && errno == ESRCH)) {
+            sched_yield();
+            word = atomic_load(&slot->word);
+            continue;
+        }
+        /* the slot stays taken until its lock is in the table */
+        uint64_t next = (state == RL_FAST_HELD) ?
+            fast_word(0, RL_FAST_CLOSED) : fast_word(0, RL_FAST_OPEN);
+        if (atomic_compare_exchange_weak(&slot->word, &word, next)) {
+            if (state != RL_FAST_HELD)
+                return 0;
+            break;
+        }
+    }
+
+    if (apply_rw_lock(file, slot->owner, F_RDLCK, slot->start, slot->len)
+            == -1) {
+        atomic_store(&slot->word, word);
+        return -1;
+    }
+    atomic_store(&slot->word, fast_word(0, RL_FAST_OPEN));
+    return 0;
+}
+
+/**
+ * @brief Moves the read lock announced by `owner` in its reader slot, if any,
+ * to the lock table of `file`
+ *
+ * Must be called with the mutex of the file held.
+ *
+ * @param file the file that contains the slot
+ * @param owner the owner of the read lock
+ * @return 0 on success, -1 if the lock could not be added to the table
+ */
+static int move_own_reader_slot(rl_open_file *file, rl_owner owner) {
+    rl_reader_slot *slot = get_reader_slot(file, owner);
+    uint64_t word = atomic_load(&slot->word);
+    if (fast_state(word) != RL_FAST_HELD || fast_pid(word) != owner.pid
+            || !equals(slot->owner, owner))
+        return 0;
+    return move_reader_slot(file, slot);
+}
+
+/**
+ * @brief Moves the read locks announced in the reader slots of `file` by the
+ * owners of PID `pid` and file descriptor `fd` to its lock table, whatever
+ * their token
+ *
+ * Must be called with the mutex of the file held. The owner of a claimed slot
+ * is only known once its lock is filled in, so the claimed slots of the
+ * process are waited for, unless it died.
+ *
+ * @param file the file that contains the slots
+ * @param pid the PID of the owners
+ * @param fd the file descriptor of the owners, -1 for all of them
+ * @return 0 on success, -1 if a lock could not be added to the table
+ */
+static int move_reader_slots_of(rl_open_file *file, pid_t pid, int fd) {
+    for (int i = 0; i < RL_NB_READER_SLOTS; i++) {
+        rl_reader_slot *slot = &file->reader_slots[i];
+        uint64_t word = atomic_load(&slot->word);
+        while (fast_state(word) == RL_FAST_CLAIMED && fast_pid(word) == pid
+                && !(kill(pid, 0) == -1 && errno == ESRCH)) {
+            sched_yield();
+            word = atomic_load(&slot->word);
+        }
+        if (fast_state(word) == RL_FAST_HELD && fast_pid(word) == pid
+                && (fd == -1 || slot->owner.fd == fd)
+                && move_reader_slot(file, slot) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Revokes the bias of `file` towards readers, moving every announced
+ * read lock to its lock table
+ *
+ * Must be called with the mutex of the file held, before the lock table is
+ * searched for the locks conflicting with a write lock. The bias is not
+ * restored before `RL_BIAS_INHIBIT_FACTOR` times the duration of the
+ * revocation, so that the writers do not pay for it too often.
+ *
+ * @param file the file whose bias to revoke
+ * @return 0 on success, -1 if a lock could not be added to the table, in which
+ * case the bias is kept
+ */
+static int revoke_bias(rl_open_file *file) {
+    if (!atomic_load(&file->biased))
+        return 0;
+
+    struct timespec begin, end;
+    if (clock_gettime(CLOCK_MONOTONIC, &begin) == -1)
+        return -1;
+    atomic_store(&file->biased, 0);
+    for (int i = 0; i < RL_NB_READER_SLOTS; i++) {
+        if (move_reader_slot(file, &file->reader_slots[i]) == -1) {
+            atomic_store(&file->biased, 1);
+            return -1;
+        }
+    }
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        return -1;
+
+    long long elapsed = (end.tv_sec - begin.tv_sec) * 1000000000LL
+        + (end.tv_nsec - begin.tv_nsec);
+    long long until = end.tv_nsec + RL_BIAS_INHIBIT_FACTOR * elapsed;
+    file->bias_inhibited_until.tv_sec = end.tv_sec + until / 1000000000LL;
+    file->bias_inhibited_until.tv_nsec = until % 1000000000LL;
+    return 0;
+}
+
+/**
+ * @brief Restores the bias of `file` towards readers if it is enabled, the
+ * file has no write lock and no waiter, and the bias is not inhibited
+ *
+ * Must be called with the mutex of the file held.
+ *
+ * @param file the file whose bias to restore
+ */
+static void restore_bias(rl_open_file *file) {
+    struct timespec now;
+    if (!file->reader_bias || atomic_load(&file->biased)
+            || file->occupancy.nb_write_locks > 0 || file->nb_waiters > 0
+            || clock_gettime(CLOCK_MONOTONIC, &now) == -1
+            || timespec_before(&now, &file->bias_inhibited_until))
+        return;
+    atomic_store(&file->biased, 1);
+}
+
+/**
+ * @brief Closes the fast paths of `file`, moving the locks taken through them
+ * to the lock table
+ *
+ * Must be called with the mutex of the file held, before the lock table or the
+ * wait queue is read or modified. If a process has claimed the fast path but
+ * not yet filled in its lock, the function waits for it, unless it died. The
+ * read locks announced in the reader slots are left there.
+ *
+ * @param file the file whose fast paths to close
+ * @return 0 on success, -1 if a lock could not be added to the table
+ */
+static int close_fast_path(rl_open_file *file) {
+    uint64_t word = atomic_load(&file->fast_lock);
+    for (;;) {
+        int state = fast_state(word);
+        if (state == RL_FAST_CLOSED)
+            return 0;
+        if (state == RL_FAST_CLAIMED
+                && !(kill(fast_pid(word), 0) == -1 && errno == ESRCH)) {
+            sched_yield();
+            word = atomic_load(&file->fast_lock);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&file->fast_lock, &word,
+                    fast_word(0, RL_FAST_CLOSED)))
+            break;
+    }
+    if (fast_state(word) != RL_FAST_HELD)
+        return 0;
+
+    rl_lock held = file->fast_held;
+    begin_update(file);
+    int res = add_lock(&held, file, file->fast_owner);
+    end_update(file);
+    if (res == -1) {
+        atomic_store(&file->fast_lock, word);
+        return -1;
+    }
+    /* the version buckets have counted the lock since it was taken */
+    mark_versions(file, &held, -1);
+    return 0;
+}
+
+/**
+ * @brief Moves to the lock table of `file` the locks taken through the fast
+ * paths that a request of `owner` of type `type` must see
+ *
+ * A write request needs every read lock announced in the reader slots, which
+ * revokes the bias of the file towards readers. Any other request only needs
+ * the read lock of its own owner, so that the bias survives the readers that
+ * come and go. Must be called with the mutex of the file held, before the lock
+ * table or the wait queue is read or modified.
+ *
+ * @param file the file whose fast paths to close
+ * @param owner the owner of the request
+ * @param type the type of the request (F_RDLCK, F_WRLCK), F_UNLCK for a
+ *             request that only concerns the locks of `owner`
+ * @return 0 on success, -1 if a lock could not be added to the table
+ */
+static int close_fast_paths_for(rl_open_file *file, rl_owner owner,
+        short type) {
+    if (close_fast_path(file) == -1)
+        return -1;
+    if (type == F_WRLCK)
+        return revoke_bias(file);
+    return move_own_reader_slot(file, owner);
+}
+
+/**
+ * @brief Opens the fast path of `file` if it has no lock and no waiter, or
+ * restores its bias towards readers if it is enabled
+ *
+ * Must be called with the mutex of the file held, right before it is released.
+ *
+ * @param file the file whose fast paths to open
+ */
+static void open_fast_path(rl_open_file *file) {
+    uint64_t word = fast_word(0, RL_FAST_CLOSED);
+    if (file->reader_bias)
+        restore_bias(file);
+    else if (file->record_size == 0 && file->nb_locks == 0
+            && file->nb_waiters == 0)
+        atomic_compare_exchange_strong(&file->fast_lock, &word,
+                fast_word(0, RL_FAST_OPEN));
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Takes the mutex of the wait graph, which a dead process may have held
+ * without leaving the graph inconsistent
+ * @return 0 on success, -1 on error
+ */
+static int lock_wait_graph() {
+    int err = pthread_mutex_lock(&wait_graph->mutex);
+    if (err == EOWNERDEAD)
+        err = pthread_mutex_consistent(&wait_graph->mutex);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the queued request `waiter` of `file` to the wait graph
+ *
+ * A free edge is taken, or else the edge of a dead process. The PID of the
+ * owner is stored last, so that the edge is complete once it can be seen.
+ * Nothing is done if the library has no wait graph.
+ *
+ * @param file the file in which the request waits
+ * @param waiter the queued request
+ * @return 0 on success, -1 on error, errno being set to `ENOLCK` if the graph
+ * is full
+ */
+static int add_wait_edge(rl_open_file *file, rl_waiter *waiter) {
+    waiter->edge = RL_NO_EDGE;
+    if (wait_graph == NULL)
+        return 0;
+    if (lock_wait_graph() == -1)
+        return -1;
+
+    int index = RL_NO_EDGE;
+    for (int i = 0; index == RL_NO_EDGE && i < RL_MAX_WAIT_EDGES; i++) {
+        if (atomic_load(&wait_graph->edges[i].pid) == RL_FREE_EDGE)
+            index = i;
+    }
+    for (int i = 0; index == RL_NO_EDGE && i < RL_MAX_WAIT_EDGES; i++) {
+        pid_t pid = atomic_load(&wait_graph->edges[i].pid);
+        if (kill(pid, 0) == -1 && errno == ESRCH)
+            index = i;
+    }
+    if (index != RL_NO_EDGE) {
+        rl_wait_edge *edge = &wait_graph->edges[index];
+        edge->token = waiter->owner.token;
+        strcpy(edge->shm_name, file->shm_name);
+        edge->start = waiter->start;
+        edge->len = waiter->len;
+        edge->type = waiter->type;
+        atomic_store(&edge->pid, waiter->owner.pid);
+        waiter->edge = index;
+    }
+
+    pthread_mutex_unlock(&wait_graph->mutex);
+    if (index == RL_NO_EDGE) {
+        errno = ENOLCK;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Puts a request at the end of the wait queue of `file`
+ *
+ * The request is also added to the wait graph, so that the processes waiting
+ * in other files can see it. This function does not use any locking mechanism
+ * on `file`.
+ *
+ * @param file the file in which the request waits
+ * @param owner the owner requesting the lock
+ * @param type the requested type (F_RDLCK, F_WRLCK)
+ * @param start the beginning of the requested segment
+ * @param len the length of the requested segment, 0 if extensible
+ * @return the index of the request in the wait queue, -1 if the queue or the
+ * wait graph is full, in which case errno is set to `ENOLCK`, or on error
+ */
+static int enqueue_waiter(rl_open_file *file, rl_owner owner, short type,
+        off_t start, off_t len) {
+    if (file->nb_waiters < RL_MAX_WAITERS) {
+        for (int i = 0; i < RL_MAX_WAITERS; i++) {
+            rl_waiter *waiter = &file->wait_queue[i];
+            if (is_waiter_free(waiter)) {
+                waiter->owner = owner;
+                waiter->type = type;
+                waiter->start = start;
+                waiter->len = len;
+                waiter->granted = 0;
+                waiter->async = 0;
+                if (add_wait_edge(file, waiter) == -1)
+                    return -1;
+                waiter->ticket = file->next_ticket++;
+                file->nb_waiters++;
+                return i;
+            }
+        }
+    }
+    errno = ENOLCK;
+    return -1;
+}
+
+/**
+ * @brief Removes the request at `index` from the wait queue of `file`
+ *
+ * The overlapping waiters are woken up, as they might have been waiting behind
+ * the removed request. The FIFO of an asynchronous request is removed, the
+ * descriptor returned by `rl_lock_async()` remaining usable. This function does
+ * not use any locking mechanism.
+ *
+ * @param file the file in which the request waits
+ * @param index the index of the request in the wait queue
+ */
+static void dequeue_waiter(rl_open_file *file, int index) {
+    rl_waiter *waiter = &file->wait_queue[index];
+    if (waiter->async)
+        remove_notify_fifo(waiter->notify_path);
+    erase_waiter(waiter);
+    file->nb_waiters--;
+    wake_waiters(file, waiter->start, waiter->len);
+}
+
+/**
+ * @brief Gets the ticket of the oldest queued write request overlapping the
+ * segment (start, len) that arrived before `before`
+ * @param file the file that contains the wait queue
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @param before the ticket before which the write request must have arrived
+ * @return the ticket of the oldest such write request, `ULONG_MAX` if there is
+ * none
+ */
+static unsigned long head_writer_ticket(rl_open_file *file, off_t start,
+        off_t len, unsigned long before) {
+    unsigned long head = ULONG_MAX;
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &file->wait_queue[i];
+        if (!is_waiter_free(cur) && !cur->granted && cur->type == F_WRLCK
+                && cur->ticket < before && cur->ticket < head
+                && seg_overlap(cur->start, cur->len, start, len))
+            head = cur->ticket;
+    }
+    return head;
+}
+
+/**
+ * @brief Checks if the queued request `waiter` must be served before a request
+ * of type `type` on (start, len) with ticket `ticket`, according to the policy
+ * of `file`
+ *
+ * Both requests must overlap. With `RL_POLICY_FIFO`, conflicting requests are
+ * served in their order of arrival. With `RL_POLICY_WRITER_PREFERRING`, read
+ * requests are served after every write request and write requests in their
+ * order of arrival. With `RL_POLICY_PHASE_FAIR`, a read request waits only for
+ * the oldest write request that arrived before it, and write requests are
+ * served after the older requests and after the read requests waiting for an
+ * older write request, so that read and write phases alternate.
+ *
+ * @param file the file that contains the wait queue
+ * @param waiter the queued request
+ * @param type the type of the other request
+ * @param start the start of the other request
+ * @param len the length of the other request, 0 if extensible
+ * @param ticket the ticket of the other request, `ULONG_MAX` if it is not
+ *               queued
+ * @return 1 if `waiter` must be served first, 0 otherwise
+ */
+static int is_served_before(rl_open_file *file, rl_waiter *waiter, short type,
+        off_t start, off_t len, unsigned long ticket) {
+    if (type == F_RDLCK && waiter->type == F_RDLCK)
+        return 0;
+
+    switch (file->policy) {
+      case RL_POLICY_WRITER_PREFERRING:
+        if (type == F_RDLCK)
+            return 1;
+        return waiter->type == F_WRLCK && waiter->ticket < ticket;
+      case RL_POLICY_PHASE_FAIR:
+        if (type == F_RDLCK)
+            return waiter->ticket == head_writer_ticket(file, start, len,
+                    ticket);
+        if (waiter->ticket < ticket)
+            return 1;
+        return waiter->type == F_RDLCK && head_writer_ticket(file,
+                waiter->start, waiter->len, waiter->ticket) < ticket;
+      default:
+        return waiter->ticket < ticket;
+    }
+}
+
+/**
+ * @brief Checks if `owner` has a lock overlapping the segment (start, len) in
+ * `file`
+ * @param file the file that contains the locks
+ * @param owner the owner of the locks
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @return 1 if such a lock exists, 0 otherwise
+ */
+static int has_overlapping_lock(rl_open_file *file, rl_owner owner,
+        off_t start, off_t len) {
+    rl_window window;
+    find_window(file, file->nb_locks, start, len, &window);
+    for (int i = window_begin(&window); i < window.end;
+            i = window_next(&window, i)) {
+        rl_lock *cur = get_lock(file, i);
+        if (seg_overlap(cur->start, cur->len, start, len)
+                && is_owner_of(file, owner, cur))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if a lock request must wait behind requests of the wait queue
+ * of `file`
+ *
+ * Requests of `owner` on segments where it already has a lock never wait in the
+ * queue, as the queued requests might be waiting for that lock to be released.
+ * Queued requests that have already been granted are ignored, and the ones of
+ * processes that have died are removed from the queue. This function does not
+ * use any locking mechanism.
+ *
+ * @param file the file that contains the wait queue
+ * @param owner the owner requesting the lock
+ * @param type the requested type (F_RDLCK, F_WRLCK)
+ * @param start the beginning of the requested segment
+ * @param len the length of the requested segment, 0 if extensible
+ * @param ticket the ticket of the request if it is queued, `ULONG_MAX`
+ *               otherwise
+ * @return 1 if the request must wait, 0 otherwise
+ */
+static int must_wait_in_queue(rl_open_file *file, rl_owner owner, short type,
+        off_t start, off_t len, unsigned long ticket) {
+    if (file->nb_waiters == 0 || has_overlapping_lock(file, owner, start, len))
+        return 0;
+
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &file->wait_queue[i];
+        if (is_waiter_free(cur) || cur->granted || cur->ticket == ticket
+                || equals(cur->owner, owner)
+                || !seg_overlap(cur->start, cur->len, start, len)
+                || !is_served_before(file, cur, type, start, len, ticket))
+            continue;
+        if (kill(cur->owner.pid, 0) == -1 && errno == ESRCH) {
+            dequeue_waiter(file, i);
+            continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if the request of `waiting` of type `type` on (start, len)
+ * waits, directly or not, for `target`
+ *
+ * The wait-for graph is made of the locks of `file`, each request waiting for
+ * the owners of the conflicting locks, and of its wait queue, each request
+ * waiting for the queued requests that must be served first. The queued
+ * requests are followed depth-first, `visited` marking the ones already
+ * explored. This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the locks and the wait queue
+ * @param waiting the owner of the request
+ * @param type the type of the request (F_RDLCK, F_WRLCK)
+ * @param start the start of the requested segment
+ * @param len the length of the requested segment, 0 if extensible
+ * @param ticket the ticket of the request if it is queued, `ULONG_MAX`
+ *               otherwise
+ * @param target the owner that might be waited for
+ * @param visited for each entry of the wait queue, whether it was explored
+ * @return 1 if the request waits for `target`, 0 otherwise
+ */
+static int is_waiting_for(rl_open_file *file, rl_owner waiting, short type,
+        off_t start, off_t len, unsigned long ticket, rl_owner target,
+        char *visited) {
+    rl_window window;
+    find_window(file, file->nb_locks, start, len, &window);
+    for (int i = window_begin(&window); i < window.end;
+            i = window_next(&window, i)) {
+        rl_lock *cur = get_lock(file, i);
+        if ((cur->type != F_WRLCK && type != F_WRLCK)
+                || !seg_overlap(cur->start, cur->len, start, len))
+            continue;
+
+        for (rl_owner_node *node = owner_node(file, cur->first_owner);
+                node != NULL; node = owner_node(file, node->next)) {
+            rl_owner holder = node->owner;
+            if (equals(holder, waiting))
+                continue;
+            if (equals(holder, target))
+                return 1;
+
+            for (int k = 0; k < RL_MAX_WAITERS; k++) {
+                rl_waiter *q = &file->wait_queue[k];
+                if (is_waiter_free(q) || q->granted || visited[k]
+                        || !equals(q->owner, holder))
+                    continue;
+                visited[k] = 1;
+                if (is_waiting_for(file, q->owner, q->type, q->start, q->len,
+                            q->ticket, target, visited))
+                    return 1;
+            }
+        }
+    }
+
+    if (has_overlapping_lock(file, waiting, start, len))
+        return 0;
+
+    for (int k = 0; k < RL_MAX_WAITERS; k++) {
+        rl_waiter *q = &file->wait_queue[k];
+        if (is_waiter_free(q) || q->granted || q->ticket == ticket
+                || equals(q->owner, waiting)
+                || !seg_overlap(q->start, q->len, start, len)
+                || !is_served_before(file, q, type, start, len, ticket))
+            continue;
+        if (equals(q->owner, target))
+            return 1;
+        if (visited[k])
+            continue;
+        visited[k] = 1;
+        if (is_waiting_for(file, q->owner, q->type, q->start, q->len,
+                    q->ticket, target, visited))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if an owner of PID `pid` and token `token` holds a lock of
+ * `file` that prevents a lock of type `type` on the segment (start, len)
+ *
+ * This function does not take the mutex of the file: it reads the lock table
+ * between two loads of `file->seq` as `get_conflicting_lock()` does, so that
+ * the files whose mutex is held by other processes can be looked at.
+ *
+ * @param file the file that contains the locks
+ * @param pid the PID of the owner
+ * @param token the token of the owner
+ * @param type the type of the lock that would be put (F_RDLCK, F_WRLCK)
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @return 1 if such a lock exists, 0 otherwise
+ */
+static int holds_conflicting_lock(rl_open_file *file, pid_t pid,
+        unsigned long token, short type, off_t start, off_t len) {
+    for (;;) {
+        unsigned long seq = atomic_load_explicit(&file->seq,
+                memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        int held = 0;
+        int nb_locks = file->nb_locks;
+        int capacity = file->lock_capacity;
+        if (nb_locks < 0 || nb_locks > capacity)
+            nb_locks = capacity;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->seq, memory_order_relaxed) != seq)
+            continue;
+        rl_window window;
+        find_window(file, nb_locks, start, len, &window);
+        for (int i = next_conflict(file, &window, window_begin(&window), type,
+                        start, len);
+                i < window.end && !held;
+                i = next_conflict(file, &window, window_next(&window, i),
+                        type, start, len)) {
+            rl_lock *cur = get_lock(file, i);
+            if ((cur->type != F_WRLCK && type != F_WRLCK)
+                    || !seg_overlap(cur->start, cur->len, start, len))
+                continue;
+
+            /* the owner list may be modified while it is walked */
+            size_t nb_owners = cur->nb_owners;
+            int pool_capacity = file->owner_capacity;
+            int next = cur->first_owner;
+            for (size_t j = 0; j < nb_owners && !held; j++) {
+                if (next < 0 || next >= pool_capacity)
+                    break;
+                rl_owner_node node = get_owner_pool(file)[next];
+                held = node.owner.pid == pid && node.owner.token == token;
+                next = node.next;
+            }
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&file->seq, memory_order_relaxed) == seq)
+            return held;
+    }
+}
+
+/**
+ * @brief Maps read-only the open file whose shared memory object is
+ * `shm_name`, for the time of a search of the wait graph
+ * @param shm_name the name of the shared memory object of the file
+ * @return the open file, to unmap with `munmap()`, NULL if it does not exist
+ * anymore or on error
+ */
+static rl_open_file *map_waited_file(const char *shm_name) {
+    int fd = shm_open(shm_name, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    rl_open_file *file = mmap(NULL, RL_SEGMENT_MAX_SIZE, PROT_READ,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    return file == MAP_FAILED ? NULL : file;
+}
+
+/**
+ * @brief Checks if the request of the owner of PID `pid` and token `token` of
+ * type `type` on (start, len) in `file` waits, directly or not, for the owner
+ * of PID `target_pid` and token `target_token`, following the wait graph
+ * across files
+ *
+ * The request waits for the owners of the conflicting locks of `file`, and
+ * those owners wait for the owners of the conflicting locks of the files in
+ * which they have a queued request, and so on. The edges of the graph are
+ * followed depth-first, `visited` marking the ones already explored. The mutex
+ * of the wait graph must be held.
+ *
+ * @param file the file in which the request waits
+ * @param pid the PID of the owner of the request
+ * @param token the token of the owner of the request
+ * @param type the type of the request (F_RDLCK, F_WRLCK)
+ * @param start the start of the requested segment
+ * @param len the length of the requested segment, 0 if extensible
+ * @param target_pid the PID of the owner that might be waited for
+ * @param target_token the token of the owner that might be waited for
+ * @param visited for each edge of the wait graph, whether it was explored
+ * @return 1 if the request waits for the target, 0 otherwise
+ */
+static int waits_across_files(rl_open_file *file, pid_t pid,
+        unsigned long token, short type, off_t start, off_t len,
+        pid_t target_pid, unsigned long target_token, char *visited) {
+    if ((pid != target_pid || token != target_token)
+            && holds_conflicting_lock(file, target_pid, target_token, type,
+                start, len))
+        return 1;
+
+    for (int i = 0; i < RL_MAX_WAIT_EDGES; i++) {
+        rl_wait_edge *edge = &wait_graph->edges[i];
+        pid_t holder = atomic_load(&edge->pid);
+        if (visited[i] || holder == RL_FREE_EDGE
+                || (holder == pid && edge->token == token)
+                || !holds_conflicting_lock(file, holder, edge->token, type,
+                    start, len)
+                || (kill(holder, 0) == -1 && errno == ESRCH))
+            continue;
+        visited[i] = 1;
+
+        rl_open_file *next = file;
+        if (strcmp(edge->shm_name, file->shm_name) != 0) {
+            next = map_waited_file(edge->shm_name);
+            if (next == NULL)
+                continue;
+        }
+        int res = waits_across_files(next, holder, edge->token, edge->type,
+                edge->start, edge->len, target_pid, target_token, visited);
+        if (next != file)
+            munmap(next, RL_SEGMENT_MAX_SIZE);
+        if (res)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if the queued request `waiter` of `file` closes a cycle in the
+ * wait-for graph, that is if it waits, directly or not, for its own owner
+ *
+ * The wait queue of `file` is searched first, then the wait graph for the
+ * cycles that go through other files, in which the owner is only told apart by
+ * its PID and its token. This function does not use any locking mechanism on
+ * `file`.
+ *
+ * @param file the file that contains the wait queue
+ * @param waiter the queued request
+ * @return 1 if waiting would cause a deadlock, 0 otherwise
+ */
+static int is_deadlocked(rl_open_file *file, rl_waiter *waiter) {
+    char visited[RL_MAX_WAITERS] = {0};
+    visited[waiter - file->wait_queue] = 1;
+    if (is_waiting_for(file, waiter->owner, waiter->type, waiter->start,
+                waiter->len, waiter->ticket, waiter->owner, visited))
+        return 1;
+
+    if (waiter->edge == RL_NO_EDGE || lock_wait_graph() == -1)
+        return 0;
+    char visited_edges[RL_MAX_WAIT_EDGES] = {0};
+    visited_edges[waiter->edge] = 1;
+    int res = waits_across_files(file, waiter->owner.pid, waiter->owner.token,
+            waiter->type, waiter->start, waiter->len, waiter->owner.pid,
+            waiter->owner.token, visited_edges);
+    pthread_mutex_unlock(&wait_graph->mutex);
+    return res;
+}
+
+/**
+ * @brief Makes the descriptor returned by `rl_lock_async()` for `waiter`
+ * readable
+ * @param waiter the granted asynchronous request
+ * @return 0 on success, -1 if the descriptor could not be notified, for
+ * instance because the process that made the request has died
+ */
+static int notify_async_waiter(rl_waiter *waiter) {
+    int fifo = open(waiter->notify_path, O_WRONLY | O_NONBLOCK);
+    if (fifo == -1)
+        return -1;
+    char granted = 1;
+    int res = write(fifo, &granted, 1) == 1 ? 0 : -1;
+    close(fifo);
+    return res;
+}
+
+/**
+ * @brief Applies the queued requests of `file` that can be granted, in the
+ * order of their tickets, on behalf of their owners
+ *
+ * Only the asynchronous requests are considered if the handoff mode of `file`
+ * is disabled. The owners of the granted requests are woken up and find their
+ * lock already applied, so that the segments released by a process go directly
+ * to the next waiters instead of the first process to take the mutex of
+ * `file`. The granted asynchronous requests are removed from the wait queue.
+ * This function does not use any locking mechanism.
+ *
+ * @param file the file that contains the wait queue
+ * @return 0 on success, -1 on error
+ */
+static int hand_off(rl_open_file *file) {
+    if (file->nb_waiters == 0)
+        return 0;
+
+    unsigned long last = RL_FREE_WAITER;
+    for (;;) {
+        rl_waiter *next = NULL;
+        int next_index = -1;
+        for (int i = 0; i < RL_MAX_WAITERS; i++) {
+            rl_waiter *cur = &file->wait_queue[i];
+            if (!is_waiter_free(cur) && !cur->granted && cur->ticket > last
+                    && (file->handoff || cur->async)
+                    && (next == NULL || cur->ticket < next->ticket)) {
+                next = cur;
+                next_index = i;
+            }
+        }
+        if (next == NULL)
+            return 0;
+        last = next->ticket;
+
+        if (kill(next->owner.pid, 0) == -1 && errno == ESRCH) {
+            dequeue_waiter(file, next_index);
+            continue;
+        }
+
+        pid_t pid;
+        while ((pid = is_lock_applicable(file, next->owner, next->type,
+                        next->start, next->len)) > 1) {
+            if (remove_locks_of(pid, file) == -1)
+                return -1;
+        }
+        if (pid == -1)
+            return -1;
+        if (pid == 0 || must_wait_in_queue(file, next->owner, next->type,
+                    next->start, next->len, next->ticket))
+            continue;
+
+        if (apply_rw_lock(file, next->owner, next->type, next->start,
+                    next->len) == -1)
+            return -1;
+        next->granted = 1;
+        if (next->async) {
+            notify_async_waiter(next);
+            dequeue_waiter(file, next_index);
+        } else
+            pthread_cond_signal(&next->wakeup);
+    }
+}
+
+/**
+ * @brief Sets the order in which the queued lock requests of the file of `lfd`
+ * are served
+ * @param lfd a descriptor of the file
+ * @param policy `RL_POLICY_FIFO`, `RL_POLICY_WRITER_PREFERRING` or
+ *               `RL_POLICY_PHASE_FAIR`
+ * @return 0 on success, -1 on error
+ */
+int rl_set_wait_policy(rl_descriptor lfd, int policy) {
+    if (lfd.fd < 0 || lfd.file == NULL || (policy != RL_POLICY_FIFO
+                && policy != RL_POLICY_WRITER_PREFERRING
+                && policy != RL_POLICY_PHASE_FAIR))
+        return -1;
+
+    if (lock_file(lfd.file) != 0)
+        return -1;
+
+    lfd.file->policy = policy;
+    wake_waiters(lfd.file, 0, 0);
+    if (hand_off(lfd.file) == -1) {
+        pthread_mutex_unlock(&lfd.file->mutex);
+        return -1;
+    }
+
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        return -1;
+    if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Enables or disables the handoff mode of the file of `lfd`
+ *
+ * In handoff mode, the process that releases a segment applies the locks of the
+ * queued requests that can then be granted before waking their owners up.
+ *
+ * @param lfd a descriptor of the file
+ * @param enabled 1 to enable the handoff mode, 0 to disable it
+ * @return 0 on success, -1 on error
+ */
+int rl_set_handoff(rl_descriptor lfd, int enabled) {
+    if (lfd.fd < 0 || lfd.file == NULL
+            || (enabled && lfd.file->record_size > 0))
+        return -1;
+
+    if (lock_file(lfd.file) != 0)
+        return -1;
+
+    lfd.file->handoff = enabled != 0;
+    if (hand_off(lfd.file) == -1) {
+        pthread_mutex_unlock(&lfd.file->mutex);
+        return -1;
+    }
+    wake_waiters(lfd.file, 0, 0);
+
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        return -1;
+    if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Enables or disables the bias of the file of `lfd` towards readers
+ *
+ * While the file is biased, the read locks are announced in reader slots
+ * instead of the lock table, without taking the mutex of the file, and a write
+ * lock request first moves them to the table, which suspends the bias for a
+ * while. This suits the segments that are read by many processes and seldom
+ * written.
+ *
+ * @param lfd a descriptor of the file
+ * @param enabled 1 to enable the bias, 0 to disable it
+ * @return 0 on success, -1 on error
+ */
+int rl_set_reader_bias(rl_descriptor lfd, int enabled) {
+    if (lfd.fd < 0 || lfd.file == NULL
+            || (enabled && lfd.file->record_size > 0))
+        return -1;
+
+    if (lock_file(lfd.file) != 0)
+        return -1;
+
+    if (close_fast_path(lfd.file) == -1 || revoke_bias(lfd.file) == -1) {
+        pthread_mutex_unlock(&lfd.file->mutex);
+        return -1;
+    }
+    lfd.file->reader_bias = enabled != 0;
+    lfd.file->bias_inhibited_until.tv_sec = 0;
+    lfd.file->bias_inhibited_until.tv_nsec = 0;
+    open_fast_path(lfd.file);
+
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        return -1;
+    if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
+        return -1;
+    return 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Closes the given locked file descriptor
+ *
+ * This function removes from each lock of the descripted open file the owner
+ * `{getpid(), lfd.fd}` if present. After deletion, the lock owners of each lock
+ * are reorganized, as each lock of the lock table of the open file description.
+ * The pending asynchronous requests made with `lfd` are cancelled, and the
+ * released segments are handed off to the queued requests that can be granted.
+ * The `close()` operation is made only if the previous operations are
+ * successful.
+ *
+ * @param lfd the locked file descriptor to close
+ * @return 0 if `lfd` was successfully closed, -1 on error
+ */
+int rl_close(rl_descriptor lfd) {
+    /* check descriptor validity */
+    if (lfd.fd < 0 || lfd.file == NULL)
+        return -1;
+
+    /* take lock on open file */
+    int err = lock_file(lfd.file);
+    if (err != 0)
+        return -1;
+    rl_owner lfd_owner = get_owner(lfd);
+    /* the locks of every token bound to `lfd` are removed with the others */
+    if (close_fast_path(lfd.file) == -1 || move_reader_slots_of(lfd.file,
+                lfd_owner.pid, lfd_owner.fd) == -1) {
+        pthread_mutex_unlock(&lfd.file->mutex);
+        return -1;
+    }
+
+    /* the requests of every token bound to `lfd` go away with its fd */
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &lfd.file->wait_queue[i];
+        if (!is_waiter_free(cur) && cur->async
+                && cur->owner.pid == lfd_owner.pid
+                && cur->owner.fd == lfd_owner.fd)
+            dequeue_waiter(lfd.file, i);
+    }
+    if (remove_held_locks(lfd.file, lfd_owner.pid, lfd_owner.fd) < 0)
+        return -1;
+    remove_records_of(lfd.file, lfd_owner.pid, lfd_owner.fd);
+
+    char shm_name[RL_SHM_NAME_MAX];
+    if (get_shm_name(lfd.fd, shm_name))
+        return -1;
+
+    if (close(lfd.fd) == -1)
+        return -1;
+
+    int detached = map_decrement(lfd.file, getpid());
+    if (detached == -1)
+        return -1;
+
+    /* the other processes are only checked when this one detaches */
+    int unlink_shm = detached;
+    for (int i = 0; detached && i < lfd.file->map_capacity; i++) {
+        rl_pid_fd_count *entry = &get_pid_map(lfd.file)[i];
+        if (!is_map_entry_used(entry))
+            continue;
+        if (kill(entry->pid, 0) == -1 && errno == ESRCH) {
+            if (remove_held_locks(lfd.file, entry->pid, -1) < 0)
                 return -1;
+            remove_records_of(lfd.file, entry->pid, -1);
+            remove_map_entry(lfd.file, entry);
+        } else
+            unlink_shm = 0;
+    }
+    if (hand_off(lfd.file) < 0)
+        return -1;
+
+    open_fast_path(lfd.file);
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        return -1;
+    err = pthread_mutex_unlock(&lfd.file->mutex);
+    if (err != 0)
+        return -1;
+
+    if (unlink_shm) {
+        if (shm_unlink(shm_name))
+            return -1;
+    }
+    
+    return 0;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Same as `alloc_record_chunks()`, taking the mutex of the file only if
+ * a chunk is missing
+ * @param file the file that contains the records
+ * @param first the first record
+ * @param end the record after the last one, at most `RL_MAX_RECORDS`
+ * @return 0 on success, -1 on error
+ */
+static int reserve_records(rl_open_file *file, off_t first, off_t end) {
+    off_t chunk = first / RL_RECORD_CHUNK_SIZE;
+    while (chunk <= (end - 1) / RL_RECORD_CHUNK_SIZE
+            && atomic_load(&file->record_chunks[chunk]) != 0)
+        chunk++;
+    if (chunk > (end - 1) / RL_RECORD_CHUNK_SIZE)
+        return 0;
+
+    if (lock_file(file) != 0)
+        return -1;
+    int res = alloc_record_chunks(file, first, end);
+    if (msync(file, file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        res = -1;
+    if (pthread_mutex_unlock(&file->mutex) != 0)
+        return -1;
+    return res;
+}
+
+/**
+ * @brief Same as `rl_fcntl_timed()` for a file in record mode
+ *
+ * The locks are put and removed on the words of the records without taking the
+ * mutex of the file, which is only taken to give a slot to a new owner, to
+ * allocate records and to free the slots of dead owners. A waiting request
+ * sleeps on the stripe of the record that prevented it from locking, and tries
+ * again each time a lock on a record of that stripe is removed, so that
+ * requests waiting for different records do not share a mutex.
+ *
+ * @param lfd the descriptor on which `lck` will be applied
+ * @param cmd the action to perform, F_SETLK, F_SETLKW or F_GETLK
+ * @param lck the lock to apply, on whole records
+ * @param deadline the absolute `CLOCK_MONOTONIC` time after which the lock is
+ *                 not waited for anymore, NULL to wait without limit
+ * @return 0 on success, -1 on failure
+ */
+static int record_fcntl(rl_descriptor lfd, int cmd, struct flock *lck,
+        const struct timespec *deadline) {
+    rl_open_file *file = lfd.file;
+    off_t start = get_start(lck, lfd.fd);
+    if (start == -1)
+        return -1;
+    if (start % file->record_size != 0 || lck->l_len % file->record_size != 0
+            || (lck->l_len == 0 && cmd != F_GETLK && lck->l_type != F_UNLCK)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    off_t first = start / file->record_size;
+    off_t end = (lck->l_len == 0) ?
+        RL_MAX_RECORDS : first + lck->l_len / file->record_size;
+    if (end > RL_MAX_RECORDS) {
+        if (cmd != F_GETLK && lck->l_type != F_UNLCK) {
+            errno = ENOLCK;
+            return -1;
+        }
+        end = RL_MAX_RECORDS;
+    }
+
+    rl_owner lfd_owner = get_owner(lfd);
+    if (cmd == F_GETLK) {
+        get_conflicting_record(file, lfd_owner, lck, first, end);
+        return 0;
+    }
+
+    int slot = pin_record_owner(file, lfd_owner);
+    if (lck->l_type == F_UNLCK) {
+        if (slot == -1)
+            return 0;
+        int released = unlock_records(file, slot, first, end);
+        unpin_record_owner(file, slot);
+        if (released)
+            records_released(file, first, end, NULL);
+        return 0;
+    }
+
+    if (slot == -1) {
+        if (lock_file(file) != 0)
+            return -1;
+        slot = add_record_owner(file, lfd_owner);
+        msync(file, file->size, MS_SYNC | MS_INVALIDATE);
+        if (pthread_mutex_unlock(&file->mutex) != 0 || slot == -1)
+            return -1;
+    }
+    if (reserve_records(file, first, end) == -1) {
+        unpin_record_owner(file, slot);
+        return -1;
+    }
+
+    rl_stripe *stripe = NULL;
+    uint64_t missed = 0;
+    int res;
+    int holder;
+    off_t conflict;
+    while ((res = lock_records(file, slot, lck->l_type, first, end, &holder,
+                    &conflict)) == 1) {
+        /* the bits rolled back may have been waited for */
+        if (end - first > 1)
+            missed |= records_released(file, first, end, stripe);
+
+        pid_t pid = atomic_load(&file->record_owners[holder].pid);
+        if (pid != RL_FREE_RECORD_OWNER
+                && kill(pid, 0) == -1 && errno == ESRCH) {
+            /* the mutex of the file is never taken inside a stripe */
+            if (stripe != NULL)
+                leave_stripe(stripe);
+            stripe = NULL;
+            if (lock_file(file) != 0)
+                break;
+            if (atomic_load(&file->record_owners[holder].pid) == pid)
+                release_record_owner(file, holder);
+            if (pthread_mutex_unlock(&file->mutex) != 0)
+                break;
+            continue;
+        }
+
+        if (cmd == F_SETLK) {
+            errno = EAGAIN;
+            break;
+        }
+
+        rl_stripe *next = get_stripe(file, conflict);
+        if (next != stripe || missed != 0) {
+            /* the stripes missed are woken up before the caller sleeps */
+            if (stripe != NULL)
+                leave_stripe(stripe);
+            stripe = NULL;
+            wake_stripes(file, missed);
+            missed = 0;
+            if (enter_stripe(next) == -1)
+                break;
+            stripe = next;
+            continue;
         }
+        if (wait_for_release(&stripe->released, &stripe->mutex, deadline)
+                == -1)
+            break;
     }
-    return 0;
+
+    unpin_record_owner(file, slot);
+    if (res == 0 && lck->l_type == F_RDLCK)
+        missed |= records_released(file, first, end, stripe);
+    int err = errno;
+    if (stripe != NULL)
+        leave_stripe(stripe);
+    wake_stripes(file, missed);
+    errno = err;
+    return res == 0 ? 0 : -1;
 }
 
 /**
- * @brief Locks the region specified by `lck` of the open file pointed by
- * `lfd`
+ * @brief Applies the non-blocking request `req` on `file`
  *
- * The region to lock must start at or after the beginning of the file. This
- * function does not use any locking mechanism, ensure mutual exclusion before
- * the call.
+ * Must be called with the mutex of the file held. The request is applied as
+ * F_SETLK would, including the removal of the locks of dead processes, without
+ * handing off the released segments.
  *
- * @param lfd the file descriptor to lock
- * @param lck the region to lock
- * @return 0 on success, -1 on error
+ * @param file the file on which to apply `req`
+ * @param req the request to apply
+ * @return 0 on success, -1 on error, errno being `EAGAIN` if a conflicting lock
+ * prevents the request from being applied
  */
-static int apply_rw_lock(rl_descriptor lfd, struct flock *lck) {
-    if (lfd.file->nb_locks + 2 > RL_MAX_LOCKS)
+static int apply_request(rl_open_file *file, rl_request *req) {
+    if (close_fast_paths_for(file, req->owner, req->type) == -1)
         return -1;
 
-    off_t lck_start = get_start(lck, lfd.fd);
-    if (lck_start == -1)
+    pid_t pid;
+    while ((pid = is_lock_applicable(file, req->owner, req->type, req->start,
+                    req->len)) > 1) {
+        if (remove_locks_of(pid, file) == -1)
+            return -1;
+    }
+    if (pid == 1 && req->type != F_UNLCK
+            && must_wait_in_queue(file, req->owner, req->type, req->start,
+                    req->len, ULONG_MAX))
+        pid = 0;
+    if (pid == 0)
+        errno = EAGAIN;
+    if (pid != 1)
         return -1;
 
-    struct flock unlock;
-    unlock.l_type = F_UNLCK;
-    unlock.l_whence = SEEK_SET;
-    unlock.l_start = lck_start;
-    unlock.l_len = lck->l_len;
-    if (apply_unlock(lfd, &unlock) == -1)
-        return -1;
+    if (req->type == F_UNLCK)
+        return apply_unlock(file, req->owner, req->start, req->len);
+    return apply_rw_lock(file, req->owner, req->type, req->start, req->len);
+}
 
-    rl_owner lfd_owner = {.pid = getpid(), .fd = lfd.fd};
-    rl_lock *left = NULL;
-    rl_lock *right = NULL;
-    for (int i = 0; i < lfd.file->nb_locks; i++) {
-        rl_lock *cur = &lfd.file->lock_table[i];
-        if (cur->type != lck->l_type || !is_owner_of(lfd_owner, cur))
+/**
+ * @brief Applies every request published to `combiner` on `file` with a
+ * single acquisition of the mutex of the file
+ *
+ * Must be called by the thread that holds the mutex of `combiner`. The requests
+ * are applied in their order of publication, and are marked as done once the
+ * mutex of the file is released.
+ *
+ * @param file the file on which to apply the requests
+ * @param combiner the combiner to which the requests were published
+ */
+static void combine_requests(rl_open_file *file, rl_combiner *combiner) {
+    rl_request *batch = atomic_exchange(&combiner->requests, NULL);
+    rl_request *first = NULL;
+    while (batch != NULL) {
+        rl_request *next = batch->next;
+        batch->next = first;
+        first = batch;
+        batch = next;
+    }
+    if (first == NULL)
+        return;
+
+    int err = (lock_file(file) == 0) ? 0 : errno;
+    for (rl_request *req = first; req != NULL; req = req->next) {
+        if (err != 0) {
+            req->res = -1;
+            req->err = err;
             continue;
-        if (cur->start + cur->len == lck_start && cur->len > 0)
-            left = cur;
-        else if (cur->start == lck_start + lck->l_len && lck->l_len > 0)
-            right = cur;
+        }
+        req->res = apply_request(file, req);
+        req->err = errno;
     }
-
-    int unlock_left = 0;
-    int unlock_right = 0;
-    rl_lock tmp;
-    tmp.type = lck->l_type;
-    tmp.start = lck_start;
-    tmp.len = lck->l_len;
-    if (left != NULL && right != NULL) {
-        if (right->len == 0) tmp.len = 0;
-        else tmp.len += left->len + right->len;
-        tmp.start = left->start;
-        unlock_left = 1;
-        unlock_right = 1;
-    } else if (left != NULL) {
-        if (tmp.len != 0)
-            tmp.len += left->len;
-        tmp.start = left->start;
-        unlock_left = 1;
-    } else if (right != NULL) {
-        if (right->len == 0) tmp.len = 0;
-        else tmp.len += right->len;
-        unlock_right = 1;
+    if (err == 0) {
+        hand_off(file);
+        open_fast_path(file);
+        msync(file, file->size, MS_SYNC | MS_INVALIDATE);
+        pthread_mutex_unlock(&file->mutex);
     }
 
-    struct flock left2;
-    if (unlock_left) {
-        rl_lock_to_flock(left, &left2);
-        left2.l_type = F_UNLCK;
-    }
-    struct flock right2;
-    if (unlock_right) {
-        rl_lock_to_flock(right, &right2);
-        right2.l_type = F_UNLCK;
+    /* a request may vanish as soon as it is marked as done */
+    for (rl_request *req = first, *next; req != NULL; req = next) {
+        next = req->next;
+        atomic_store(&req->done, 1);
     }
+}
 
-    if (unlock_left && apply_unlock(lfd, &left2) == -1)
+/**
+ * @brief Applies the non-blocking request of `owner` on the segment
+ * (start, len) of `file` through the combiner of the file in this process
+ *
+ * When no request is published and the mutex of the combiner is free, the
+ * request is applied at once under the mutex of the file. Otherwise, it is
+ * published to the combiner, and the calling thread then waits for the mutex
+ * of the combiner. A thread that gets it while its request is not applied yet
+ * applies every published request, so that the threads of a process locking
+ * the same file take its mutex once per batch rather than once per request.
+ *
+ * @param file the file on which to apply the request
+ * @param owner the owner of the lock
+ * @param type the type of the request (F_RDLCK, F_WRLCK, F_UNLCK)
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @return 0 on success, -1 on error, errno being `EAGAIN` if a conflicting lock
+ * prevents the request from being applied
+ */
+static int combine_request(rl_open_file *file, rl_owner owner, short type,
+        off_t start, off_t len) {
+    int index = find_in_rla(file);
+    if (index == -1) {
+        errno = EBADF;
         return -1;
+    }
+    rl_combiner *combiner = &rla.combiners[index];
+
+    rl_request req = {.owner = owner, .start = start, .len = len,
+        .type = type};
+    if (atomic_load(&combiner->requests) == NULL
+            && pthread_mutex_trylock(&combiner->mutex) == 0) {
+        /* the requests published meanwhile wait for the combiner mutex */
+        int res = -1;
+        int err = (lock_file(file) == 0) ? 0 : errno;
+        if (err == 0) {
+            res = apply_request(file, &req);
+            err = errno;
+            hand_off(file);
+            open_fast_path(file);
+            msync(file, file->size, MS_SYNC | MS_INVALIDATE);
+            pthread_mutex_unlock(&file->mutex);
+        }
+        pthread_mutex_unlock(&combiner->mutex);
+        errno = err;
+        return res;
+    }
 
-    if (unlock_right && apply_unlock(lfd, &right2) == -1)
-        return -1;
+    atomic_init(&req.done, 0);
+    req.next = atomic_load(&combiner->requests);
+    while (!atomic_compare_exchange_weak(&combiner->requests, &req.next,
+                &req))
+        ;
 
-    rl_lock *tmp2 = find_lock(lfd.file, &tmp);
-    if (tmp2 != NULL) {
-        if (add_owner(lfd_owner, tmp2) == -1)
-            return -1;
-    } else {
-        if (add_lock(&tmp, lfd.file, lfd_owner) == -1)
-            return -1;
+    while (!atomic_load(&req.done)) {
+        if (pthread_mutex_lock(&combiner->mutex) != 0) {
+            sched_yield();
+            continue;
+        }
+        if (!atomic_load(&req.done))
+            combine_requests(file, combiner);
+        pthread_mutex_unlock(&combiner->mutex);
     }
-    return 0;
+    errno = req.err;
+    return req.res;
 }
 
 /**
  * @brief Applies the lock or unlock described by `lck` if possible
  *
- * When `cmd` is F_SETLK, a non-blocking attempt to apply `lck` is made.
+ * When `cmd` is F_SETLK, a non-blocking attempt to apply `lck` is made. When
+ * `cmd` is F_SETLKW, the caller is put to sleep until the conflicting locks are
+ * released, either explicitly, by closing their descriptors or because their
+ * owners died, which the next request on the file that runs into their locks
+ * notices. If the handoff mode of the file is enabled, the lock may be
+ * applied on behalf of the caller by the process that released the conflicting
+ * locks. If waiting would close a cycle of owners waiting for each other, in
+ * this file or through the queues of other files, the call fails with errno
+ * set to `EDEADLK` instead.
+ *
+ * When `cmd` is F_GETLK, nothing is applied: `lck` is overwritten with the
+ * first lock that prevents the caller from applying it, `l_pid` being the PID
+ * of one of its owners, or its type is set to F_UNLCK if there is no such lock.
+ * The lock table is then read without taking the mutex of the file, so that
+ * probes do not contend with the processes that apply locks.
+ *
+ * A lock requested on a file without any lock or queued request, and its
+ * release, are applied with a single atomic operation instead of taking the
+ * mutex of the file, as long as no other request comes in between. The other
+ * F_SETLK requests of the threads of a process on the same file are applied in
+ * batches by one of them when they contend, which takes the mutex of the file
+ * once per batch.
  * 
  * @param lfd the descriptor on which `lck` will be applied
- * @param cmd the action to perform, only F_SETLK is supported
+ * @param cmd the action to perform, F_SETLK, F_SETLKW or F_GETLK
  * @param lck the lock to apply
  * @return 0 on success, -1 on failure
  */
 int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck) {
-    if (lfd.fd < 0 || lfd.file == NULL || cmd != F_SETLK || lck == NULL
-            || lck->l_len < 0
+    return rl_fcntl_timed(lfd, cmd, lck, NULL);
+}
+
+/**
+ * @brief Applies the lock or unlock described by `lck` if possible, waiting at
+ * most until `deadline`
+ *
+ * Behaves as `rl_fcntl()`, except that when `cmd` is F_SETLKW the caller stops
+ * waiting for the conflicting locks to be released once the `CLOCK_MONOTONIC`
+ * clock reaches `deadline`. In that case nothing is applied and errno is set to
+ * `ETIMEDOUT`.
+ *
+ * @param lfd the descriptor on which `lck` will be applied
+ * @param cmd the action to perform, F_SETLK, F_SETLKW or F_GETLK
+ * @param lck the lock to apply
+ * @param deadline the absolute `CLOCK_MONOTONIC` time after which the lock is
+ *                 not waited for anymore, NULL to wait without limit
+ * @return 0 on success, -1 on failure
+ */
+int rl_fcntl_timed(rl_descriptor lfd, int cmd, struct flock *lck,
+        const struct timespec *deadline) {
+    if (lfd.fd < 0 || lfd.file == NULL
+            || (cmd != F_SETLK && cmd != F_SETLKW && cmd != F_GETLK)
+            || lck == NULL || lck->l_len < 0
             || (lck->l_type != F_RDLCK && lck->l_type != F_WRLCK
-                    && lck->l_type != F_UNLCK)
+                    && (lck->l_type != F_UNLCK || cmd == F_GETLK))
             || (lck->l_whence != SEEK_SET && lck->l_whence != SEEK_CUR
                     && lck->l_whence != SEEK_END))
         return -1;
+    if (lfd.file->record_size > 0)
+        return record_fcntl(lfd, cmd, lck, deadline);
+
+    rl_owner lfd_owner = get_owner(lfd);
+    if (cmd == F_GETLK) {
+        off_t start = get_start(lck, lfd.fd);
+        if (start == -1)
+            return -1;
+        /* the locks taken through the fast paths are only seen in the table */
+        int state = fast_state(atomic_load(&lfd.file->fast_lock));
+        if (state == RL_FAST_CLAIMED || state == RL_FAST_HELD
+                || (lck->l_type == F_WRLCK && atomic_load(&lfd.file->biased))) {
+            if (lock_file(lfd.file) != 0)
+                return -1;
+            int res = close_fast_paths_for(lfd.file, lfd_owner, lck->l_type);
+            if (pthread_mutex_unlock(&lfd.file->mutex) != 0 || res == -1)
+                return -1;
+        }
+        get_conflicting_lock(lfd.file, lfd_owner, lck, start);
+        return 0;
+    }
 
-    if (pthread_mutex_lock(&lfd.file->mutex) != 0)
+    if (lck->l_whence == SEEK_SET && lck->l_start >= 0
+            && (fast_fcntl(lfd.file, lfd_owner, lck)
+                    || biased_fcntl(lfd.file, lfd_owner, lck)))
+        return 0;
+
+    if (cmd == F_SETLK) {
+        off_t start = get_start(lck, lfd.fd);
+        if (start == -1)
+            return -1;
+        return combine_request(lfd.file, lfd_owner, lck->l_type, start,
+                lck->l_len);
+    }
+
+    if (lock_file(lfd.file) != 0)
         return -1;
 
+    int queued = -1;
+    int handed_off = 0;
+    unsigned long ticket = ULONG_MAX;
     pid_t pid;
-    while ((pid = is_lock_applicable(lck, lfd)) > 1) {
-        if (remove_locks_of(pid, lfd.file) == -1)
+    off_t start = get_start(lck, lfd.fd);
+    if (start == -1)
+        goto error;
+    if (close_fast_paths_for(lfd.file, lfd_owner, lck->l_type) == -1)
+        goto error;
+
+    for (;;) {
+        if (queued != -1 && lfd.file->wait_queue[queued].granted) {
+            handed_off = 1;
+            break;
+        }
+
+        while ((pid = is_lock_applicable(lfd.file, lfd_owner, lck->l_type,
+                        start, lck->l_len)) > 1) {
+            if (remove_locks_of(pid, lfd.file) == -1)
+                goto error;
+        }
+
+        if (pid == 1 && lck->l_type != F_UNLCK
+                && must_wait_in_queue(lfd.file, lfd_owner, lck->l_type, start,
+                        lck->l_len, ticket))
+            pid = 0;
+
+        if (pid != 0)
+            break;
+
+        if (queued == -1) {
+            queued = enqueue_waiter(lfd.file, lfd_owner, lck->l_type, start,
+                    lck->l_len);
+            if (queued == -1)
+                goto error;
+            if (is_deadlocked(lfd.file, &lfd.file->wait_queue[queued])) {
+                errno = EDEADLK;
+                goto error;
+            }
+            ticket = lfd.file->wait_queue[queued].ticket;
+        }
+
+        int woken = wait_for_release(&lfd.file->wait_queue[queued].wakeup,
+                &lfd.file->mutex, deadline);
+        if (woken == -1 || (woken == 1 && repair_file(lfd.file) == -1))
             goto error;
     }
 
-    if (pid == -1)
-        goto error;
-
-    if (pid == 0) {
-        msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE);
-        errno = EAGAIN;
-        pthread_mutex_unlock(&lfd.file->mutex);
-        return -1;
+    if (queued != -1) {
+        dequeue_waiter(lfd.file, queued);
+        queued = -1;
     }
 
-    switch (lck->l_type) {
-      case F_UNLCK:
-        if (apply_unlock(lfd, lck) == -1)
+    if (!handed_off) {
+        if (pid == -1)
             goto error;
-        break;
-      case F_RDLCK:
-      case F_WRLCK:
-        if (apply_rw_lock(lfd, lck) == -1)
+
+        switch (lck->l_type) {
+          case F_UNLCK:
+            if (apply_unlock(lfd.file, lfd_owner, start, lck->l_len) == -1)
+                goto error;
+            break;
+          case F_RDLCK:
+          case F_WRLCK:
+            if (apply_rw_lock(lfd.file, lfd_owner, lck->l_type, start,
+                        lck->l_len) == -1)
+                goto error;
+            break;
+          default:
             goto error;
-        break;
-      default:
-        goto error;
+        }
     }
 
-    if (msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
+    if (hand_off(lfd.file) == -1)
+        goto error;
+
+    open_fast_path(lfd.file);
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
         return -1;
     if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
         return -1;
     return 0;
 
  error:
-    msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE);
+    if (queued != -1)
+        dequeue_waiter(lfd.file, queued);
+    hand_off(lfd.file);
+    open_fast_path(lfd.file);
+    msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE);
+    pthread_mutex_unlock(&lfd.file->mutex);
+    return -1;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Requests the lock described by `lck` without blocking, returning a
+ * descriptor that becomes readable once the lock is applied
+ *
+ * If the lock cannot be applied immediately, the request is put in the wait
+ * queue of the file and is granted on behalf of the caller by the process that
+ * releases the conflicting locks, which then writes a byte to the returned
+ * descriptor. The descriptor can thus be watched with `poll()`, `select()` or
+ * `epoll` along with other descriptors. The descriptor is a FIFO in a directory
+ * private to the user of the caller. Once it is readable, the lock is held and
+ * the descriptor can simply be closed. A pending request is withdrawn with
+ * `rl_lock_cancel()`. As no process sleeps on the request, locks left by dead
+ * processes are only removed when another operation on the file finds them. If
+ * the request would close a cycle of owners waiting for each other, the call
+ * fails with errno set to `EDEADLK`.
+ *
+ * @param lfd the descriptor on which `lck` will be applied
+ * @param lck the lock to apply, of type F_RDLCK or F_WRLCK
+ * @return the descriptor to watch on success, -1 on failure
+ */
+int rl_lock_async(rl_descriptor lfd, struct flock *lck) {
+    if (lfd.fd < 0 || lfd.file == NULL || lfd.file->record_size > 0
+            || lck == NULL || lck->l_len < 0
+            || (lck->l_type != F_RDLCK && lck->l_type != F_WRLCK)
+            || (lck->l_whence != SEEK_SET && lck->l_whence != SEEK_CUR
+                    && lck->l_whence != SEEK_END))
+        return -1;
+
+    /* a fresh directory of the user, so that no one else can reach the FIFO */
+    char path[RL_FIFO_PATH_MAX];
+    snprintf(path, RL_FIFO_PATH_MAX, "%s_XXXXXX", RL_FIFO_PREFIX);
+    if (mkdtemp(path) == NULL)
+        return -1;
+    strcat(path, "/grant");
+    if (mkfifo(path, S_IRUSR | S_IWUSR) == -1) {
+        remove_notify_fifo(path);
+        return -1;
+    }
+
+    /* opened for writing as well so that the FIFO always has a writer */
+    int afd = open(path, O_RDWR | O_NONBLOCK);
+    if (afd == -1) {
+        remove_notify_fifo(path);
+        return -1;
+    }
+
+    if (lock_file(lfd.file) != 0)
+        goto error2;
+
+    rl_owner lfd_owner = get_owner(lfd);
+    off_t start = get_start(lck, lfd.fd);
+    if (start == -1
+            || close_fast_paths_for(lfd.file, lfd_owner, lck->l_type) == -1)
+        goto error;
+
+    pid_t pid;
+    while ((pid = is_lock_applicable(lfd.file, lfd_owner, lck->l_type, start,
+                    lck->l_len)) > 1) {
+        if (remove_locks_of(pid, lfd.file) == -1)
+            goto error;
+    }
+    if (pid == -1)
+        goto error;
+
+    if (pid == 1 && !must_wait_in_queue(lfd.file, lfd_owner, lck->l_type,
+                start, lck->l_len, ULONG_MAX)) {
+        if (apply_rw_lock(lfd.file, lfd_owner, lck->l_type, start, lck->l_len)
+                == -1)
+            goto error;
+        char granted = 1;
+        if (write(afd, &granted, 1) != 1)
+            goto error;
+        remove_notify_fifo(path);
+    } else {
+        int queued = enqueue_waiter(lfd.file, lfd_owner, lck->l_type, start,
+                lck->l_len);
+        if (queued == -1)
+            goto error;
+        rl_waiter *waiter = &lfd.file->wait_queue[queued];
+        if (is_deadlocked(lfd.file, waiter)) {
+            dequeue_waiter(lfd.file, queued);
+            errno = EDEADLK;
+            goto error;
+        }
+        waiter->async = 1;
+        waiter->notify_fd = afd;
+        strcpy(waiter->notify_path, path);
+    }
+
+    if (hand_off(lfd.file) == -1)
+        goto error;
+
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        goto error;
+    if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
+        goto error2;
+    return afd;
+
+ error:
+    msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE);
     pthread_mutex_unlock(&lfd.file->mutex);
+ error2:
+    close(afd);
+    remove_notify_fifo(path);
     return -1;
 }
 
+/**
+ * @brief Withdraws the request of `rl_lock_async()` that returned `afd` and
+ * closes `afd`
+ * @param lfd the descriptor given to `rl_lock_async()`
+ * @param afd the descriptor returned by `rl_lock_async()`
+ * @return 0 if the request was withdrawn before being granted, 1 if the lock
+ * had already been applied, in which case it is still held, -1 on error
+ */
+int rl_lock_cancel(rl_descriptor lfd, int afd) {
+    if (lfd.fd < 0 || lfd.file == NULL || afd < 0)
+        return -1;
+
+    if (lock_file(lfd.file) != 0)
+        return -1;
+
+    int res = 1;
+    rl_owner lfd_owner = get_owner(lfd);
+    for (int i = 0; i < RL_MAX_WAITERS; i++) {
+        rl_waiter *cur = &lfd.file->wait_queue[i];
+        if (!is_waiter_free(cur) && cur->async && cur->notify_fd == afd
+                && equals(cur->owner, lfd_owner)) {
+            dequeue_waiter(lfd.file, i);
+            res = 0;
+            break;
+        }
+    }
+
+    if (hand_off(lfd.file) == -1)
+        res = -1;
+
+    open_fast_path(lfd.file);
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        res = -1;
+    if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
+        res = -1;
+
+    if (close(afd) == -1)
+        return -1;
+    return res;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Sums the versions of the buckets of `file` covered by the segment
+ * (start, len)
+ * @param file the file that contains the version buckets
+ * @param start the start of the segment
+ * @param len the length of the segment, 0 if extensible
+ * @param nb_writers where to put the number of write locks on the buckets
+ * @return the sum of the versions of the buckets
+ */
+static unsigned long sum_versions(rl_open_file *file, off_t start, off_t len,
+        int *nb_writers) {
+    int first;
+    int nb_buckets = get_buckets(start, len, RL_VERSION_BUCKET_SIZE,
+            RL_NB_VERSION_BUCKETS, &first);
+    unsigned long sum = 0;
+    *nb_writers = 0;
+    for (int i = 0; i < nb_buckets; i++) {
+        rl_version_bucket *bucket
+            = &file->buckets[(first + i) % RL_NB_VERSION_BUCKETS];
+        *nb_writers += atomic_load(&bucket->nb_writers);
+        sum += atomic_load(&bucket->version);
+    }
+    return sum;
+}
+
+/**
+ * @brief Starts an optimistic read of the segment (start, len) of `lfd`
+ *
+ * No lock is put and the mutex of the file is not taken: the caller reads the
+ * segment, then calls `rl_read_validate()` with the returned stamp to know if a
+ * write lock may have been put on the segment in the meantime, in which case
+ * what was read must be discarded. Write locks are tracked per bucket of
+ * `RL_VERSION_BUCKET_SIZE` bytes, so a write lock on a nearby segment can make
+ * the validation fail as well. If the segment is currently write-locked, even
+ * by a dead process or by the caller, no stamp is returned and the caller
+ * should take a read lock instead.
+ *
+ * @param lfd the descriptor of the file to read
+ * @param start the start of the segment, from the beginning of the file
+ * @param len the length of the segment, 0 if extensible
+ * @return a stamp to give to `rl_read_validate()`, 0 if the segment is
+ * write-locked, if the file is in record mode or on error
+ */
+unsigned long rl_read_begin(rl_descriptor lfd, off_t start, off_t len) {
+    if (lfd.fd < 0 || lfd.file == NULL || start < 0 || len < 0
+            || lfd.file->record_size > 0)
+        return 0;
+
+    int nb_writers;
+    unsigned long sum = sum_versions(lfd.file, start, len, &nb_writers);
+    if (nb_writers > 0)
+        return 0;
+    return sum + 1;
+}
+
+/**
+ * @brief Checks if no write lock was put on the segment (start, len) of `lfd`
+ * since `rl_read_begin()` returned `stamp`
+ * @param lfd the descriptor of the file that was read
+ * @param start the start of the segment, as given to `rl_read_begin()`
+ * @param len the length of the segment, as given to `rl_read_begin()`
+ * @param stamp the stamp returned by `rl_read_begin()`
+ * @return 1 if what was read is consistent, 0 if it must be read again
+ */
+int rl_read_validate(rl_descriptor lfd, off_t start, off_t len,
+        unsigned long stamp) {
+    if (lfd.fd < 0 || lfd.file == NULL || start < 0 || len < 0 || stamp == 0)
+        return 0;
+
+    atomic_thread_fence(memory_order_acquire);
+    int nb_writers;
+    unsigned long sum = sum_versions(lfd.file, start, len, &nb_writers);
+    return nb_writers == 0 && sum + 1 == stamp;
+}
+
+/******************************************************************************/
+
+/**
+ * @brief Puts a write lock on the `nbytes` bytes after the tail of the file of
+ * `lfd` and moves the tail after them
+ *
+ * The tail is kept in the shared memory object, and is at least the size of
+ * the file at the time of the call, rounded up to a record in record mode.
+ * Concurrent appenders are thus given disjoint segments, which they write and
+ * unlock independently, instead of all taking an extensible write lock at the
+ * end of the file. The mutex of the file is only held while the tail is moved
+ * and the lock is put. If the segment after the tail is locked by another
+ * owner, nothing is applied and errno is set to `EAGAIN`.
+ *
+ * @param lfd the descriptor of the file to append to
+ * @param nbytes the number of bytes to reserve, a multiple of the record size
+ *               in record mode
+ * @param offset where to put the start of the reserved segment
+ * @return 0 on success, -1 on failure
+ */
+int rl_reserve_append(rl_descriptor lfd, off_t nbytes, off_t *offset) {
+    if (lfd.fd < 0 || lfd.file == NULL || nbytes <= 0 || offset == NULL)
+        return -1;
+    rl_open_file *file = lfd.file;
+    if (file->record_size > 0 && nbytes % file->record_size != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(lfd.fd, &st) == -1)
+        return -1;
+
+    if (lock_file(file) != 0)
+        return -1;
+
+    rl_owner lfd_owner = get_owner(lfd);
+    off_t start = file->append_tail;
+    if (start < st.st_size)
+        start = st.st_size;
+    int res = -1;
+    if (file->record_size > 0) {
+        start = (start + file->record_size - 1) / file->record_size
+            * file->record_size;
+        off_t first = start / file->record_size;
+        off_t end = first + nbytes / file->record_size;
+        int slot = add_record_owner(file, lfd_owner);
+        int holder;
+        off_t conflict;
+        if (end > RL_MAX_RECORDS)
+            errno = ENOLCK;
+        else if (slot != -1 && alloc_record_chunks(file, first, end) == 0) {
+            while ((res = lock_records(file, slot, F_WRLCK, first, end,
+                            &holder, &conflict)) == 1) {
+                pid_t pid = atomic_load(&file->record_owners[holder].pid);
+                if (!(kill(pid, 0) == -1 && errno == ESRCH))
+                    break;
+                release_record_owner(file, holder);
+            }
+            if (res == 1) {
+                records_released(file, first, end, NULL);
+                errno = EAGAIN;
+                res = -1;
+            }
+        }
+        if (slot != -1)
+            unpin_record_owner(file, slot);
+    } else if (close_fast_paths_for(file, lfd_owner, F_WRLCK) == 0) {
+        pid_t pid;
+        while ((pid = is_lock_applicable(file, lfd_owner, F_WRLCK, start,
+                        nbytes)) > 1) {
+            if (remove_locks_of(pid, file) == -1)
+                goto end;
+        }
+        if (pid == 1 && must_wait_in_queue(file, lfd_owner, F_WRLCK, start,
+                    nbytes, ULONG_MAX))
+            pid = 0;
+        if (pid == 0)
+            errno = EAGAIN;
+        else if (pid == 1)
+            res = apply_rw_lock(file, lfd_owner, F_WRLCK, start, nbytes);
+    }
+    if (res == 0) {
+        file->append_tail = start + nbytes;
+        *offset = start;
+    }
+
+ end:
+    /* the locks of the dead processes removed above may be handed off */
+    if (hand_off(file) == -1)
+        res = -1;
+    open_fast_path(file);
+    if (msync(file, file->size, MS_SYNC | MS_INVALIDATE) == -1)
+        res = -1;
+    if (pthread_mutex_unlock(&file->mutex) != 0)
+        return -1;
+    return res;
+}
+
 /******************************************************************************/
 
 /**
@@ -1129,18 +5369,32 @@ int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck) {
  * @return 0 on success, -1 on error
  */
 static int dup_owner(rl_descriptor lfd, rl_owner new_owner) {
-    rl_owner lfd_owner = {.pid = getpid(), .fd = lfd.fd};
+    rl_owner lfd_owner = get_owner(lfd);
+    if (lfd.file->record_size > 0) {
+        int from = find_record_owner(lfd.file, lfd_owner);
+        return (from == -1) ?
+            0 : copy_record_owner(lfd.file, from, new_owner);
+    }
+    if (close_fast_paths_for(lfd.file, lfd_owner, F_UNLCK) == -1)
+        return -1;
+
+    int res = -1;
+    begin_update(lfd.file);
     for (int i = 0; i < lfd.file->nb_locks; i++) {
-        rl_lock *tmp = &lfd.file->lock_table[i];
-        int code = is_owner_of(lfd_owner, tmp);
+        rl_lock *tmp = get_lock(lfd.file, i);
+        int code = is_owner_of(lfd.file, lfd_owner, tmp);
         if (code == -1)
-            return -1;
+            goto end;
         if (code) {
-            if (add_owner(new_owner, tmp) == -1)
-                return -1;
+            if (add_owner(lfd.file, new_owner, tmp) == -1)
+                goto end;
         }
     }
-    return 0;
+    res = 0;
+
+ end:
+    end_update(lfd.file);
+    return res;
 }
 
 /**
@@ -1158,10 +5412,11 @@ rl_descriptor rl_dup(rl_descriptor lfd) {
     if (new_fd == -1)
         return err;
     
-    if (pthread_mutex_lock(&lfd.file->mutex) != 0)
+    if (lock_file(lfd.file) != 0)
         return err;
 
-    rl_owner new_owner = {.pid = getpid(), .fd = new_fd};
+    rl_owner new_owner = {.pid = getpid(), .fd = new_fd,
+        .token = lfd.token};
     if (dup_owner(lfd, new_owner) == -1) {
         close(new_fd);
         return err;
@@ -1170,12 +5425,13 @@ rl_descriptor rl_dup(rl_descriptor lfd) {
     if (map_increment(lfd.file, getpid()))
         return err;
 
-    if (msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
         return err;
     if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
         return err;
 
-    rl_descriptor res = {.fd = new_fd, .file = lfd.file};
+    rl_descriptor res = {.fd = new_fd, .file = lfd.file,
+        .token = lfd.token};
     return res;
 }
 
@@ -1198,10 +5454,11 @@ rl_descriptor rl_dup2(rl_descriptor lfd, int new_fd) {
     if (dup2(lfd.fd, new_fd) == -1)
         return err;
     
-    if (pthread_mutex_lock(&lfd.file->mutex) != 0)
+    if (lock_file(lfd.file) != 0)
         return err;
 
-    rl_owner new_owner = {.pid = getpid(), .fd = new_fd};
+    rl_owner new_owner = {.pid = getpid(), .fd = new_fd,
+        .token = lfd.token};
     if (dup_owner(lfd, new_owner) == -1) {
         close(new_fd);
         return err;
@@ -1210,15 +5467,49 @@ rl_descriptor rl_dup2(rl_descriptor lfd, int new_fd) {
     if (map_increment(lfd.file, getpid()))
         return err;
 
-    if (msync(lfd.file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
+    if (msync(lfd.file, lfd.file->size, MS_SYNC | MS_INVALIDATE) == -1)
         return err;
     if (pthread_mutex_unlock(&lfd.file->mutex) != 0)
         return err;
 
-    rl_descriptor res = {.fd = new_fd, .file = lfd.file};
+    rl_descriptor res = {.fd = new_fd, .file = lfd.file,
+        .token = lfd.token};
     return res;
 }
 
+/**
+ * @brief Gives a copy of `lfd` whose locks belong to the owner identified by
+ * `token` instead of being shared with the other copies of `lfd`
+ *
+ * The copies of a descriptor with different tokens are distinct owners, which
+ * lets the threads of a process lock the same file through a single file
+ * descriptor without sharing their locks. The locks are released as usual when
+ * the file descriptor is closed through any of its copies.
+ *
+ * @param lfd the descriptor to copy
+ * @param token the token of the owner, `RL_OWNER_PROCESS` for the owner shared
+ *              with the copies of `lfd` without a token, `RL_OWNER_THREAD` for
+ *              a token unique to the calling thread, which no other thread of
+ *              the process ever gets, taken downwards from `RL_OWNER_THREAD`
+ * @return the copy of `lfd`, {.fd = -1, .file = NULL} on error
+ */
+rl_descriptor rl_bind_owner(rl_descriptor lfd, unsigned long token) {
+    static _Thread_local unsigned long thread_token = RL_OWNER_PROCESS;
+    rl_descriptor err = {.fd = -1, .file = NULL};
+
+    if (lfd.fd < 0 || lfd.file == NULL)
+        return err;
+
+    if (token == RL_OWNER_THREAD) {
+        if (thread_token == RL_OWNER_PROCESS)
+            thread_token = RL_OWNER_THREAD - 1
+                - atomic_fetch_add(&nb_thread_tokens, 1);
+        token = thread_token;
+    }
+    lfd.token = token;
+    return lfd;
+}
+
 /******************************************************************************/
 
 /**
@@ -1236,43 +5527,68 @@ pid_t rl_fork() {
     
     if (pid == 0) {
         pid_t child = getpid();
-        for (int i = 0; i < rla.nb_files; i++) {
-            rl_open_file *file = rla.open_files[i];
+        /* the other threads of the parent do not exist in the child */
+        for (int i = 0; i < RL_MAX_FILES; i++)
+            initialize_combiner(&rla.combiners[i]);
+        for (int i = 0; i < atomic_load(&rla.nb_files); i++) {
+            rl_open_file *file = atomic_load(&rla.open_files[i]);
+
+            if (lock_file(file) != 0 || close_fast_path(file) == -1
+                    || move_reader_slots_of(file, parent, -1) == -1)
+                return err;
 
-            if (pthread_mutex_lock(&file->mutex) != 0)
+            // Clone the fd count of the parent
+            rl_pid_fd_count *parent_entry = find_map_entry(file, parent);
+            // TODO: An entry with key == child could very rarely already
+            // exist if the system reuses a PID
+            if (parent_entry != NULL && insert_map_entry(file, child,
+                        atomic_load(&parent_entry->fd_count)) == NULL)
                 return err;
 
+            begin_update(file);
+            rl_owner *owners = NULL;
+            size_t capacity = 0;
             for (int j = 0; j < file->nb_locks; j++) {
-                rl_lock *lck = &file->lock_table[j];
-                int nb_owners = lck->nb_owners;
-                for (int k = 0; k < nb_owners; k++) {
-                    if (lck->lock_owners[k].pid == parent) {
-                        rl_owner child_owner = {.pid = child,
-                                                .fd = lck->lock_owners[k].fd};
-                        if (add_owner(child_owner, lck) == -1)
-                            return err;
+                rl_lock *lck = get_lock(file, j);
+                /* collected first as adding owners may move the pool */
+                if (lck->nb_owners > capacity) {
+                    rl_owner *tmp = realloc(owners,
+                            lck->nb_owners * sizeof(rl_owner));
+                    if (tmp == NULL) {
+                        free(owners);
+                        return err;
+                    }
+                    owners = tmp;
+                    capacity = lck->nb_owners;
+                }
+                size_t nb_owners = 0;
+                for (rl_owner_node *node = owner_node(file, lck->first_owner);
+                        node != NULL && nb_owners < capacity;
+                        node = owner_node(file, node->next)) {
+                    if (node->owner.pid == parent)
+                        owners[nb_owners++] = node->owner;
+                }
+                for (size_t k = 0; k < nb_owners; k++) {
+                    owners[k].pid = child;
+                    if (add_owner(file, owners[k], lck) == -1) {
+                        free(owners);
+                        return err;
                     }
                 }
             }
-
-            // Clone the fd count of the parent
-            rl_pid_fd_count *parent_entry = NULL;
-            for (int z = 0; z < file->nb_map_entries; z++)
-                if (file->pid_map[z].pid == parent)
-                    parent_entry = &file->pid_map[z];
-
-            if (parent_entry != NULL) {
-                if (file->nb_map_entries >= RL_MAX_MAP_ENTRIES)
+            free(owners);
+            end_update(file);
+            for (int j = 0; file->record_size > 0 && j < RL_MAX_RECORD_OWNERS;
+                    j++) {
+                rl_record_owner *cur = &file->record_owners[j];
+                rl_owner child_owner = {.pid = child, .fd = cur->fd,
+                    .token = cur->token};
+                if (atomic_load(&cur->pid) == parent
+                        && copy_record_owner(file, j, child_owner) == -1)
                     return err;
-                // TODO: An entry with key == child could very rarely already
-                // exist if the system reuses a PID
-                file->pid_map[file->nb_map_entries].pid = child;
-                file->pid_map[file->nb_map_entries].fd_count
-                        = parent_entry->fd_count;
-                file->nb_map_entries++;
             }
 
-            if (msync(file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE)
+            if (msync(file, file->size, MS_SYNC | MS_INVALIDATE)
                     == -1)
                 return err;
             if (pthread_mutex_unlock(&file->mutex) != 0)
@@ -1293,14 +5609,19 @@ pid_t rl_fork() {
  * @return 0 on success, -1 on error
  */
 int rl_print_open_file(rl_open_file *file, int display_pids) {
-    char buffer[16384] = "";
+    size_t size = 64;
+    for (int i = 0; i < file->nb_locks; i++)
+        size += 128 + 64 * get_lock(file, i)->nb_owners;
+    char *buffer = malloc(size);
+    if (buffer == NULL)
+        return -1;
     int len = 0;
 
     len += sprintf(buffer + len, "Number of locks: %d\n",
             file->nb_locks);
 
     for (int i = 0; i < file->nb_locks; i++) {
-        rl_lock *lck = &file->lock_table[i];
+        rl_lock *lck = get_lock(file, i);
 
         len += sprintf(buffer + len, "===== Lock %d:\n", i);
 
@@ -1314,8 +5635,11 @@ int rl_print_open_file(rl_open_file *file, int display_pids) {
 
         len += sprintf(buffer + len, "Number of owners: %lu\n",
                 lck->nb_owners);
-        for (int j = 0; j < lck->nb_owners; j++) {
-            rl_owner *owner = &lck->lock_owners[j];
+        int j = 0;
+        for (rl_owner_node *node = owner_node(file, lck->first_owner);
+                j < lck->nb_owners && node != NULL;
+                node = owner_node(file, node->next), j++) {
+            rl_owner *owner = &node->owner;
 
             if (display_pids)
                 len += sprintf(buffer + len, "Owner %d: fd = %d, pid = %d\n", j,
@@ -1327,6 +5651,7 @@ int rl_print_open_file(rl_open_file *file, int display_pids) {
     }
 
     printf("%s", buffer);
+    free(buffer);
     return 0;
 }
 
@@ -1341,13 +5666,17 @@ int rl_print_open_file(rl_open_file *file, int display_pids) {
  * @return 0 on success, -1 on error
  */
 int rl_print_open_file_safe(rl_open_file *file, int display_pids) {
-    if (pthread_mutex_lock(&file->mutex) != 0)
+    if (lock_file(file) != 0)
         return -1;
+    if (close_fast_path(file) == -1 || revoke_bias(file) == -1) {
+        pthread_mutex_unlock(&file->mutex);
+        return -1;
+    }
     
     if (rl_print_open_file(file, display_pids) < 0)
         return -1;
 
-    if (msync(file, sizeof(rl_open_file), MS_SYNC | MS_INVALIDATE) == -1)
+    if (msync(file, file->size, MS_SYNC | MS_INVALIDATE) == -1)
         return -1;
     if (pthread_mutex_unlock(&file->mutex) != 0)
         return -1;
@@ -4,29 +4,95 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
 
-#define RL_MAX_MAP_ENTRIES 256
-#define RL_MAX_OWNERS 32
-#define RL_MAX_LOCKS 32
+#define RL_INITIAL_MAP_ENTRIES 256
+#define RL_FREE_MAP_ENTRY -1
+#define RL_REMOVED_MAP_ENTRY -2
+#define RL_MOVED_FD_COUNT -1
+#define RL_INITIAL_OWNERS 64
+#define RL_INITIAL_LOCKS 32
+#ifndef RL_SEGMENT_MAX_SIZE
+#define RL_SEGMENT_MAX_SIZE (64 * 1024 * 1024)
+#endif
+#define RL_SHM_NAME_MAX 64
 #define RL_MAX_FILES 256
-#define RL_FREE_OWNER -1
+#define RL_NO_OWNER -1
 #define RL_FREE_FILE NULL
 #define RL_FREE_LOCK -2
+#define RL_NO_LOCK -1
+#define RL_END_OF_FILE INT64_MAX
+#define RL_CACHE_LINE_SIZE 64
+#define RL_MAX_WAITERS 64
+#define RL_FREE_WAITER 0
+#define RL_POLICY_FIFO 0
+#define RL_POLICY_WRITER_PREFERRING 1
+#define RL_POLICY_PHASE_FAIR 2
+#define RL_FIFO_PATH_MAX 64
+#define RL_FIFO_PREFIX "/tmp/rl_async"
+#define RL_MAX_WAIT_EDGES 1024
+#define RL_NO_EDGE -1
+#define RL_FREE_EDGE 0
+#define RL_NB_VERSION_BUCKETS 64
+#define RL_VERSION_BUCKET_SIZE 4096
+#define RL_NB_OCCUPANCY_BUCKETS 1024
+#define RL_OCCUPANCY_BUCKET_SIZE 4096
+#define RL_MAX_RECORD_OWNERS 32
+#define RL_FREE_RECORD_OWNER 0
+#define RL_RECORD_CHUNK_SIZE 32768
+#define RL_MAX_RECORD_CHUNKS 128
+#define RL_MAX_RECORDS ((off_t) RL_RECORD_CHUNK_SIZE * RL_MAX_RECORD_CHUNKS)
+#define RL_RECORD_WRITERS (~(uint64_t) 0 << RL_MAX_RECORD_OWNERS)
+#define RL_RECORD_BATCH 4096
+#define RL_UNLOCK_BATCH 32
+#define RL_NB_STRIPES 64
+#define RL_FAST_OPEN 0
+#define RL_FAST_CLOSED 1
+#define RL_FAST_CLAIMED 2
+#define RL_FAST_HELD 3
+#define RL_FAST_STATE_BITS 2
+#define RL_NB_READER_SLOTS 256
+#define RL_BIAS_INHIBIT_FACTOR 9
+#define RL_OWNER_PROCESS 0UL
+#define RL_OWNER_THREAD (~0UL)
 #define SHM_PREFIX "f"
+#define RL_WAIT_GRAPH_NAME "/" SHM_PREFIX "_wait_graph"
 
 typedef struct rl_pid_fd_count rl_pid_fd_count;
 typedef struct rl_owner rl_owner;
+typedef struct rl_owner_node rl_owner_node;
 typedef struct rl_lock rl_lock;
+typedef struct rl_waiter rl_waiter;
+typedef struct rl_wait_edge rl_wait_edge;
+typedef struct rl_wait_graph rl_wait_graph;
+typedef struct rl_version_bucket rl_version_bucket;
+typedef struct rl_occupancy rl_occupancy;
+typedef struct rl_record_owner rl_record_owner;
+typedef struct rl_stripe rl_stripe;
+typedef struct rl_reader_slot rl_reader_slot;
 typedef struct rl_open_file rl_open_file;
 typedef struct rl_descriptor rl_descriptor;
+typedef struct rl_request rl_request;
+typedef struct rl_combiner rl_combiner;
 typedef struct rl_all_files rl_all_files;
 
 /**
  * @brief A map entry with key = PID and value = fd count
  */
 struct rl_pid_fd_count {
-    pid_t pid; /**< The PID of a process which has opened a specific file */
-    int fd_count; /**< The number of times the process has opened the file */
+    _Atomic pid_t pid; /**< The PID of a process which has opened a specific
+                        * file, `RL_FREE_MAP_ENTRY` or `RL_REMOVED_MAP_ENTRY`
+                        * if there is none
+                        */
+    atomic_int fd_count; /**< The number of times the process has opened the
+                          * file, `RL_MOVED_FD_COUNT` once the map has moved
+                          */
+    int first_held; /**< The index in the owner pool of the first owner node
+                     * of the process, linked to the other ones through
+                     * `next_held`, `RL_NO_OWNER` if it holds no lock
+                     */
 };
 
 /**
@@ -35,6 +101,25 @@ struct rl_pid_fd_count {
 struct rl_owner {
     pid_t pid; /**< The PID of the process that locked a segment */
     int fd; /**< The file descriptor of the locked file */
+    unsigned long token; /**< The token telling apart the owners sharing `fd`
+                          * in the process, `RL_OWNER_PROCESS` if there is none
+                          */
+};
+
+/**
+ * @brief An owner in the list of owners of a lock, which is also in the list of
+ * the locks held by the process of the owner
+ */
+struct rl_owner_node {
+    rl_owner owner; /**< The owner */
+    int next; /**< The index in the owner pool of the next owner of the lock,
+               * or of the next free node, `RL_NO_OWNER` if there is none
+               */
+    int prev_held; /**< The index of the previous node of the process */
+    int next_held; /**< The index of the next node of the process */
+    off_t start; /**< The beginning of the segment of the owned lock */
+    off_t len; /**< The length of the segment of the owned lock */
+    short type; /**< The type of the owned lock */
 };
 
 /**
@@ -45,7 +130,153 @@ struct rl_lock {
     off_t len; /**< The length of the segment */
     short type; /**< The type (F_RDLCK, F_WRLCK) of the lock */
     size_t nb_owners; /**< The number of owners of the lock */
-    rl_owner lock_owners[RL_MAX_OWNERS]; /**< The owners of the lock */
+    int first_owner; /**< The index in the owner pool of the first owner of the
+                      * lock, linked to the other ones through `next`, or the
+                      * index of the next free slot of the lock table if the
+                      * lock is free, `RL_NO_LOCK` if there is none
+                      */
+};
+
+/**
+ * @brief A lock request waiting in the queue of an open file
+ */
+struct rl_waiter {
+    unsigned long ticket; /**< The order of arrival of the request in the
+                           * queue, `RL_FREE_WAITER` if the entry is free
+                           */
+    rl_owner owner; /**< The owner that requested the lock */
+    off_t start; /**< The beginning of the requested segment */
+    off_t len; /**< The length of the requested segment */
+    short type; /**< The requested type (F_RDLCK, F_WRLCK) */
+    int granted; /**< Whether the lock has been applied on behalf of `owner` */
+    int async; /**< Whether the request was made by `rl_lock_async()` */
+    int notify_fd; /**< The descriptor returned by `rl_lock_async()` in the
+                    * process of `owner`
+                    */
+    char notify_path[RL_FIFO_PATH_MAX]; /**< The FIFO to write to when an
+                                         * asynchronous request is granted
+                                         */
+    int edge; /**< The index of the request in the edges of the wait graph,
+               * `RL_NO_EDGE` if it is not there
+               */
+    pthread_cond_t wakeup; /**< Signaled when a segment overlapping the
+                            * requested one is released
+                            */
+};
+
+/**
+ * @brief A lock request waiting in the queue of a file, as seen by the
+ * processes looking for deadlocks across files
+ */
+struct rl_wait_edge {
+    _Atomic pid_t pid; /**< The PID of the owner of the request,
+                        * `RL_FREE_EDGE` if the edge is free
+                        */
+    unsigned long token; /**< The token of the owner of the request */
+    char shm_name[RL_SHM_NAME_MAX]; /**< The name of the shared memory object
+                                     * of the file in which the request waits
+                                     */
+    off_t start; /**< The beginning of the requested segment */
+    off_t len; /**< The length of the requested segment */
+    short type; /**< The requested type (F_RDLCK, F_WRLCK) */
+};
+
+/**
+ * @brief The requests waiting in the queues of every file, shared by all the
+ * processes using the library
+ *
+ * An owner waiting in the queue of a file waits for the owners of the
+ * conflicting locks of that file, which may themselves wait in the queue of
+ * another file. The owners are told apart across files by their PID and their
+ * token only, as their file descriptors differ from a file to another.
+ */
+struct rl_wait_graph {
+    pthread_mutex_t mutex; /**< Held while an edge is added or the graph is
+                            * searched
+                            */
+    atomic_int ready; /**< Whether the graph has been initialized */
+    rl_wait_edge edges[RL_MAX_WAIT_EDGES]; /**< The waiting requests */
+};
+
+/**
+ * @brief The write locks on a set of regions of a file, used to validate
+ * optimistic reads
+ */
+struct rl_version_bucket {
+    atomic_ulong version; /**< Incremented each time a write lock on the
+                           * bucket is added or removed
+                           */
+    atomic_int nb_writers; /**< The number of write locks on the bucket */
+};
+
+/**
+ * @brief The number of locks per region of a file, used to grant the requests
+ * on unlocked regions without scanning the lock table
+ *
+ * Bucket `i` covers the offsets `o` such that
+ * `(o / RL_OCCUPANCY_BUCKET_SIZE) % RL_NB_OCCUPANCY_BUCKETS == i`. The locks
+ * that cover every bucket, such as the extensible ones, are only counted in
+ * `nb_wide_readers` and `nb_wide_writers`.
+ */
+struct rl_occupancy {
+    int nb_readers[RL_NB_OCCUPANCY_BUCKETS]; /**< The number of read locks on
+                                              * each bucket
+                                              */
+    int nb_writers[RL_NB_OCCUPANCY_BUCKETS]; /**< The number of write locks
+                                              * on each bucket
+                                              */
+    int nb_wide_readers; /**< The number of read locks on every bucket */
+    int nb_wide_writers; /**< The number of write locks on every bucket */
+    int nb_write_locks; /**< The number of write locks on the file */
+};
+
+/**
+ * @brief An owner of locks on the records of a file in record mode
+ */
+struct rl_record_owner {
+    _Atomic pid_t pid; /**< The PID of the owner, `RL_FREE_RECORD_OWNER` if
+                        * the slot is free
+                        */
+    int fd; /**< The file descriptor of the owner */
+    unsigned long token; /**< The token of the owner */
+    atomic_long nb_records; /**< The number of records locked by the owner,
+                             * at least, plus its requests in progress, -1 if
+                             * the slot is free
+                             */
+    _Atomic off_t first_record; /**< The first record the owner may lock */
+    _Atomic off_t end_record; /**< The record after the last one the owner may
+                               * lock
+                               */
+};
+
+/**
+ * @brief The requests waiting for the records of a file in record mode whose
+ * index modulo `RL_NB_STRIPES` is the same
+ */
+struct rl_stripe {
+    pthread_mutex_t mutex; /**< The lock protecting `released` */
+    pthread_cond_t released; /**< Signaled when a lock on a record of the
+                              * stripe is removed
+                              */
+    atomic_int nb_waiters; /**< The number of requests waiting on the stripe */
+};
+
+/**
+ * @brief A read lock announced by its owner without taking the mutex of the
+ * file, while the file is biased towards readers
+ */
+struct rl_reader_slot {
+    _Alignas(RL_CACHE_LINE_SIZE) _Atomic uint64_t word; /**< The state of the
+                                                         * slot packed with
+                                                         * the PID of its
+                                                         * owner, as in
+                                                         * `fast_lock`,
+                                                         * `RL_FAST_OPEN` if
+                                                         * the slot is free
+                                                         */
+    rl_owner owner; /**< The owner of the read lock */
+    off_t start; /**< The beginning of the segment */
+    off_t len; /**< The length of the segment */
 };
 
 /**
@@ -54,12 +285,119 @@ struct rl_lock {
 struct rl_open_file {
     int nb_locks; /**< The number of locks */
     pthread_mutex_t mutex; /**< The exclusive lock on the open file */
-    rl_lock lock_table[RL_MAX_LOCKS]; /**< The locks on the open file */
+    atomic_ulong seq; /**< Incremented before and after each modification of
+                       * `lock_table`, odd while it is being modified
+                       */
+    int update_depth; /**< The number of nested modifications of `lock_table`
+                       * in progress
+                       */
+    rl_version_bucket buckets[RL_NB_VERSION_BUCKETS]; /**< The write locks
+                                                       * per region of the
+                                                       * file
+                                                       */
+    rl_occupancy occupancy; /**< The locks per region of the file */
+    _Atomic uint64_t fast_lock; /**< The state of the fast path in the low
+                                 * `RL_FAST_STATE_BITS` bits, `RL_FAST_OPEN`
+                                 * if the file has no lock and no waiter,
+                                 * `RL_FAST_CLAIMED` or `RL_FAST_HELD` if
+                                 * its only lock is `fast_held`, taken
+                                 * without the mutex by the process whose PID
+                                 * is in the other bits, `RL_FAST_CLOSED` if
+                                 * the locks are in `lock_table`
+                                 */
+    rl_owner fast_owner; /**< The owner of `fast_held` */
+    rl_lock fast_held; /**< The lock taken through the fast path, only valid
+                        * in the `RL_FAST_HELD` state
+                        */
+    int reader_bias; /**< Whether the read locks are announced in
+                      * `reader_slots` while there is no write lock
+                      */
+    atomic_int biased; /**< Whether the read locks can currently be announced
+                        * in `reader_slots`
+                        */
+    struct timespec bias_inhibited_until; /**< The `CLOCK_MONOTONIC` time
+                                           * before which the bias is not
+                                           * restored after a revocation
+                                           */
+    rl_reader_slot reader_slots[RL_NB_READER_SLOTS]; /**< The read locks
+                                                      * announced by their
+                                                      * owners
+                                                      */
+    off_t record_size; /**< The size of the records of the file, 0 if the
+                        * locks are ranges of bytes kept in `lock_table`
+                        */
+    off_t append_tail; /**< The offset after the last segment reserved by
+                        * `rl_reserve_append()`
+                        */
+    rl_record_owner record_owners[RL_MAX_RECORD_OWNERS]; /**< The owners of
+                                                          * locks on records
+                                                          */
+    atomic_size_t record_chunks[RL_MAX_RECORD_CHUNKS]; /**< The offsets in
+                                                        * the shared memory
+                                                        * object of the
+                                                        * chunks of
+                                                        * `RL_RECORD_CHUNK_SIZE`
+                                                        * record words, 0 if
+                                                        * not allocated
+                                                        */
+    rl_stripe stripes[RL_NB_STRIPES]; /**< The requests waiting for records */
+    char shm_name[RL_SHM_NAME_MAX]; /**< The name of the shared memory
+                                     * object that contains the open file
+                                     */
+    size_t size; /**< The size of the shared memory object, at most
+                  * `RL_SEGMENT_MAX_SIZE`
+                  */
+    size_t lock_table; /**< The offset in the shared memory object of the
+                        * slots of the locks on the open file, which do not
+                        * move until the table grows
+                        */
+    size_t lock_index; /**< The offset in the shared memory object of the
+                        * indexes in `lock_table` of the `nb_locks` locks,
+                        * sorted by start, the finite ones first
+                        */
+    size_t lock_starts; /**< The offset in the shared memory object of the
+                         * starts of the locks, in the order of `lock_index`
+                         */
+    size_t lock_ends; /**< The offset in the shared memory object of the ends
+                       * of the locks, `RL_END_OF_FILE` for the extensible
+                       * ones, in the order of `lock_index`
+                       */
+    size_t lock_writes; /**< The offset in the shared memory object of the
+                         * masks of the locks, -1 for the write locks and 0
+                         * for the read locks, in the order of `lock_index`
+                         */
+    int lock_capacity; /**< The number of locks `lock_table` can hold */
+    int free_lock; /**< The index of the first free slot of `lock_table`,
+                    * `RL_NO_LOCK` if there is none
+                    */
+    off_t max_len; /**< The length of the longest finite lock */
     int nb_map_entries; /**< The number of entries in `pid_map` */
-    rl_pid_fd_count pid_map[RL_MAX_MAP_ENTRIES]; /**< The map storing which
-                                                  * processes have opened the
-                                                  * file and how many times
-                                                  */
+    int nb_removed_map_entries; /**< The number of removed entries in
+                                 * `pid_map`
+                                 */
+    size_t pid_map; /**< The offset in the shared memory object of the hash
+                     * table storing which processes have opened the file and
+                     * how many times, with linear probing
+                     */
+    int map_capacity; /**< The number of entries `pid_map` can hold, a power
+                       * of 2
+                       */
+    size_t owner_pool; /**< The offset in the shared memory object of the
+                        * nodes storing the owners of the locks
+                        */
+    int owner_capacity; /**< The number of nodes `owner_pool` can hold */
+    int free_owner; /**< The index of the first free node of `owner_pool`,
+                     * `RL_NO_OWNER` if there is none
+                     */
+    int policy; /**< The order in which queued requests are served */
+    int handoff; /**< Whether released segments are handed off directly to
+                  * the queued requests
+                  */
+    int nb_waiters; /**< The number of requests in `wait_queue` */
+    unsigned long next_ticket; /**< The ticket of the next queued request */
+    rl_waiter wait_queue[RL_MAX_WAITERS]; /**< The requests waiting for
+                                           * conflicting locks to be released
+                                           */
 };
 
 /**
@@ -68,20 +406,73 @@ struct rl_open_file {
 struct rl_descriptor {
     int fd; /**< The open file descriptor as in the descriptor table */
     rl_open_file *file; /**< The locks on the open file */
+    unsigned long token; /**< The token of the owner of the locks applied
+                          * through the descriptor, `RL_OWNER_PROCESS` if the
+                          * locks are shared with every descriptor of the
+                          * process for `fd` without a token
+                          */
+};
+
+/**
+ * @brief A non-blocking lock request published by a thread to the combiner of
+ * its process
+ */
+struct rl_request {
+    rl_owner owner; /**< The owner of the lock */
+    off_t start; /**< The beginning of the segment */
+    off_t len; /**< The length of the segment, 0 if extensible */
+    short type; /**< The type (F_RDLCK, F_WRLCK, F_UNLCK) of the request */
+    int res; /**< The result of the request, 0 or -1 */
+    int err; /**< The value of errno after the request */
+    atomic_int done; /**< Whether the request has been applied */
+    rl_request *next; /**< The request published before this one */
+};
+
+/**
+ * @brief The lock requests of the threads of a process on an open file, applied
+ * in batches by one of them
+ */
+struct rl_combiner {
+    pthread_mutex_t mutex; /**< Held by the thread applying a batch */
+    _Atomic(rl_request *) requests; /**< The last published request, not yet
+                                     * applied, NULL if there is none
+                                     */
 };
 
 /**
  * @brief All the open file descriptions of a process
  */
 struct rl_all_files {
-    int nb_files; /**< The number of open file descriptions */
-    rl_open_file *open_files[RL_MAX_FILES]; /**< The open file descriptions */
+    atomic_int nb_files; /**< The number of open file descriptions */
+    _Atomic(rl_open_file *) open_files[RL_MAX_FILES]; /**< The open file
+                                                       * descriptions, added
+                                                       * in the first free
+                                                       * slot and never
+                                                       * removed
+                                                       */
+    rl_combiner combiners[RL_MAX_FILES]; /**< The combiners of the open file
+                                          * descriptions, in the same order
+                                          */
 };
 
 rl_descriptor rl_open(const char *path, int oflag, ...);
+rl_descriptor rl_open_records(const char *path, int oflag, off_t record_size,
+        ...);
 int rl_close(rl_descriptor lfd);
 int rl_fcntl(rl_descriptor lfd, int cmd, struct flock *lck);
+int rl_fcntl_timed(rl_descriptor lfd, int cmd, struct flock *lck,
+        const struct timespec *deadline);
+int rl_lock_async(rl_descriptor lfd, struct flock *lck);
+int rl_lock_cancel(rl_descriptor lfd, int afd);
+int rl_set_wait_policy(rl_descriptor lfd, int policy);
+int rl_set_handoff(rl_descriptor lfd, int enabled);
+int rl_set_reader_bias(rl_descriptor lfd, int enabled);
+unsigned long rl_read_begin(rl_descriptor lfd, off_t start, off_t len);
+int rl_read_validate(rl_descriptor lfd, off_t start, off_t len,
+        unsigned long stamp);
+int rl_reserve_append(rl_descriptor lfd, off_t nbytes, off_t *offset);
 rl_descriptor rl_dup(rl_descriptor lfd);
+rl_descriptor rl_bind_owner(rl_descriptor lfd, unsigned long token);
 rl_descriptor rl_dup2(rl_descriptor lfd, int newd);
 pid_t rl_fork();
 int rl_init_library();
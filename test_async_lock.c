@@ -0,0 +1,127 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places write locks on [0; 10[ and [40; 50[, then creates
+ * a child process which opens the file on its own and makes three asynchronous
+ * requests: a write lock on [0; 10[, which stays pending, a read lock on
+ * [20; 30[, whose descriptor is readable immediately, and a write lock on
+ * [40; 50[, which is cancelled. The child then polls the descriptor of its
+ * first request, which becomes readable when the parent unlocks [0; 10[, half
+ * a second later. At that time the lock on [0; 10[ already belongs to the
+ * child.
+ */
+
+static int is_readable(int afd, int timeout) {
+    struct pollfd pfd = {.fd = afd, .events = POLLIN};
+    int res = poll(&pfd, 1, timeout);
+    if (res == -1)
+        PANIC_EXIT("poll()");
+    return res == 1 && (pfd.revents & POLLIN);
+}
+
+static int request(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    int afd = rl_lock_async(lfd, &lck);
+    if (afd < 0)
+        PANIC_EXIT("rl_lock_async()");
+    return afd;
+}
+
+int main() {
+#define FILENAME "/tmp/test-async-lock.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    lck.l_start = 40;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Placed write locks on [0; 10[ and [40; 50[\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        int pending = request(lfd2, F_WRLCK, 0, 10);
+        if (is_readable(pending, 0))
+            PANIC_EXIT("conflicting request granted");
+        printf("CHILD: Write lock request on [0; 10[ pending\n");
+
+        int immediate = request(lfd2, F_RDLCK, 20, 10);
+        if (!is_readable(immediate, 0))
+            PANIC_EXIT("compatible request not granted");
+        close(immediate);
+        printf("CHILD: Read lock request on [20; 30[ granted immediately\n");
+
+        int cancelled = request(lfd2, F_WRLCK, 40, 10);
+        if (rl_lock_cancel(lfd2, cancelled) != 0)
+            PANIC_EXIT("rl_lock_cancel()");
+        printf("CHILD: Write lock request on [40; 50[ cancelled\n");
+
+        if (!is_readable(pending, 3000))
+            PANIC_EXIT("request not granted after unlock");
+        if (rl_lock_cancel(lfd2, pending) != 1)
+            PANIC_EXIT("rl_lock_cancel()");
+        printf("CHILD: Write lock request on [0; 10[ granted\n");
+
+        if (rl_print_open_file_safe(lfd2.file, 0) < 0)
+            PANIC_EXIT("rl_print_open_file_safe()");
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        return 0;
+    }
+
+    usleep(500000);
+
+    lck.l_start = 0;
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Unlocked [0; 10[\n");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
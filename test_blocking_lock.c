@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places a write lock on [0; 10[ then creates a child
+ * process which opens the file on its own and waits with F_SETLKW for a write
+ * lock on [5; 15[. The parent sleeps for a second before unlocking, so the
+ * child must have been blocked for about a second when it gets its lock. The
+ * child then exits without releasing its lock, and the parent, waiting with
+ * F_SETLKW for a write lock on [0; 20[, gets it once the lock of its dead
+ * child is detected and removed.
+ */
+
+static double elapsed_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main() {
+#define FILENAME "/tmp/test-blocking-lock.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Placed write lock on [0; 10[\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        struct flock lck2;
+        lck2.l_type = F_WRLCK;
+        lck2.l_whence = SEEK_SET;
+        lck2.l_start = 5;
+        lck2.l_len = 10;
+
+        if (rl_fcntl(lfd2, F_SETLK, &lck2) == 0 || errno != EAGAIN)
+            PANIC_EXIT("rl_fcntl()");
+
+        printf("CHILD: Non-blocking write lock on [5; 15[ refused\n");
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (rl_fcntl(lfd2, F_SETLKW, &lck2) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        double waited = elapsed_since(&start);
+        if (waited < 0.5)
+            PANIC_EXIT("F_SETLKW did not block");
+
+        printf("CHILD: Got write lock on [5; 15[ after blocking\n");
+        printf("CHILD: Exiting without releasing the lock\n");
+        exit(0);
+    }
+
+    sleep(1);
+
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Unlocked [0; 10[\n");
+
+    if (waitpid(pid, NULL, 0) < 0)
+        PANIC_EXIT("waitpid()");
+
+    lck.l_type = F_WRLCK;
+    lck.l_start = 0;
+    lck.l_len = 20;
+    if (rl_fcntl(lfd, F_SETLKW, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Got write lock on [0; 20[ despite the dead child\n");
+
+    if (rl_print_open_file_safe(lfd.file, 0) < 0)
+        PANIC_EXIT("rl_print_open_file_safe()");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process opens the file twice and places NB_LOCKS read locks
+ * through each descriptor, interleaved in the lock table. A child process then
+ * opens the file on its own, places a write lock on [1000; 1010[ and dies
+ * without closing it. Closing the second descriptor of the parent must remove
+ * exactly its locks and keep those of the first descriptor, as F_GETLK through
+ * another token of the first descriptor shows. The lock left by the dead child
+ * is reaped when the parent asks for a write lock on [1000; 1010[.
+ */
+
+#define NB_LOCKS 100
+
+static void lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+static void getlk(rl_descriptor lfd, off_t start, struct flock *lck) {
+    lck->l_type = F_WRLCK;
+    lck->l_whence = SEEK_SET;
+    lck->l_start = start;
+    lck->l_len = 1;
+    if (rl_fcntl(lfd, F_GETLK, lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-close-owned.txt"
+    rl_init_library();
+
+    rl_descriptor lfd1 = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd1.fd < 0 || lfd1.file == NULL)
+        PANIC_EXIT("rl_open()");
+    rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+    if (lfd2.fd < 0 || lfd2.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    for (int i = 0; i < NB_LOCKS; i++) {
+        lock(lfd1, F_RDLCK, 4 * i, 1);
+        lock(lfd2, F_RDLCK, 4 * i + 2, 1);
+    }
+    printf("PARENT: Placed %d read locks through each descriptor\n", NB_LOCKS);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd3 = rl_open(FILENAME, O_RDWR);
+        if (lfd3.fd < 0 || lfd3.file == NULL)
+            PANIC_EXIT("rl_open()");
+        lock(lfd3, F_WRLCK, 1000, 10);
+        printf("CHILD: Placed write lock on [1000; 1010[ and died\n");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+    if (lfd1.file->nb_locks != 2 * NB_LOCKS + 1)
+        PANIC_EXIT("unexpected number of locks");
+
+    if (rl_close(lfd2) < 0)
+        PANIC_EXIT("rl_close()");
+    if (lfd1.file->nb_locks != NB_LOCKS + 1)
+        PANIC_EXIT("unexpected number of locks after rl_close()");
+    rl_descriptor other = rl_bind_owner(lfd1, 1);
+    struct flock lck;
+    for (int i = 0; i < NB_LOCKS; i++) {
+        getlk(other, 4 * i, &lck);
+        if (lck.l_type != F_RDLCK || lck.l_start != 4 * i)
+            PANIC_EXIT("lock of the first descriptor removed");
+        getlk(other, 4 * i + 2, &lck);
+        if (lck.l_type != F_UNLCK)
+            PANIC_EXIT("lock of the second descriptor kept");
+    }
+    printf("PARENT: Second descriptor closed, locks of the first one kept\n");
+
+    lock(lfd1, F_WRLCK, 1000, 10);
+    getlk(other, 1005, &lck);
+    if (lfd1.file->nb_locks != NB_LOCKS + 1 || lck.l_type != F_WRLCK
+            || lck.l_start != 1000 || lck.l_pid != getpid())
+        PANIC_EXIT("lock of the dead child not reaped");
+    printf("PARENT: Lock of the dead child reaped\n");
+
+    if (rl_close(lfd1) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
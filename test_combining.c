@@ -0,0 +1,125 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process stores a counter at the beginning of a file and creates a
+ * child process. Each process starts NB_THREADS threads, each with its own
+ * duplicate of the descriptor of the process so that they are distinct owners.
+ * Each thread takes a write lock on the counter with F_SETLK until it gets it,
+ * increments the counter and unlocks it, NB_INCREMENTS times, the requests of
+ * the threads of a process being applied in batches by one of them. The counter
+ * must then be 2 * NB_THREADS * NB_INCREMENTS.
+ */
+
+#define NB_THREADS 4
+#define NB_INCREMENTS 2000
+
+static int lock(rl_descriptor lfd, short type) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = sizeof(int);
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+static void *count(void *arg) {
+    rl_descriptor *lfd = arg;
+    for (int i = 0; i < NB_INCREMENTS; i++) {
+        int code;
+        while ((code = lock(*lfd, F_WRLCK)) == -1 && errno == EAGAIN)
+            ;
+        if (code == -1)
+            PANIC_EXIT("rl_fcntl()");
+
+        int n;
+        if (pread(lfd->fd, &n, sizeof(int), 0) != sizeof(int))
+            PANIC_EXIT("pread()");
+        n++;
+        if (pwrite(lfd->fd, &n, sizeof(int), 0) != sizeof(int))
+            PANIC_EXIT("pwrite()");
+
+        if (lock(*lfd, F_UNLCK) == -1)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    return NULL;
+}
+
+static void run_threads(rl_descriptor lfd) {
+    rl_descriptor dups[NB_THREADS];
+    pthread_t threads[NB_THREADS];
+    for (int i = 0; i < NB_THREADS; i++) {
+        dups[i] = rl_dup(lfd);
+        if (dups[i].fd < 0)
+            PANIC_EXIT("rl_dup()");
+    }
+    for (int i = 0; i < NB_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, count, &dups[i]) != 0)
+            PANIC_EXIT("pthread_create()");
+    }
+    for (int i = 0; i < NB_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0)
+            PANIC_EXIT("pthread_join()");
+    }
+    for (int i = 0; i < NB_THREADS; i++) {
+        if (rl_close(dups[i]) < 0)
+            PANIC_EXIT("rl_close()");
+    }
+}
+
+int main() {
+#define FILENAME "/tmp/test-combining.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+    int n = 0;
+    if (pwrite(lfd.fd, &n, sizeof(int), 0) != sizeof(int))
+        PANIC_EXIT("pwrite()");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+        run_threads(lfd2);
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    run_threads(lfd);
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (pread(lfd.fd, &n, sizeof(int), 0) != sizeof(int))
+        PANIC_EXIT("pread()");
+    if (n != 2 * NB_THREADS * NB_INCREMENTS)
+        PANIC_EXIT("lost increments");
+    printf("PARENT: Counter at %d\n", n);
+
+    if (lfd.file->nb_locks != 0)
+        PANIC_EXIT("locks left");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
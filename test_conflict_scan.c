@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places NB_LOCKS locks on [10 * i; 10 * i + 5[, every
+ * third one being a write lock and the other ones read locks, a write lock on
+ * [LONG_START; LONG_START + 1000[ and an extensible read lock starting at
+ * EXT_START. A child process then opens the file on its own and probes with
+ * F_GETLK every offset from 0 to past EXT_START, asking for read and write
+ * locks of length 1, 7 and 0, and must get the first lock that conflicts, as
+ * computed by testing every lock in turn.
+ */
+
+#define NB_LOCKS 100
+#define LONG_START 2000
+#define EXT_START 4000
+
+typedef struct {
+    off_t start;
+    off_t len;
+    short type;
+} segment;
+
+static int overlap(segment *seg, off_t start, off_t len) {
+    off_t end = (seg->len == 0) ? -1 : seg->start + seg->len;
+    return (end == -1 || start < end)
+        && (len == 0 || seg->start < start + len);
+}
+
+static void lock(rl_descriptor lfd, segment *seg) {
+    struct flock lck;
+    lck.l_type = seg->type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = seg->start;
+    lck.l_len = seg->len;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-conflict-scan.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    segment segs[NB_LOCKS + 2];
+    for (int i = 0; i < NB_LOCKS; i++) {
+        segs[i].start = 10 * i;
+        segs[i].len = 5;
+        segs[i].type = (i % 3 == 0) ? F_WRLCK : F_RDLCK;
+    }
+    segs[NB_LOCKS].start = LONG_START;
+    segs[NB_LOCKS].len = 1000;
+    segs[NB_LOCKS].type = F_WRLCK;
+    segs[NB_LOCKS + 1].start = EXT_START;
+    segs[NB_LOCKS + 1].len = 0;
+    segs[NB_LOCKS + 1].type = F_RDLCK;
+    for (int i = 0; i < NB_LOCKS + 2; i++)
+        lock(lfd, &segs[i]);
+    printf("PARENT: Placed %d locks\n", NB_LOCKS + 2);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        short types[2] = {F_RDLCK, F_WRLCK};
+        off_t lens[3] = {1, 7, 0};
+        long nb_probes = 0;
+        for (off_t x = 0; x < EXT_START + 20; x++) {
+            for (int t = 0; t < 2; t++) {
+                for (int l = 0; l < 3; l++) {
+                    segment *expected = NULL;
+                    for (int i = 0; i < NB_LOCKS + 2 && expected == NULL; i++) {
+                        if ((segs[i].type == F_WRLCK || types[t] == F_WRLCK)
+                                && overlap(&segs[i], x, lens[l]))
+                            expected = &segs[i];
+                    }
+
+                    struct flock lck;
+                    lck.l_type = types[t];
+                    lck.l_whence = SEEK_SET;
+                    lck.l_start = x;
+                    lck.l_len = lens[l];
+                    if (rl_fcntl(lfd2, F_GETLK, &lck) < 0)
+                        PANIC_EXIT("rl_fcntl()");
+                    nb_probes++;
+
+                    if (expected == NULL) {
+                        if (lck.l_type != F_UNLCK)
+                            PANIC_EXIT("conflict reported on a free segment");
+                    } else if (lck.l_type != expected->type
+                            || lck.l_start != expected->start
+                            || lck.l_len != expected->len)
+                        PANIC_EXIT("wrong conflicting lock reported");
+                }
+            }
+        }
+        printf("CHILD: %ld probes answered correctly\n", nb_probes);
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places a write lock on [0; 10[ then creates a child
+ * process which opens the file on its own, places a write lock on [20; 30[ and
+ * waits with F_SETLKW for a write lock on [0; 10[. The parent then asks with
+ * F_SETLKW for a write lock on [20; 30[, which would make both processes wait
+ * for each other forever: its request must fail with EDEADLK while the child
+ * keeps waiting. The child gets its lock once the parent unlocks [0; 10[.
+ */
+
+int main() {
+#define FILENAME "/tmp/test-deadlock.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Placed write lock on [0; 10[\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        struct flock lck2;
+        lck2.l_type = F_WRLCK;
+        lck2.l_whence = SEEK_SET;
+        lck2.l_start = 20;
+        lck2.l_len = 10;
+
+        if (rl_fcntl(lfd2, F_SETLK, &lck2) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        printf("CHILD: Placed write lock on [20; 30[\n");
+        fflush(stdout);
+
+        lck2.l_start = 0;
+        if (rl_fcntl(lfd2, F_SETLKW, &lck2) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        printf("CHILD: Got write lock on [0; 10[\n");
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    usleep(500000);
+
+    lck.l_start = 20;
+    if (rl_fcntl(lfd, F_SETLKW, &lck) == 0 || errno != EDEADLK)
+        PANIC_EXIT("deadlock not detected");
+
+    printf("PARENT: Write lock on [20; 30[ refused with EDEADLK\n");
+    fflush(stdout);
+
+    lck.l_type = F_UNLCK;
+    lck.l_start = 0;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
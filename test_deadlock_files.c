@@ -0,0 +1,105 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process opens two files and places a write lock on [0; 10[ of
+ * the first one, then creates a child process which opens both files on its
+ * own, places a write lock on [0; 10[ of the second file and waits with
+ * F_SETLKW for a write lock on [0; 10[ of the first one. The parent then asks
+ * with F_SETLKW for a write lock on [0; 10[ of the second file, which would
+ * make both processes wait for each other forever although neither file alone
+ * has a cycle: its request must fail with EDEADLK while the child keeps
+ * waiting. The child gets its lock once the parent unlocks the first file.
+ */
+
+static int lock(rl_descriptor lfd, int cmd, short type) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+    return rl_fcntl(lfd, cmd, &lck);
+}
+
+int main() {
+#define FILENAME1 "/tmp/test-deadlock-files-1.txt"
+#define FILENAME2 "/tmp/test-deadlock-files-2.txt"
+    rl_init_library();
+
+    rl_descriptor lfd1 = rl_open(FILENAME1, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd1.fd < 0 || lfd1.file == NULL)
+        PANIC_EXIT("rl_open()");
+    rl_descriptor lfd2 = rl_open(FILENAME2, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd2.fd < 0 || lfd2.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    if (lock(lfd1, F_SETLK, F_WRLCK) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Placed write lock on [0; 10[ of the first file\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor child1 = rl_open(FILENAME1, O_RDWR);
+        if (child1.fd < 0 || child1.file == NULL)
+            PANIC_EXIT("rl_open()");
+        rl_descriptor child2 = rl_open(FILENAME2, O_RDWR);
+        if (child2.fd < 0 || child2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        if (lock(child2, F_SETLK, F_WRLCK) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        printf("CHILD: Placed write lock on [0; 10[ of the second file\n");
+        fflush(stdout);
+
+        if (lock(child1, F_SETLKW, F_WRLCK) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        printf("CHILD: Got write lock on [0; 10[ of the first file\n");
+
+        if (rl_close(child1) < 0 || rl_close(child2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    usleep(500000);
+
+    if (lock(lfd2, F_SETLKW, F_WRLCK) == 0 || errno != EDEADLK)
+        PANIC_EXIT("deadlock across files not detected");
+
+    printf("PARENT: Write lock on [0; 10[ of the second file refused with "
+            "EDEADLK\n");
+    fflush(stdout);
+
+    if (lock(lfd1, F_SETLK, F_UNLCK) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (lock(lfd2, F_SETLK, F_WRLCK) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    if (rl_close(lfd1) < 0 || rl_close(lfd2) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME1) < 0 || unlink(FILENAME2) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process write-locks [0; 10[ on a file without any lock, which is
+ * done through the fast path and leaves the lock table empty, then unlocks it
+ * the same way. It locks the segment again and a first child probes [5; 6[
+ * with F_GETLK, which moves the lock to the table, is refused a write lock on
+ * it, and exits. Once the parent has unlocked, the fast path must be open
+ * again. A second child then takes a lock through the fast path and exits
+ * without releasing it, and the parent must still be granted a conflicting
+ * lock.
+ */
+
+static int lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+static int fast_state(rl_open_file *file) {
+    return atomic_load(&file->fast_lock) & ((1 << RL_FAST_STATE_BITS) - 1);
+}
+
+static void run_child(const char *filename, void (*body)(rl_descriptor)) {
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd = rl_open(filename, O_RDWR);
+        if (lfd.fd < 0 || lfd.file == NULL)
+            PANIC_EXIT("rl_open()");
+        body(lfd);
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+}
+
+static void probe(rl_descriptor lfd) {
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 5;
+    lck.l_len = 1;
+    if (rl_fcntl(lfd, F_GETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lck.l_type != F_WRLCK || lck.l_start != 0 || lck.l_len != 10
+            || lck.l_pid != getppid())
+        PANIC_EXIT("lock taken through the fast path not reported");
+    if (fast_state(lfd.file) != RL_FAST_CLOSED || lfd.file->nb_locks != 1)
+        PANIC_EXIT("lock not moved to the table");
+
+    if (lock(lfd, F_WRLCK, 5, 1) == 0 || errno != EAGAIN)
+        PANIC_EXIT("conflicting lock granted");
+    printf("CHILD: Lock of the parent found in the table\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+}
+
+static void die_holding(rl_descriptor lfd) {
+    if (lock(lfd, F_WRLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (fast_state(lfd.file) != RL_FAST_HELD)
+        PANIC_EXIT("fast path not taken");
+    printf("CHILD: Exiting with a lock on the whole file\n");
+}
+
+int main() {
+#define FILENAME "/tmp/test-fast-path.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    if (lock(lfd, F_WRLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (fast_state(lfd.file) != RL_FAST_HELD || lfd.file->nb_locks != 0)
+        PANIC_EXIT("fast path not taken");
+    if (lock(lfd, F_UNLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (fast_state(lfd.file) != RL_FAST_OPEN)
+        PANIC_EXIT("fast path not released");
+    printf("PARENT: Locked and unlocked [0; 10[ through the fast path\n");
+    fflush(stdout);
+
+    if (lock(lfd, F_WRLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    run_child(FILENAME, probe);
+
+    if (lock(lfd, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0 || fast_state(lfd.file) != RL_FAST_OPEN)
+        PANIC_EXIT("fast path not reopened");
+    printf("PARENT: Fast path reopened after unlocking\n");
+    fflush(stdout);
+
+    run_child(FILENAME, die_holding);
+    if (lock(lfd, F_WRLCK, 3, 4) < 0)
+        PANIC_EXIT("lock of a dead process not removed");
+    if (lfd.file->nb_locks != 1)
+        PANIC_EXIT("unexpected number of locks");
+    printf("PARENT: Lock of the dead child removed\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places a write lock on [0; 10[ and a read lock on
+ * [20; 30[, then creates a child process which opens the file on its own and
+ * asks with F_GETLK who prevents it from locking various segments. The parent
+ * then repeatedly extends its write lock to [0; 20[ and shrinks it back, which
+ * makes the lock table go through states where [0; 10[ is not locked at all
+ * while the locks are merged and split. Meanwhile, the child keeps on probing
+ * [0; 5[ with F_GETLK, which must always report the write lock of the parent.
+ */
+
+#define NB_PROBES 20000
+
+static void probe(rl_descriptor lfd, short type, off_t start, off_t len,
+        struct flock *res) {
+    res->l_type = type;
+    res->l_whence = SEEK_SET;
+    res->l_start = start;
+    res->l_len = len;
+    if (rl_fcntl(lfd, F_GETLK, res) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-getlk.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    lck.l_type = F_RDLCK;
+    lck.l_start = 20;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    struct flock res;
+    probe(lfd, F_WRLCK, 0, 30, &res);
+    if (res.l_type != F_UNLCK)
+        PANIC_EXIT("own locks reported as conflicting");
+
+    printf("PARENT: Placed write lock on [0; 10[ and read lock on [20; 30[\n");
+    fflush(stdout);
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) < 0)
+        PANIC_EXIT("sigprocmask()");
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        probe(lfd2, F_RDLCK, 5, 10, &res);
+        if (res.l_type != F_WRLCK || res.l_start != 0 || res.l_len != 10
+                || res.l_pid != parent)
+            PANIC_EXIT("write lock on [0; 10[ not reported");
+        printf("CHILD: Read lock on [5; 15[ blocked by a write lock on "
+                "[%ld; %ld[\n", (long) res.l_start,
+                (long) (res.l_start + res.l_len));
+
+        probe(lfd2, F_RDLCK, 20, 0, &res);
+        if (res.l_type != F_UNLCK)
+            PANIC_EXIT("compatible read lock reported as conflicting");
+        printf("CHILD: Read lock on [20; +inf[ not blocked\n");
+
+        probe(lfd2, F_WRLCK, 15, 0, &res);
+        if (res.l_type != F_RDLCK || res.l_start != 20 || res.l_len != 10
+                || res.l_pid != parent)
+            PANIC_EXIT("read lock on [20; 30[ not reported");
+        printf("CHILD: Write lock on [15; +inf[ blocked by a read lock on "
+                "[%ld; %ld[\n", (long) res.l_start,
+                (long) (res.l_start + res.l_len));
+        fflush(stdout);
+
+        if (kill(parent, SIGUSR1) < 0)
+            PANIC_EXIT("kill()");
+
+        for (int i = 0; i < NB_PROBES; i++) {
+            probe(lfd2, F_WRLCK, 0, 5, &res);
+            if (res.l_type != F_WRLCK || res.l_start != 0
+                    || (res.l_len != 10 && res.l_len != 20))
+                PANIC_EXIT("inconsistent lock table read");
+        }
+        printf("CHILD: %d probes of [0; 5[ consistent\n", NB_PROBES);
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int sig;
+    if (sigwait(&set, &sig) != 0)
+        PANIC_EXIT("sigwait()");
+
+    int status;
+    lck.l_start = 10;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        lck.l_type = F_WRLCK;
+        if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        lck.l_type = F_UNLCK;
+        if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places NB_LOCKS write locks on [2 * i; 2 * i + 1[, far
+ * more than the initial capacity of the lock table, which must grow to hold
+ * them. A child process then opens the file on its own and must be refused a
+ * write lock on each locked byte, and be granted one on each byte between two
+ * locks, which makes the table grow once more. The parent then unlocks
+ * everything at once, and places its locks again, which must reuse the freed
+ * slots of the table instead of making it grow.
+ */
+
+#define NB_LOCKS 500
+
+static int lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+int main() {
+#define FILENAME "/tmp/test-many-locks.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    for (int i = 0; i < NB_LOCKS; i++) {
+        if (lock(lfd, F_WRLCK, 2 * i, 1) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    if (lfd.file->nb_locks != NB_LOCKS || lfd.file->lock_capacity < NB_LOCKS)
+        PANIC_EXIT("lock table did not grow");
+    printf("PARENT: Placed %d write locks\n", NB_LOCKS);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        for (int i = 0; i < NB_LOCKS; i++) {
+            if (lock(lfd2, F_WRLCK, 2 * i, 1) == 0 || errno != EAGAIN)
+                PANIC_EXIT("conflicting lock granted");
+            if (lock(lfd2, F_WRLCK, 2 * i + 1, 1) < 0)
+                PANIC_EXIT("rl_fcntl()");
+        }
+        if (lfd2.file->nb_locks != 2 * NB_LOCKS)
+            PANIC_EXIT("unexpected number of locks");
+        printf("CHILD: Placed %d write locks between those of the parent\n",
+                NB_LOCKS);
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (lock(lfd, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0)
+        PANIC_EXIT("locks left after unlocking the whole file");
+    printf("PARENT: Unlocked the whole file\n");
+
+    int capacity = lfd.file->lock_capacity;
+    for (int i = 0; i < NB_LOCKS; i++) {
+        if (lock(lfd, F_WRLCK, 2 * i, 1) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    if (lfd.file->nb_locks != NB_LOCKS || lfd.file->lock_capacity != capacity)
+        PANIC_EXIT("freed slots not reused");
+    printf("PARENT: Placed %d write locks again in the freed slots\n",
+            NB_LOCKS);
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
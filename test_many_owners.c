@@ -0,0 +1,101 @@
+#include <stdio.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The process places a read lock on [0; 10[ and calls rl_dup() NB_DUPS times
+ * on the rl_descriptor, which gives the lock far more owners than the initial
+ * capacity of the owner pool, which must grow to hold them. It then unlocks
+ * [4; 5[ for the first rl_descriptor only, which removes it from the owners of
+ * [0; 10[ and gives it two new locks on [0; 4[ and [5; 10[. The duplicates are
+ * then closed one by one, F_GETLK through another token showing the lock on
+ * [0; 10[ until the last one is closed, and only the two locks of the first
+ * rl_descriptor afterwards.
+ */
+
+#define NB_DUPS 100
+
+static void getlk(rl_descriptor lfd, off_t start, off_t len,
+        struct flock *lck) {
+    lck->l_type = F_WRLCK;
+    lck->l_whence = SEEK_SET;
+    lck->l_start = start;
+    lck->l_len = len;
+    if (rl_fcntl(lfd, F_GETLK, lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-many-owners.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_RDLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    rl_descriptor dups[NB_DUPS];
+    for (int i = 0; i < NB_DUPS; i++) {
+        dups[i] = rl_dup(lfd);
+        if (dups[i].fd < 0)
+            PANIC_EXIT("rl_dup()");
+    }
+    rl_descriptor other = rl_bind_owner(lfd, 1);
+    struct flock found;
+    getlk(other, 0, 0, &found);
+    if (lfd.file->nb_locks != 1 || found.l_type != F_RDLCK
+            || found.l_start != 0 || found.l_len != 10)
+        PANIC_EXIT("owners missing after rl_dup()");
+    printf("Read lock on [0; 10[ shared by %d owners\n", NB_DUPS + 1);
+
+    lck.l_type = F_UNLCK;
+    lck.l_start = 4;
+    lck.l_len = 1;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 3)
+        PANIC_EXIT("read lock not split");
+    getlk(lfd, 4, 1, &found);
+    if (found.l_type != F_RDLCK || found.l_start != 0 || found.l_len != 10)
+        PANIC_EXIT("unexpected owners after split");
+    printf("First rl_descriptor left [0; 10[ for [0; 4[ and [5; 10[\n");
+
+    for (int i = 0; i < NB_DUPS; i++) {
+        getlk(lfd, 4, 1, &found);
+        if (found.l_type != F_RDLCK || found.l_len != 10)
+            PANIC_EXIT("lock on [0; 10[ removed before its last owner");
+        if (rl_close(dups[i]) < 0)
+            PANIC_EXIT("rl_close()");
+    }
+    if (lfd.file->nb_locks != 2)
+        PANIC_EXIT("lock without owner left");
+    getlk(lfd, 0, 0, &found);
+    if (found.l_type != F_UNLCK)
+        PANIC_EXIT("duplicate still owning a lock");
+    getlk(other, 0, 0, &found);
+    if (found.l_type != F_RDLCK || found.l_start != 0 || found.l_len != 4)
+        PANIC_EXIT("lock of the first rl_descriptor removed");
+    getlk(other, 4, 0, &found);
+    if (found.l_type != F_RDLCK || found.l_start != 5 || found.l_len != 5)
+        PANIC_EXIT("lock of the first rl_descriptor removed");
+    printf("Duplicates closed, one owner left\n");
+
+    if (rl_print_open_file_safe(lfd.file, 0) < 0)
+        PANIC_EXIT("rl_print_open_file_safe()");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
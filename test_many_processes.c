@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process opens the file and creates NB_CHILDREN child processes,
+ * more than the PID map can hold at first, which must be rehashed into a larger
+ * one. Each child opens the file twice, the second attach being done without
+ * the mutex of the file, and tells the parent through a pipe. Once every child
+ * is attached, the parent checks the PID map and closes the pipe, upon which
+ * every child closes its two descriptors and exits. The PID map must then only
+ * contain the parent.
+ */
+
+#define NB_CHILDREN 250
+
+int main() {
+#define FILENAME "/tmp/test-many-processes.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    int ready[2], release[2];
+    if (pipe(ready) < 0 || pipe(release) < 0)
+        PANIC_EXIT("pipe()");
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PANIC_EXIT("fork()");
+
+        if (pid == 0) {
+            close(ready[0]);
+            close(release[1]);
+            rl_init_library();
+            rl_descriptor lfd1 = rl_open(FILENAME, O_RDWR);
+            if (lfd1.fd < 0 || lfd1.file == NULL)
+                PANIC_EXIT("rl_open()");
+            rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+            if (lfd2.fd < 0 || lfd2.file == NULL)
+                PANIC_EXIT("rl_open()");
+
+            char c = 0;
+            if (write(ready[1], &c, 1) != 1)
+                PANIC_EXIT("write()");
+            if (read(release[0], &c, 1) != 0)
+                PANIC_EXIT("read()");
+
+            if (rl_close(lfd1) < 0 || rl_close(lfd2) < 0)
+                PANIC_EXIT("rl_close()");
+            exit(0);
+        }
+    }
+    close(ready[1]);
+    close(release[0]);
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        char c;
+        if (read(ready[0], &c, 1) != 1)
+            PANIC_EXIT("read()");
+    }
+    if (lfd.file->nb_map_entries != NB_CHILDREN + 1
+            || lfd.file->map_capacity <= RL_INITIAL_MAP_ENTRIES)
+        PANIC_EXIT("unexpected PID map");
+    printf("PARENT: %d processes attached to the file\n", NB_CHILDREN + 1);
+
+    close(release[1]);
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        int status;
+        if (wait(&status) < 0)
+            PANIC_EXIT("wait()");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            PANIC_EXIT("child failed");
+    }
+    if (lfd.file->nb_map_entries != 1)
+        PANIC_EXIT("entries left in the PID map");
+    printf("PARENT: Every child detached from the file\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
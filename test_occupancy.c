@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places a write lock on [0; 10[, a read lock on
+ * [BUCKET; BUCKET + 10[ and an extensible read lock starting at WIDE, which
+ * must be counted in the occupancy summary of the file. A child process then
+ * opens the file on its own: it is granted a read lock on [100; 110[ and a
+ * write lock on [WRAP; WRAP + 10[, which falls in the same bucket as [0; 10[,
+ * is refused a write lock on [BUCKET + 5; BUCKET + 15[ and granted a read lock
+ * on it. Once the parent has unlocked the whole file and the child has closed
+ * it, the summary must be empty.
+ */
+
+#define BUCKET RL_OCCUPANCY_BUCKET_SIZE
+#define WRAP (RL_OCCUPANCY_BUCKET_SIZE * RL_NB_OCCUPANCY_BUCKETS)
+#define WIDE (2 * WRAP)
+
+static int lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+static int is_empty(rl_occupancy *occupancy) {
+    for (int i = 0; i < RL_NB_OCCUPANCY_BUCKETS; i++) {
+        if (occupancy->nb_readers[i] != 0 || occupancy->nb_writers[i] != 0)
+            return 0;
+    }
+    return occupancy->nb_wide_readers == 0 && occupancy->nb_wide_writers == 0;
+}
+
+int main() {
+#define FILENAME "/tmp/test-occupancy.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    if (lock(lfd, F_WRLCK, 0, 10) < 0 || lock(lfd, F_RDLCK, BUCKET, 10) < 0
+            || lock(lfd, F_RDLCK, WIDE, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    rl_occupancy *occupancy = &lfd.file->occupancy;
+    if (occupancy->nb_writers[0] != 1 || occupancy->nb_readers[1] != 1
+            || occupancy->nb_wide_readers != 1)
+        PANIC_EXIT("locks missing from the occupancy summary");
+    printf("PARENT: Locks counted in the occupancy summary\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        if (lock(lfd2, F_RDLCK, 100, 10) < 0)
+            PANIC_EXIT("read lock refused on a free segment");
+        if (lock(lfd2, F_WRLCK, WRAP, 10) < 0)
+            PANIC_EXIT("write lock refused on a free segment");
+        if (lock(lfd2, F_WRLCK, BUCKET + 5, 10) == 0 || errno != EAGAIN)
+            PANIC_EXIT("conflicting write lock granted");
+        if (lock(lfd2, F_RDLCK, BUCKET + 5, 10) < 0)
+            PANIC_EXIT("read lock refused on a read-locked segment");
+        printf("CHILD: Requests answered as without the summary\n");
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (lock(lfd, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0 || !is_empty(occupancy))
+        PANIC_EXIT("locks left in the occupancy summary");
+    printf("PARENT: Occupancy summary empty after unlocking the whole file\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
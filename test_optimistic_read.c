@@ -0,0 +1,121 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process first checks the optimistic read stamps on [0; 10[: a
+ * write lock on a far segment does not invalidate them, a write lock on
+ * [0; 10[ prevents getting one and invalidates the previous ones.
+ *
+ * It then creates a child process which repeatedly takes a write lock on
+ * [0; 10[ and overwrites the segment one byte at a time with the same letter,
+ * going from 'A' to 'Z', pausing for a millisecond between two rounds.
+ * Meanwhile, the parent reads the segment optimistically without ever locking
+ * it, and every read that validates must contain ten times the same letter.
+ */
+
+#define LEN 10
+#define NB_ROUNDS 200
+
+static void lock(rl_descriptor lfd, short type, off_t start) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = LEN;
+    if (rl_fcntl(lfd, F_SETLKW, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-optimistic-read.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+    if (write(lfd.fd, "AAAAAAAAAA", LEN) != LEN)
+        PANIC_EXIT("write()");
+
+    unsigned long stamp = rl_read_begin(lfd, 0, LEN);
+    if (stamp == 0)
+        PANIC_EXIT("rl_read_begin()");
+
+    lock(lfd, F_WRLCK, 20000);
+    lock(lfd, F_UNLCK, 20000);
+    if (!rl_read_validate(lfd, 0, LEN, stamp))
+        PANIC_EXIT("far write lock invalidated the read");
+    printf("PARENT: Write lock on a far segment kept the read valid\n");
+
+    lock(lfd, F_WRLCK, 0);
+    if (rl_read_begin(lfd, 0, LEN) != 0)
+        PANIC_EXIT("stamp given on a write-locked segment");
+    lock(lfd, F_UNLCK, 0);
+    if (rl_read_validate(lfd, 0, LEN, stamp))
+        PANIC_EXIT("write lock did not invalidate the read");
+    printf("PARENT: Write lock on [0; 10[ invalidated the read\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        for (int i = 0; i < NB_ROUNDS; i++) {
+            char c = 'A' + i % 26;
+            lock(lfd2, F_WRLCK, 0);
+            for (int j = 0; j < LEN; j++) {
+                if (pwrite(lfd2.fd, &c, 1, j) != 1)
+                    PANIC_EXIT("pwrite()");
+            }
+            lock(lfd2, F_UNLCK, 0);
+            usleep(1000);
+        }
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int status;
+    long nb_valid = 0, nb_invalid = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        char buf[LEN];
+        stamp = rl_read_begin(lfd, 0, LEN);
+        if (pread(lfd.fd, buf, LEN, 0) != LEN)
+            PANIC_EXIT("pread()");
+        if (!rl_read_validate(lfd, 0, LEN, stamp)) {
+            nb_invalid++;
+            continue;
+        }
+        nb_valid++;
+        for (int j = 1; j < LEN; j++) {
+            if (buf[j] != buf[0])
+                PANIC_EXIT("validated read is torn");
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+    if (nb_valid == 0)
+        PANIC_EXIT("no read validated");
+    printf("PARENT: Every validated read was consistent\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places write locks on [10 * i; 10 * i + 5[ for i from 0
+ * to 9 in a shuffled order, and an extensible read lock starting at 200. Probing
+ * the file from each lock to its end with F_GETLK through another token must
+ * report that lock first, the extensible lock coming last. A child process then
+ * probes every offset from 0 to 210 with F_GETLK and must find the lock
+ * covering it, if any. The parent then fills the gaps between its write locks,
+ * which must all merge into a single lock on [0; 100[, and unlocks [50; 60[,
+ * which must split it again.
+ */
+
+#define NB_LOCKS 10
+
+static void lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+static int first_lock(rl_descriptor lfd, off_t start, short type,
+        off_t lock_start, off_t lock_len) {
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = 0;
+    if (rl_fcntl(lfd, F_GETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    return lck.l_type == type && lck.l_start == lock_start
+        && lck.l_len == lock_len;
+}
+
+int main() {
+#define FILENAME "/tmp/test-ordered-locks.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    lock(lfd, F_RDLCK, 200, 0);
+    int order[NB_LOCKS] = {7, 2, 9, 0, 5, 3, 8, 1, 6, 4};
+    for (int i = 0; i < NB_LOCKS; i++)
+        lock(lfd, F_WRLCK, 10 * order[i], 5);
+
+    if (lfd.file->nb_locks != NB_LOCKS + 1)
+        PANIC_EXIT("unexpected number of locks");
+    rl_descriptor other = rl_bind_owner(lfd, 1);
+    for (int i = 0; i < NB_LOCKS; i++) {
+        if (!first_lock(other, 10 * i, F_WRLCK, 10 * i, 5))
+            PANIC_EXIT("lock table not sorted");
+    }
+    if (!first_lock(other, 100, F_RDLCK, 200, 0))
+        PANIC_EXIT("extensible lock not last");
+    printf("PARENT: Placed %d locks, lock table sorted\n", NB_LOCKS + 1);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        for (off_t x = 0; x <= 210; x++) {
+            struct flock lck;
+            lck.l_type = F_WRLCK;
+            lck.l_whence = SEEK_SET;
+            lck.l_start = x;
+            lck.l_len = 1;
+            if (rl_fcntl(lfd2, F_GETLK, &lck) < 0)
+                PANIC_EXIT("rl_fcntl()");
+
+            if (x < 100 && x % 10 < 5) {
+                if (lck.l_type != F_WRLCK || lck.l_start != x - x % 10
+                        || lck.l_len != 5)
+                    PANIC_EXIT("write lock not found");
+            } else if (x >= 200) {
+                if (lck.l_type != F_RDLCK || lck.l_start != 200
+                        || lck.l_len != 0)
+                    PANIC_EXIT("extensible lock not found");
+            } else if (lck.l_type != F_UNLCK)
+                PANIC_EXIT("unlocked offset reported as locked");
+        }
+        printf("CHILD: Every offset from 0 to 210 probed correctly\n");
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    for (int i = 0; i < NB_LOCKS; i++)
+        lock(lfd, F_WRLCK, 10 * order[i] + 5, 5);
+    if (lfd.file->nb_locks != 2 || !first_lock(other, 0, F_WRLCK, 0, 100))
+        PANIC_EXIT("write locks not merged");
+    printf("PARENT: Write locks merged into [0; 100[\n");
+
+    lock(lfd, F_UNLCK, 50, 10);
+    if (lfd.file->nb_locks != 3 || !first_lock(other, 0, F_WRLCK, 0, 50)
+            || !first_lock(other, 50, F_WRLCK, 60, 40))
+        PANIC_EXIT("write lock not split");
+    printf("PARENT: Write lock split around [50; 60[\n");
+
+    if (rl_print_open_file_safe(lfd.file, 0) < 0)
+        PANIC_EXIT("rl_print_open_file_safe()");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
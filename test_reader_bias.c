@@ -0,0 +1,215 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process biases the file towards readers and read-locks [0; 100[,
+ * followed by NB_CHILDREN child processes, which must all be announced in the
+ * reader slots and leave the lock table empty. A child probing [50; 51[ for a
+ * read lock with F_GETLK must find no conflict. Another child opens the file,
+ * read-locks it through its descriptor and through two copies bound to tokens
+ * of their own, and closes the descriptor, which must remove the three read
+ * locks from the slots but keep the bias and the other read locks in their
+ * slots. The parent is then refused a write lock on [50; 51[,
+ * which revokes the bias and moves every read lock to the table as a single
+ * lock shared by every reader. Once the children have unlocked and closed the
+ * file, the parent unlocks and gets its write lock. The bias is restored when
+ * the write lock is released, and a new read lock is announced in a slot
+ * again.
+ */
+
+#define NB_CHILDREN 20
+
+static int lock(rl_descriptor lfd, int cmd, short type, off_t start,
+        off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, cmd, &lck);
+}
+
+static int nb_announced(rl_open_file *file, pid_t pid) {
+    int nb = 0;
+    for (int i = 0; i < RL_NB_READER_SLOTS; i++) {
+        uint64_t word = atomic_load(&file->reader_slots[i].word);
+        if ((word & ((1 << RL_FAST_STATE_BITS) - 1)) == RL_FAST_HELD
+                && (pid_t) (word >> RL_FAST_STATE_BITS) == pid)
+            nb++;
+    }
+    return nb;
+}
+
+int main() {
+#define FILENAME "/tmp/test-reader-bias.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+    if (rl_set_reader_bias(lfd, 1) < 0)
+        PANIC_EXIT("rl_set_reader_bias()");
+    if (lock(lfd, F_SETLK, F_RDLCK, 0, 100) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    int ready[2], release[2];
+    if (pipe(ready) < 0 || pipe(release) < 0)
+        PANIC_EXIT("pipe()");
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PANIC_EXIT("fork()");
+
+        if (pid == 0) {
+            close(ready[0]);
+            close(release[1]);
+            rl_init_library();
+            rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+            if (lfd2.fd < 0 || lfd2.file == NULL)
+                PANIC_EXIT("rl_open()");
+            if (lock(lfd2, F_SETLK, F_RDLCK, 0, 100) < 0)
+                PANIC_EXIT("rl_fcntl()");
+
+            char c = 0;
+            if (write(ready[1], &c, 1) != 1)
+                PANIC_EXIT("write()");
+            if (read(release[0], &c, 1) != 0)
+                PANIC_EXIT("read()");
+
+            if (lock(lfd2, F_SETLK, F_UNLCK, 0, 100) < 0)
+                PANIC_EXIT("rl_fcntl()");
+            if (rl_close(lfd2) < 0)
+                PANIC_EXIT("rl_close()");
+            exit(0);
+        }
+    }
+    close(ready[1]);
+    close(release[0]);
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        char c;
+        if (read(ready[0], &c, 1) != 1)
+            PANIC_EXIT("read()");
+    }
+    if (lfd.file->nb_locks != 0 || !atomic_load(&lfd.file->biased))
+        PANIC_EXIT("read locks not announced in the reader slots");
+    printf("PARENT: %d read locks announced without the lock table\n",
+            NB_CHILDREN + 1);
+
+    struct flock probe;
+    probe.l_type = F_RDLCK;
+    probe.l_whence = SEEK_SET;
+    probe.l_start = 50;
+    probe.l_len = 1;
+    if (rl_fcntl(lfd, F_GETLK, &probe) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (probe.l_type != F_UNLCK || lfd.file->nb_locks != 0)
+        PANIC_EXIT("read probe conflicting with the readers");
+
+    int closed[2], done[2];
+    if (pipe(closed) < 0 || pipe(done) < 0)
+        PANIC_EXIT("pipe()");
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+    if (pid == 0) {
+        close(closed[0]);
+        close(done[1]);
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+        rl_descriptor bound1 = rl_bind_owner(lfd2, 1);
+        rl_descriptor bound2 = rl_bind_owner(lfd2, 2);
+        if (lock(lfd2, F_SETLK, F_RDLCK, 0, 100) < 0
+                || lock(bound1, F_SETLK, F_RDLCK, 0, 100) < 0
+                || lock(bound2, F_SETLK, F_RDLCK, 0, 100) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        if (nb_announced(lfd2.file, getpid()) != 3)
+            PANIC_EXIT("read locks of the tokens not announced");
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+
+        char c = 0;
+        if (write(closed[1], &c, 1) != 1)
+            PANIC_EXIT("write()");
+        if (read(done[0], &c, 1) != 0)
+            PANIC_EXIT("read()");
+        exit(0);
+    }
+    close(closed[1]);
+    close(done[0]);
+    char c;
+    if (read(closed[0], &c, 1) != 1)
+        PANIC_EXIT("read()");
+    if (nb_announced(lfd.file, pid) != 0)
+        PANIC_EXIT("read locks of the tokens left after the close");
+    close(done[1]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+    if (lfd.file->nb_locks != 0 || !atomic_load(&lfd.file->biased))
+        PANIC_EXIT("bias revoked by a reader closing its descriptor");
+    printf("PARENT: Bias kept after a reader closed its descriptor and "
+            "tokens\n");
+
+    if (lock(lfd, F_SETLK, F_WRLCK, 50, 1) == 0 || errno != EAGAIN)
+        PANIC_EXIT("write lock granted over the readers");
+    struct flock held;
+    held.l_type = F_WRLCK;
+    held.l_whence = SEEK_SET;
+    held.l_start = 50;
+    held.l_len = 1;
+    if (rl_fcntl(lfd, F_GETLK, &held) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (atomic_load(&lfd.file->biased) || lfd.file->nb_locks != 1
+            || held.l_type != F_RDLCK || held.l_pid == getpid())
+        PANIC_EXIT("read locks not moved to the table");
+    printf("PARENT: Bias revoked, read locks moved to the table\n");
+    fflush(stdout);
+
+    close(release[1]);
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        int status;
+        if (wait(&status) < 0)
+            PANIC_EXIT("wait()");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            PANIC_EXIT("child failed");
+    }
+
+    if (lock(lfd, F_SETLK, F_UNLCK, 0, 100) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lock(lfd, F_SETLKW, F_WRLCK, 50, 1) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    printf("PARENT: Write lock on [50; 51[ granted\n");
+
+    /* outlasts the inhibition of the bias that follows the revocation */
+    usleep(10000);
+    if (lock(lfd, F_SETLK, F_UNLCK, 50, 1) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0 || !atomic_load(&lfd.file->biased))
+        PANIC_EXIT("bias not restored");
+    if (lock(lfd, F_SETLK, F_RDLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0)
+        PANIC_EXIT("read lock not announced in a reader slot");
+    printf("PARENT: Bias restored after the write lock\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process opens the file in record mode with records of
+ * RECORD_SIZE bytes and places NB_RECORDS write locks on the even records, one
+ * request each, then a read lock on record 2 * NB_RECORDS + 2. A request that
+ * is not aligned on records must be refused, as well as opening the file with
+ * another record size. A child process then opens the file with rl_open(),
+ * which keeps the record mode, and must:
+ * - be refused a write lock on each even record and granted one on each odd
+ *   record;
+ * - be refused a write lock on the records [2 * NB_RECORDS; 2 * NB_RECORDS
+ *   + 4[, after which a second descriptor of the child must see the first two
+ *   records unlocked;
+ * - be granted a read lock on record 2 * NB_RECORDS + 2;
+ * - wait for a write lock on record 0, which the parent unlocks after a second.
+ * The child dies holding its locks, which the parent reaps by locking record 0
+ * again.
+ */
+
+#define RECORD_SIZE 64
+#define NB_RECORDS 50000
+
+static int lock(rl_descriptor lfd, int cmd, short type, off_t record,
+        off_t nb_records) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = record * RECORD_SIZE;
+    lck.l_len = nb_records * RECORD_SIZE;
+    return rl_fcntl(lfd, cmd, &lck);
+}
+
+int main() {
+#define FILENAME "/tmp/test-record-locks.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open_records(FILENAME, O_CREAT | O_RDWR | O_TRUNC,
+            RECORD_SIZE, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open_records()");
+
+    for (int i = 0; i < NB_RECORDS; i++) {
+        if (lock(lfd, F_SETLK, F_WRLCK, 2 * i, 1) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    if (lock(lfd, F_SETLK, F_RDLCK, 2 * NB_RECORDS + 2, 1) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 0)
+        PANIC_EXIT("record locks put in the lock table");
+
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = RECORD_SIZE / 2;
+    lck.l_len = RECORD_SIZE;
+    if (rl_fcntl(lfd, F_SETLK, &lck) == 0 || errno != EINVAL)
+        PANIC_EXIT("unaligned request accepted");
+    rl_descriptor other = rl_open_records(FILENAME, O_RDWR, 2 * RECORD_SIZE);
+    if (other.fd != -1 || errno != EINVAL)
+        PANIC_EXIT("record size changed");
+    printf("PARENT: Locked %d records, unaligned requests refused\n",
+            NB_RECORDS);
+    fflush(stdout);
+
+    int ready[2];
+    if (pipe(ready) < 0)
+        PANIC_EXIT("pipe()");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        close(ready[0]);
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+        if (lfd2.file->record_size != RECORD_SIZE)
+            PANIC_EXIT("record mode lost");
+
+        for (int i = 0; i < NB_RECORDS; i++) {
+            if (lock(lfd2, F_SETLK, F_WRLCK, 2 * i, 1) == 0 || errno != EAGAIN)
+                PANIC_EXIT("conflicting lock granted");
+            if (lock(lfd2, F_SETLK, F_WRLCK, 2 * i + 1, 1) < 0)
+                PANIC_EXIT("rl_fcntl()");
+        }
+        printf("CHILD: Locked the %d odd records\n", NB_RECORDS);
+
+        if (lock(lfd2, F_SETLK, F_WRLCK, 2 * NB_RECORDS, 4) == 0
+                || errno != EAGAIN)
+            PANIC_EXIT("conflicting lock granted");
+        rl_descriptor lfd3 = rl_open(FILENAME, O_RDWR);
+        if (lfd3.fd < 0 || lfd3.file == NULL)
+            PANIC_EXIT("rl_open()");
+        lck.l_type = F_WRLCK;
+        lck.l_whence = SEEK_SET;
+        lck.l_start = 2 * NB_RECORDS * RECORD_SIZE;
+        lck.l_len = 2 * RECORD_SIZE;
+        if (rl_fcntl(lfd3, F_GETLK, &lck) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        if (lck.l_type != F_UNLCK)
+            PANIC_EXIT("refused request not rolled back");
+        lck.l_type = F_WRLCK;
+        lck.l_start = 0;
+        lck.l_len = RECORD_SIZE;
+        if (rl_fcntl(lfd3, F_GETLK, &lck) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        if (lck.l_type != F_WRLCK || lck.l_pid != getppid())
+            PANIC_EXIT("lock of the parent not reported");
+        printf("CHILD: Refused request rolled back\n");
+
+        if (lock(lfd2, F_SETLK, F_RDLCK, 2 * NB_RECORDS + 2, 1) < 0)
+            PANIC_EXIT("read lock refused");
+
+        char c = 0;
+        if (write(ready[1], &c, 1) != 1)
+            PANIC_EXIT("write()");
+        if (lock(lfd2, F_SETLKW, F_WRLCK, 0, 1) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        printf("CHILD: Waited for record 0 and died\n");
+        exit(0);
+    }
+    close(ready[1]);
+
+    char c;
+    if (read(ready[0], &c, 1) != 1)
+        PANIC_EXIT("read()");
+    sleep(1);
+    if (lock(lfd, F_SETLK, F_UNLCK, 0, 1) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (lock(lfd, F_SETLK, F_WRLCK, 0, 2) < 0)
+        PANIC_EXIT("locks of the dead child not reaped");
+    printf("PARENT: Locks of the dead child reaped\n");
+
+    lck.l_type = F_UNLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 0;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include <stdio.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The process opens the file in record mode and duplicates its descriptor
+ * NB_DESCRIPTORS times, twice as many as there can be owners of records. Each
+ * duplicate in turn write-locks and unlocks its own record, all of them staying
+ * open, which must succeed as an owner without locks gives its slot back. The
+ * RL_MAX_RECORD_OWNERS first duplicates then keep a lock on their record, and
+ * the next one must be refused a lock with ENOLCK, until one of the others
+ * unlocks its record.
+ */
+
+#define RECORD_SIZE 64
+#define NB_DESCRIPTORS (2 * RL_MAX_RECORD_OWNERS)
+
+static int lock(rl_descriptor lfd, short type, off_t record) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = record * RECORD_SIZE;
+    lck.l_len = RECORD_SIZE;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+int main() {
+#define FILENAME "/tmp/test-record-owners.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open_records(FILENAME, O_CREAT | O_RDWR | O_TRUNC,
+            RECORD_SIZE, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open_records()");
+
+    rl_descriptor dups[NB_DESCRIPTORS];
+    for (int i = 0; i < NB_DESCRIPTORS; i++) {
+        dups[i] = rl_dup(lfd);
+        if (dups[i].fd < 0)
+            PANIC_EXIT("rl_dup()");
+        if (lock(dups[i], F_WRLCK, i) < 0)
+            PANIC_EXIT("rl_fcntl()");
+        if (lock(dups[i], F_UNLCK, i) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    printf("%d open descriptors locked and unlocked records in turn\n",
+            NB_DESCRIPTORS);
+
+    for (int i = 0; i < RL_MAX_RECORD_OWNERS; i++) {
+        if (lock(dups[i], F_WRLCK, i) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    if (lock(dups[RL_MAX_RECORD_OWNERS], F_WRLCK, RL_MAX_RECORD_OWNERS) == 0
+            || errno != ENOLCK)
+        PANIC_EXIT("more owners of records than slots");
+    if (lock(dups[0], F_UNLCK, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lock(dups[RL_MAX_RECORD_OWNERS], F_WRLCK, RL_MAX_RECORD_OWNERS) < 0)
+        PANIC_EXIT("slot of an owner without locks not given back");
+    printf("Slot of an owner without locks given to another one\n");
+
+    for (int i = 0; i < NB_DESCRIPTORS; i++) {
+        if (rl_close(dups[i]) < 0)
+            PANIC_EXIT("rl_close()");
+    }
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process opens the file in record mode and places write locks on
+ * NB_CHILDREN records, as many as there are owner slots left. Each of
+ * NB_CHILDREN child processes then waits for a write lock on its own record.
+ * After a second, every child must be waiting on the stripe of its record and
+ * none in the wait queue of the file. The parent then unlocks the records one
+ * at a time, and every child must get its lock. No request must be left
+ * waiting on a stripe.
+ */
+
+#define RECORD_SIZE 32
+#define NB_CHILDREN (RL_MAX_RECORD_OWNERS - 1)
+
+static int lock(rl_descriptor lfd, int cmd, short type, off_t record) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = record * RECORD_SIZE;
+    lck.l_len = RECORD_SIZE;
+    return rl_fcntl(lfd, cmd, &lck);
+}
+
+int main() {
+#define FILENAME "/tmp/test-record-waiters.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open_records(FILENAME, O_CREAT | O_RDWR | O_TRUNC,
+            RECORD_SIZE, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open_records()");
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        if (lock(lfd, F_SETLK, F_WRLCK, i) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    printf("PARENT: Locked %d records\n", NB_CHILDREN);
+    fflush(stdout);
+
+    int ready[2];
+    if (pipe(ready) < 0)
+        PANIC_EXIT("pipe()");
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PANIC_EXIT("fork()");
+
+        if (pid == 0) {
+            close(ready[0]);
+            rl_init_library();
+            rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+            if (lfd2.fd < 0 || lfd2.file == NULL)
+                PANIC_EXIT("rl_open()");
+
+            char c = 0;
+            if (write(ready[1], &c, 1) != 1)
+                PANIC_EXIT("write()");
+            if (lock(lfd2, F_SETLKW, F_WRLCK, i) < 0)
+                PANIC_EXIT("rl_fcntl()");
+
+            if (rl_close(lfd2) < 0)
+                PANIC_EXIT("rl_close()");
+            exit(0);
+        }
+    }
+    close(ready[1]);
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        char c;
+        if (read(ready[0], &c, 1) != 1)
+            PANIC_EXIT("read()");
+    }
+    sleep(1);
+    int nb_waiters = 0;
+    for (int i = 0; i < RL_NB_STRIPES; i++)
+        nb_waiters += atomic_load(&lfd.file->stripes[i].nb_waiters);
+    if (nb_waiters != NB_CHILDREN || lfd.file->nb_waiters != 0)
+        PANIC_EXIT("children not waiting on the stripes");
+    printf("PARENT: %d children waiting on the stripes\n", NB_CHILDREN);
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        if (lock(lfd, F_SETLK, F_UNLCK, i) < 0)
+            PANIC_EXIT("rl_fcntl()");
+    }
+    printf("PARENT: Unlocked the records\n");
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        int status;
+        if (wait(&status) < 0)
+            PANIC_EXIT("wait()");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            PANIC_EXIT("child failed");
+    }
+    for (int i = 0; i < RL_NB_STRIPES; i++) {
+        if (atomic_load(&lfd.file->stripes[i].nb_waiters) != 0)
+            PANIC_EXIT("request left on a stripe");
+    }
+    printf("PARENT: Every child got its record\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process reserves the first HEADER_SIZE bytes of an empty file with
+ * rl_reserve_append() and keeps them locked. NB_CHILDREN child processes then
+ * append NB_ENTRIES entries of ENTRY_SIZE bytes each to the file at the same
+ * time, each entry being reserved with rl_reserve_append(), written and
+ * unlocked. Once every child is done, the parent writes its header, and the
+ * file must contain the header followed by every entry, none of them
+ * overlapping another one.
+ */
+
+#define HEADER_SIZE 10
+#define NB_CHILDREN 8
+#define NB_ENTRIES 100
+#define ENTRY_SIZE 16
+
+static void unlock(rl_descriptor lfd, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = F_UNLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-reserve-append.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    off_t header;
+    if (rl_reserve_append(lfd, HEADER_SIZE, &header) < 0)
+        PANIC_EXIT("rl_reserve_append()");
+    if (header != 0)
+        PANIC_EXIT("header not at the beginning of the file");
+    printf("PARENT: Reserved the header\n");
+    fflush(stdout);
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            PANIC_EXIT("fork()");
+
+        if (pid == 0) {
+            rl_init_library();
+            rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+            if (lfd2.fd < 0 || lfd2.file == NULL)
+                PANIC_EXIT("rl_open()");
+
+            char entry[ENTRY_SIZE];
+            memset(entry, 'a' + i, ENTRY_SIZE);
+            for (int j = 0; j < NB_ENTRIES; j++) {
+                off_t offset;
+                if (rl_reserve_append(lfd2, ENTRY_SIZE, &offset) < 0)
+                    PANIC_EXIT("rl_reserve_append()");
+                if (pwrite(lfd2.fd, entry, ENTRY_SIZE, offset) != ENTRY_SIZE)
+                    PANIC_EXIT("pwrite()");
+                unlock(lfd2, offset, ENTRY_SIZE);
+            }
+
+            if (rl_close(lfd2) < 0)
+                PANIC_EXIT("rl_close()");
+            exit(0);
+        }
+    }
+
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        int status;
+        if (wait(&status) < 0)
+            PANIC_EXIT("wait()");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            PANIC_EXIT("child failed");
+    }
+    printf("PARENT: %d children appended %d entries each\n", NB_CHILDREN,
+            NB_ENTRIES);
+
+    char buffer[HEADER_SIZE + NB_CHILDREN * NB_ENTRIES * ENTRY_SIZE + 1];
+    memset(buffer, 'H', HEADER_SIZE);
+    if (pwrite(lfd.fd, buffer, HEADER_SIZE, header) != HEADER_SIZE)
+        PANIC_EXIT("pwrite()");
+    unlock(lfd, header, HEADER_SIZE);
+
+    if (pread(lfd.fd, buffer, sizeof(buffer), 0) != sizeof(buffer) - 1)
+        PANIC_EXIT("unexpected file size");
+    int counts[NB_CHILDREN] = {0};
+    for (int i = 0; i < NB_CHILDREN * NB_ENTRIES; i++) {
+        char *entry = buffer + HEADER_SIZE + i * ENTRY_SIZE;
+        if (entry[0] < 'a' || entry[0] >= 'a' + NB_CHILDREN)
+            PANIC_EXIT("entry overwritten");
+        for (int j = 1; j < ENTRY_SIZE; j++) {
+            if (entry[j] != entry[0])
+                PANIC_EXIT("entries overlap");
+        }
+        counts[entry[0] - 'a']++;
+    }
+    for (int i = 0; i < NB_CHILDREN; i++) {
+        if (counts[i] != NB_ENTRIES)
+            PANIC_EXIT("entry lost");
+    }
+    printf("PARENT: Header and entries written without overlapping\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
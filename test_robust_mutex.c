@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process read-locks [0; 10[ and creates a child that write-locks
+ * [20; 30[, then takes the mutex of the file and starts a modification of the
+ * lock table, and exits without finishing it nor releasing the mutex. The
+ * parent must then take the mutex again, find its own lock still there, and be
+ * granted a write lock on [20; 30[ as the lock of the dead child was removed.
+ */
+
+static int lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+int main() {
+#define FILENAME "/tmp/test-robust-mutex.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+    if (lock(lfd, F_RDLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+        if (lock(lfd2, F_WRLCK, 20, 10) < 0)
+            PANIC_EXIT("rl_fcntl()");
+
+        if (pthread_mutex_lock(&lfd2.file->mutex) != 0)
+            PANIC_EXIT("pthread_mutex_lock()");
+        atomic_fetch_add(&lfd2.file->seq, 1);
+        lfd2.file->update_depth++;
+        printf("CHILD: Exiting in the middle of a modification\n");
+        exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (lock(lfd, F_WRLCK, 20, 10) < 0)
+        PANIC_EXIT("lock of the dead child not removed");
+    if (atomic_load(&lfd.file->seq) & 1)
+        PANIC_EXIT("modification of the dead child not ended");
+    struct flock lck;
+    lck.l_type = F_WRLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 0;
+    if (rl_fcntl(rl_bind_owner(lfd, 1), F_GETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 2 || lck.l_type != F_RDLCK || lck.l_start != 0
+            || lck.l_len != 10)
+        PANIC_EXIT("locks not repaired");
+    printf("PARENT: Mutex recovered from the dead child\n");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+#define _XOPEN_SOURCE 500
+#include <stdio.h>
+#include <pthread.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The process binds two copies of its descriptor to the tokens 1 and 2, which
+ * must be distinct owners: the second is refused a write lock on a segment
+ * locked by the first until the first unlocks it. NB_THREADS threads then each
+ * open a file of their own at the same time, and bind the shared descriptor to
+ * a token of their own. Each thread takes a write lock on a counter stored in
+ * the shared file with F_SETLK until it gets it, increments the counter and
+ * unlocks it, NB_INCREMENTS times. The counter must then be
+ * NB_THREADS * NB_INCREMENTS. Last, a thread write-locks a segment through its
+ * token and ends without unlocking it: a thread started after it, whose
+ * thread-local storage may sit where the first one's did, must get a token of
+ * its own and be refused the segment.
+ */
+
+#define NB_THREADS 4
+#define NB_INCREMENTS 2000
+
+static rl_descriptor shared;
+
+static int lock(rl_descriptor lfd, short type, off_t start, off_t len) {
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = start;
+    lck.l_len = len;
+    return rl_fcntl(lfd, F_SETLK, &lck);
+}
+
+static void *count(void *arg) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/test-thread-owners-%d.txt",
+            *(int *) arg);
+    rl_descriptor own = rl_open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (own.fd < 0 || own.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    rl_descriptor lfd = rl_bind_owner(shared, RL_OWNER_THREAD);
+    if (lfd.fd < 0)
+        PANIC_EXIT("rl_bind_owner()");
+    for (int i = 0; i < NB_INCREMENTS; i++) {
+        int code;
+        while ((code = lock(lfd, F_WRLCK, 0, sizeof(int))) == -1
+                && errno == EAGAIN)
+            ;
+        if (code == -1)
+            PANIC_EXIT("rl_fcntl()");
+
+        int n;
+        if (pread(lfd.fd, &n, sizeof(int), 0) != sizeof(int))
+            PANIC_EXIT("pread()");
+        n++;
+        if (pwrite(lfd.fd, &n, sizeof(int), 0) != sizeof(int))
+            PANIC_EXIT("pwrite()");
+
+        if (lock(lfd, F_UNLCK, 0, sizeof(int)) == -1)
+            PANIC_EXIT("rl_fcntl()");
+    }
+
+    if (lock(own, F_WRLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (rl_close(own) < 0)
+        PANIC_EXIT("rl_close()");
+    if (unlink(path) < 0)
+        PANIC_EXIT("unlink()");
+    return NULL;
+}
+
+static void *hold(void *arg) {
+    rl_descriptor lfd = rl_bind_owner(shared, RL_OWNER_THREAD);
+    if (lfd.fd < 0)
+        PANIC_EXIT("rl_bind_owner()");
+    *(unsigned long *) arg = lfd.token;
+    if (lock(lfd, F_WRLCK, 20, 1) < 0)
+        return "lock of a new token refused";
+    return NULL;
+}
+
+static void run(void *(*routine)(void *), void *arg, void **ret) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, routine, arg) != 0)
+        PANIC_EXIT("pthread_create()");
+    if (pthread_join(thread, ret) != 0)
+        PANIC_EXIT("pthread_join()");
+}
+
+int main() {
+#define FILENAME "/tmp/test-thread-owners.txt"
+    rl_init_library();
+
+    shared = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (shared.fd < 0 || shared.file == NULL)
+        PANIC_EXIT("rl_open()");
+    int n = 0;
+    if (pwrite(shared.fd, &n, sizeof(int), 0) != sizeof(int))
+        PANIC_EXIT("pwrite()");
+
+    rl_descriptor first = rl_bind_owner(shared, 1);
+    rl_descriptor second = rl_bind_owner(shared, 2);
+    if (lock(first, F_WRLCK, 0, 10) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lock(second, F_WRLCK, 5, 1) == 0 || errno != EAGAIN)
+        PANIC_EXIT("lock of another token granted");
+    if (lock(second, F_UNLCK, 0, 0) < 0 || lock(first, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lock(second, F_WRLCK, 5, 1) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lock(second, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    printf("Tokens 1 and 2 own distinct locks\n");
+
+    pthread_t threads[NB_THREADS];
+    int ids[NB_THREADS];
+    for (int i = 0; i < NB_THREADS; i++) {
+        ids[i] = i;
+        if (pthread_create(&threads[i], NULL, count, &ids[i]) != 0)
+            PANIC_EXIT("pthread_create()");
+    }
+    for (int i = 0; i < NB_THREADS; i++) {
+        if (pthread_join(threads[i], NULL) != 0)
+            PANIC_EXIT("pthread_join()");
+    }
+
+    if (pread(shared.fd, &n, sizeof(int), 0) != sizeof(int))
+        PANIC_EXIT("pread()");
+    if (n != NB_THREADS * NB_INCREMENTS)
+        PANIC_EXIT("lost increments");
+    if (shared.file->nb_locks != 0)
+        PANIC_EXIT("locks left");
+    printf("%d threads counted to %d through one descriptor\n", NB_THREADS, n);
+
+    unsigned long tokens[2];
+    void *ret;
+    run(hold, &tokens[0], &ret);
+    if (ret != NULL)
+        PANIC_EXIT((char *) ret);
+    run(hold, &tokens[1], &ret);
+    if (tokens[0] == tokens[1] || ret == NULL)
+        PANIC_EXIT("token of an ended thread reused");
+    rl_descriptor ended = shared;
+    ended.token = tokens[0];
+    if (lock(ended, F_UNLCK, 0, 0) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    printf("Threads started one after another own distinct locks\n");
+
+    if (rl_close(shared) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
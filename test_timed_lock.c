@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * The parent process places a read lock on [0; 10[ then creates a child
+ * process which opens the file on its own. The child asks for a write lock on
+ * [0; 5[ with a deadline 300 ms away, which must fail with ETIMEDOUT after
+ * about 300 ms. It then asks again with a deadline 5 s away, and gets its lock
+ * once the parent releases its read lock, one second after the fork.
+ */
+
+static struct timespec in_ms(long ms) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_nsec += ms * 1000000L;
+    t.tv_sec += t.tv_nsec / 1000000000L;
+    t.tv_nsec %= 1000000000L;
+    return t;
+}
+
+static double elapsed_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main() {
+#define FILENAME "/tmp/test-timed-lock.txt"
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = F_RDLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Placed read lock on [0; 10[\n");
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+
+    if (pid == 0) {
+        rl_init_library();
+        rl_descriptor lfd2 = rl_open(FILENAME, O_RDWR);
+        if (lfd2.fd < 0 || lfd2.file == NULL)
+            PANIC_EXIT("rl_open()");
+
+        struct flock lck2;
+        lck2.l_type = F_WRLCK;
+        lck2.l_whence = SEEK_SET;
+        lck2.l_start = 0;
+        lck2.l_len = 5;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct timespec deadline = in_ms(300);
+        if (rl_fcntl_timed(lfd2, F_SETLKW, &lck2, &deadline) == 0
+                || errno != ETIMEDOUT)
+            PANIC_EXIT("rl_fcntl_timed()");
+
+        double waited = elapsed_since(&start);
+        if (waited < 0.25 || waited > 0.8)
+            PANIC_EXIT("rl_fcntl_timed() did not wait until the deadline");
+
+        printf("CHILD: Write lock on [0; 5[ timed out\n");
+
+        deadline = in_ms(5000);
+        if (rl_fcntl_timed(lfd2, F_SETLKW, &lck2, &deadline) < 0)
+            PANIC_EXIT("rl_fcntl_timed()");
+
+        printf("CHILD: Got write lock on [0; 5[ before the deadline\n");
+
+        if (rl_close(lfd2) < 0)
+            PANIC_EXIT("rl_close()");
+        return 0;
+    }
+
+    sleep(1);
+
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    printf("PARENT: Unlocked [0; 10[\n");
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}
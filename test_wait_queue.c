@@ -0,0 +1,174 @@
+#define _XOPEN_SOURCE 500
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "panic.h"
+#include "rl_lock_library.h"
+
+/*
+ * First scenario, with the default FIFO policy: the parent places a read lock
+ * on [0; 10[, then a writer child waits for a write lock on the same segment.
+ * A reader child arriving afterwards must not be able to take a read lock on
+ * [0; 10[ although it is compatible with the parent lock, it must wait behind
+ * the writer instead. The writer writes 'W' at offset 0 when it gets its lock,
+ * so the reader must read 'W' when it finally gets its own lock.
+ *
+ * Second scenario, with the writer-preferring policy: the parent places a write
+ * lock on [0; 10[, then a reader child waits for a read lock, then a writer
+ * child waits for a write lock. When the parent unlocks, the writer is served
+ * first although it arrived last, so the reader must read 'X', written by the
+ * writer.
+ *
+ * Third scenario, in handoff mode: the parent places a write lock on [0; 10[,
+ * then a writer child waits for a write lock on the same segment. As soon as
+ * the parent unlocks the segment, the lock table shows the child as the owner
+ * of the write lock, and the parent cannot take the lock back.
+ */
+
+#define FILENAME "/tmp/test-wait-queue.txt"
+
+static pid_t spawn(short type, char c, int try_first) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
+        PANIC_EXIT("fork()");
+    if (pid > 0)
+        return pid;
+
+    rl_init_library();
+    rl_descriptor lfd = rl_open(FILENAME, O_RDWR);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+
+    struct flock lck;
+    lck.l_type = type;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+
+    if (try_first) {
+        if (rl_fcntl(lfd, F_SETLK, &lck) == 0 || errno != EAGAIN)
+            PANIC_EXIT("request did not wait behind the queue");
+        printf("CHILD %d: Non-blocking request refused\n", (int) getpid());
+    }
+
+    if (rl_fcntl(lfd, F_SETLKW, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    if (type == F_WRLCK) {
+        if (pwrite(lfd.fd, &c, 1, 0) != 1)
+            PANIC_EXIT("pwrite()");
+        printf("CHILD %d: Wrote '%c'\n", (int) getpid(), c);
+        usleep(200000);
+    } else {
+        char r = 0;
+        if (pread(lfd.fd, &r, 1, 0) != 1)
+            PANIC_EXIT("pread()");
+        printf("CHILD %d: Read '%c'\n", (int) getpid(), r);
+        if (r != c)
+            PANIC_EXIT("requests were not served in the expected order");
+    }
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+    exit(0);
+}
+
+static void wait_child(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0)
+        PANIC_EXIT("waitpid()");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        PANIC_EXIT("child failed");
+}
+
+int main() {
+    rl_init_library();
+
+    rl_descriptor lfd = rl_open(FILENAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (lfd.fd < 0 || lfd.file == NULL)
+        PANIC_EXIT("rl_open()");
+    if (write(lfd.fd, "----------", 10) != 10)
+        PANIC_EXIT("write()");
+
+    struct flock lck;
+    lck.l_type = F_RDLCK;
+    lck.l_whence = SEEK_SET;
+    lck.l_start = 0;
+    lck.l_len = 10;
+
+    printf("FIFO policy\n");
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    pid_t writer = spawn(F_WRLCK, 'W', 0);
+    usleep(300000);
+    pid_t reader = spawn(F_RDLCK, 'W', 1);
+    usleep(300000);
+
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    wait_child(writer);
+    wait_child(reader);
+
+    printf("Writer-preferring policy\n");
+    if (rl_set_wait_policy(lfd, RL_POLICY_WRITER_PREFERRING) < 0)
+        PANIC_EXIT("rl_set_wait_policy()");
+
+    lck.l_type = F_WRLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    reader = spawn(F_RDLCK, 'X', 0);
+    usleep(300000);
+    writer = spawn(F_WRLCK, 'X', 0);
+    usleep(300000);
+
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    wait_child(writer);
+    wait_child(reader);
+
+    printf("Handoff mode\n");
+    if (rl_set_handoff(lfd, 1) < 0)
+        PANIC_EXIT("rl_set_handoff()");
+
+    lck.l_type = F_WRLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    writer = spawn(F_WRLCK, 'H', 0);
+    usleep(300000);
+
+    lck.l_type = F_UNLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+
+    lck.l_type = F_WRLCK;
+    if (rl_fcntl(lfd, F_GETLK, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    if (lfd.file->nb_locks != 1 || lck.l_type != F_WRLCK || lck.l_pid != writer)
+        PANIC_EXIT("lock was not handed off to the waiting writer");
+    printf("PARENT: Lock handed off to the waiting writer\n");
+
+    lck.l_type = F_WRLCK;
+    if (rl_fcntl(lfd, F_SETLK, &lck) == 0 || errno != EAGAIN)
+        PANIC_EXIT("rl_fcntl()");
+    printf("PARENT: Could not take the lock back\n");
+
+    if (rl_fcntl(lfd, F_SETLKW, &lck) < 0)
+        PANIC_EXIT("rl_fcntl()");
+    wait_child(writer);
+
+    if (rl_close(lfd) < 0)
+        PANIC_EXIT("rl_close()");
+
+    if (unlink(FILENAME) < 0)
+        PANIC_EXIT("unlink()");
+
+    return 0;
+}